@@ -0,0 +1,148 @@
+#include<iostream>
+#include<sstream>
+#include<cstdlib>
+#include<stdexcept>
+#include<cmath>
+#include<algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include "sfs.hpp"
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{threads        |0     | Max number of threads to test (0 means all the cores).}"
+    "{max_errors     |0     | specifies how many fouls are allowed before a voxel is considered empty.}"
+    "{oar_th         |0.5   | Occupancy area rate.}"
+    "{scene          |<none>| Set the scene dimensions in WCS units. Format xorig:yorig:zorig:xsize:ysize:zsize}"
+    "{vsize          |<none>| Set the max size of a voxel.}"
+    "{nviews         |<none>| Number of views.}"
+    "{@cam_0         |<none>| Camera parameters for view 0...}"
+    "{@cam_n         |<none>| ... camera parameters for view N.}"
+    "{@view_0        |<none>| Foreground image for view 0...}"
+    "{@view_n        |<none>| ... foreground image for view N.}"
+    ;
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Benchmark the scaling of the octree visual hull with the number of threads.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+
+      std::istringstream buffer (parser.get<std::string>("scene"));
+      fsiv::Voxel scene;
+      buffer >> scene;
+      if (!buffer)
+      {
+          std::cerr << "Error: Worng: cli parameter scene." << std::endl;
+          return EXIT_FAILURE;
+      }
+      float vsize = parser.get<float>("vsize");
+      if (vsize<=0.0f)
+      {
+          std::cerr << "Error: wrong CLI: parameter vsize>0.0" << std::endl;
+          return EXIT_FAILURE;
+      }
+      const size_t max_errors = parser.get<size_t>("max_errors");
+      const float oar_th = parser.get<float>("oar_th");
+      size_t n_views = parser.get<int>("nviews");
+      int first_arg = 1;
+      while (first_arg<argc && argv[first_arg][0]=='-')
+          ++first_arg;
+      if (size_t(argc-first_arg) != n_views*2)
+      {
+          std::cerr << "Error: wrong cli." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::vector<fsiv::View> views;
+      for(size_t v=0; v<n_views; ++v)
+      {
+          fsiv::CameraParameters cparams;
+          if (!cparams.read_from_file(argv[first_arg+v]))
+          {
+              std::cerr << "Error: could not load camera parameters form file["
+                        << argv[first_arg+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          cv::Mat fg_img = cv::imread(argv[first_arg+n_views+v], cv::IMREAD_GRAYSCALE);
+          if (fg_img.empty())
+          {
+              std::cerr << "Error: could not load forground image form file["
+                        << argv[first_arg+n_views+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          views.push_back(fsiv::View(argv[first_arg+n_views+v], fg_img, cparams));
+      }
+      float max_dim = std::max(scene.x_dim(), scene.y_dim());
+      max_dim = std::max(max_dim, scene.z_dim());
+      size_t max_levels = std::ceil(std::log2(max_dim/vsize));
+
+      int max_threads = 1;
+#ifdef USE_OPENMP
+      max_threads = omp_get_num_procs();
+#else
+      std::cout << "Warning: built without OpenMP (WITH_OPENMP=OFF), only one thread is tested." << std::endl;
+#endif
+      if (parser.get<int>("threads")>0)
+          max_threads = std::min(max_threads, parser.get<int>("threads"));
+
+      std::string reference;
+      double t_octree_1 = 0.0, t_linear_1 = 0.0;
+      std::cout << "threads octree(s) speed-up linear(s) speed-up nodes identical" << std::endl;
+      for (int t=1; t<=max_threads; ++t)
+      {
+#ifdef USE_OPENMP
+          omp_set_num_threads(t);
+#endif
+          int64_t t0 = cv::getTickCount();
+          fsiv::Octree octree;
+          fsiv::compute_visual_hull(views, octree, scene, max_levels, max_errors, oar_th);
+          const double t_octree = (cv::getTickCount()-t0)/cv::getTickFrequency();
+
+          t0 = cv::getTickCount();
+          fsiv::LinearOctree linear;
+          fsiv::compute_visual_hull(views, linear, scene, max_levels, max_errors, oar_th);
+          const double t_linear = (cv::getTickCount()-t0)/cv::getTickFrequency();
+
+          std::ostringstream octree_text, linear_text;
+          octree_text << octree;
+          linear_text << linear;
+          if (t==1)
+          {
+              reference = octree_text.str();
+              t_octree_1 = t_octree;
+              t_linear_1 = t_linear;
+          }
+          const bool identical = octree_text.str()==reference &&
+                  linear_text.str()==reference;
+          std::cout << t << ' ' << t_octree << ' ' << t_octree_1/t_octree << ' '
+                    << t_linear << ' ' << t_linear_1/t_linear << ' '
+                    << linear.size() << ' ' << (identical ? "yes" : "NO") << std::endl;
+          if (!identical)
+              retCode = EXIT_FAILURE;
+      }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
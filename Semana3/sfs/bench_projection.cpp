@@ -0,0 +1,171 @@
+#include<iostream>
+#include<sstream>
+#include<cstdlib>
+#include<stdexcept>
+#include<cmath>
+#include<algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/calib3d.hpp>
+#include "sfs.hpp"
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{scene          |<none>| Set the scene dimensions in WCS units. Format xorig:yorig:zorig:xsize:ysize:zsize}"
+    "{vsize          |<none>| Set the voxel side size in WCS units.}"
+    "{nviews         |<none>| Number of views.}"
+    "{@cam_0         |<none>| Camera parameters for view 0...}"
+    "{@cam_n         |<none>| ... camera parameters for view N.}"
+    "{@view_0        |<none>| Foreground image for view 0...}"
+    "{@view_n        |<none>| ... foreground image for view N.}"
+    ;
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Benchmark the voxel projection used by the visual hull.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+
+      std::istringstream buffer (parser.get<std::string>("scene"));
+      fsiv::Voxel scene;
+      buffer >> scene;
+      if (!buffer)
+      {
+          std::cerr << "Error: Worng: cli parameter scene." << std::endl;
+          return EXIT_FAILURE;
+      }
+      float vsize = parser.get<float>("vsize");
+      size_t n_views = parser.get<int>("nviews");
+      int first_arg = 1;
+      while (first_arg<argc && argv[first_arg][0]=='-')
+          ++first_arg;
+      if (size_t(argc-first_arg) != n_views*2)
+      {
+          std::cerr << "Error: wrong cli." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::vector<fsiv::View> views;
+      std::vector<fsiv::CameraParameters> cameras;
+      for(size_t v=0; v<n_views; ++v)
+      {
+          fsiv::CameraParameters cparams;
+          if (!cparams.read_from_file(argv[first_arg+v]))
+          {
+              std::cerr << "Error: could not load camera parameters form file["
+                        << argv[first_arg+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          cv::Mat fg_img = cv::imread(argv[first_arg+n_views+v], cv::IMREAD_GRAYSCALE);
+          if (fg_img.empty())
+          {
+              std::cerr << "Error: could not load forground image form file["
+                        << argv[first_arg+n_views+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          views.push_back(fsiv::View(argv[first_arg+n_views+v], fg_img, cparams));
+          cameras.push_back(cparams);
+      }
+
+      fsiv::VoxelSet vs(scene, vsize);
+      const double n_tests = double(vs.size())*views.size();
+
+      //Before: build the vertices matrix and use cv::projectPoints.
+      int64_t checksum_old = 0;
+      int64_t t0 = cv::getTickCount();
+      for (size_t idx=0; idx<vs.size(); ++idx)
+      {
+          const fsiv::Voxel voxel = vs.voxel(idx);
+          for (size_t v=0; v<views.size(); ++v)
+              checksum_old += views[v].compute_bounding_box(voxel.vertices()).area();
+      }
+      const double t_old = (cv::getTickCount()-t0)/cv::getTickFrequency();
+
+      //After: closed-form projection into stack storage.
+      int64_t checksum_new = 0;
+      t0 = cv::getTickCount();
+      for (size_t idx=0; idx<vs.size(); ++idx)
+      {
+          const fsiv::Voxel voxel = vs.voxel(idx);
+          for (size_t v=0; v<views.size(); ++v)
+              checksum_new += views[v].compute_bounding_box(voxel).area();
+      }
+      const double t_new = (cv::getTickCount()-t0)/cv::getTickFrequency();
+
+      std::cout << "Voxels: " << vs.size() << " Views: " << views.size() << std::endl;
+      std::cout << "cv::projectPoints: " << t_old << " s, "
+                << n_tests/t_old << " voxels/s" << std::endl;
+      std::cout << "closed-form      : " << t_new << " s, "
+                << n_tests/t_new << " voxels/s" << std::endl;
+      std::cout << "speed-up: " << t_old/t_new << "x" << std::endl;
+      std::cout << "sum of bbox areas: " << checksum_old << " vs "
+                << checksum_new << std::endl;
+
+      //Batched projection of the voxel origins of the set: one call per view.
+      std::vector<cv::Point3f> points(vs.size());
+      std::vector<float> X(vs.size()), Y(vs.size()), Z(vs.size());
+      for (size_t idx=0; idx<vs.size(); ++idx)
+      {
+          const fsiv::Voxel voxel = vs.voxel(idx);
+          points[idx] = cv::Point3f(voxel.x(), voxel.y(), voxel.z());
+          X[idx] = voxel.x();
+          Y[idx] = voxel.y();
+          Z[idx] = voxel.z();
+      }
+      const double n_points = double(points.size())*views.size();
+      std::vector<cv::Point2f> uv_cv;
+      t0 = cv::getTickCount();
+      for (size_t v=0; v<views.size(); ++v)
+          cv::projectPoints(points, cameras[v].rotation_vector(),
+                            cameras[v].translation_vector(),
+                            cameras[v].camera_matrix(),
+                            cameras[v].distortion_coeffs(), uv_cv);
+      const double t_cv = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      std::cout << "Points: " << points.size() << " Views: " << views.size() << std::endl;
+      std::cout << "cv::projectPoints (batch): " << t_cv << " s, "
+                << n_points/t_cv << " points/s" << std::endl;
+      std::vector<float> u(points.size()), v(points.size());
+      const fsiv::ProjectionKernel kernels[3] = {fsiv::PROJECTION_SCALAR,
+                                                 fsiv::PROJECTION_AVX2,
+                                                 fsiv::PROJECTION_NEON};
+      for (int k=0; k<3; ++k)
+      {
+          if (!fsiv::projection_kernel_supported(kernels[k]))
+              continue;
+          t0 = cv::getTickCount();
+          for (size_t i=0; i<views.size(); ++i)
+              fsiv::project_points(views[i].projection_model(), &X[0], &Y[0], &Z[0],
+                                   X.size(), &u[0], &v[0], kernels[k]);
+          const double t_k = (cv::getTickCount()-t0)/cv::getTickFrequency();
+          //The error is measured for the last view against cv::projectPoints.
+          double max_err = 0.0;
+          for (size_t p=0; p<points.size(); ++p)
+              max_err = std::max(max_err, double(std::max(std::abs(u[p]-uv_cv[p].x),
+                                                           std::abs(v[p]-uv_cv[p].y))));
+          std::cout << fsiv::projection_kernel_name(kernels[k]) << " (batch): "
+                    << t_k << " s, " << n_points/t_k << " points/s, speed-up: "
+                    << t_cv/t_k << "x, max. error: " << max_err << " px"
+                    << std::endl;
+      }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
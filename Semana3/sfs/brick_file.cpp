@@ -0,0 +1,532 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "brick_file.hpp"
+
+namespace fsiv
+{
+
+static std::string bricks_signature = "voxelbricks";
+
+/** @brief Number of bricks compressed in parallel before writing them. */
+static const size_t brick_batch = 1024;
+
+/** @brief Number of bricks needed to cover n voxels.*/
+static size_t
+bricks_for(const size_t n)
+{
+    return (n + BRICK_SIZE - 1) / BRICK_SIZE;
+}
+
+/**
+ * @brief Get the rows of a brick with all the voxels inside the voxelset set.
+ * @param[in] b0 are the coordinates of the first voxel of the brick.
+ */
+static void
+full_brick_rows(const size_t size[3], const size_t b0[3], std::uint32_t* rows)
+{
+    const size_t nx = std::min(BRICK_SIZE, size[0] - b0[0]);
+    const std::uint32_t row = nx == 32 ? ~std::uint32_t(0)
+                                       : (std::uint32_t(1) << nx) - 1;
+    for (size_t lz = 0; lz < BRICK_SIZE; ++lz)
+        for (size_t ly = 0; ly < BRICK_SIZE; ++ly)
+            rows[lz * BRICK_SIZE + ly] = (b0[1] + ly < size[1] && b0[2] + lz < size[2])
+                    ? row : 0;
+}
+
+/** @brief Get the first voxel of a brick.*/
+static void
+brick_origin(const size_t bricks[3], const size_t b, size_t b0[3])
+{
+    b0[0] = (b % bricks[0]) * BRICK_SIZE;
+    b0[1] = ((b / bricks[0]) % bricks[1]) * BRICK_SIZE;
+    b0[2] = (b / (bricks[0] * bricks[1])) * BRICK_SIZE;
+}
+
+/** @brief Get the rows of a brick of a voxelset.*/
+static void
+get_brick_rows(const VoxelSet& vs, const size_t b0[3], std::uint32_t* rows)
+{
+    for (size_t lz = 0; lz < BRICK_SIZE; ++lz)
+        for (size_t ly = 0; ly < BRICK_SIZE; ++ly)
+        {
+            const size_t y = b0[1] + ly, z = b0[2] + lz;
+            std::uint32_t row = 0;
+            if (y < vs.y_size() && z < vs.z_size())
+                for (size_t lx = 0; lx < BRICK_SIZE && b0[0] + lx < vs.x_size(); ++lx)
+                    if (vs.occupancy(b0[0] + lx, y, z))
+                        row |= std::uint32_t(1) << lx;
+            rows[lz * BRICK_SIZE + ly] = row;
+        }
+}
+
+bool
+save_bricked(const std::string& fname, const VoxelSet& vs, const int level)
+{
+    std::ofstream out(fname, std::ios::binary);
+    if (!out)
+        return false;
+    const size_t size[3] = {vs.x_size(), vs.y_size(), vs.z_size()};
+    const size_t bricks[3] = {bricks_for(size[0]), bricks_for(size[1]),
+                              bricks_for(size[2])};
+    const size_t n = bricks[0] * bricks[1] * bricks[2];
+
+    out << bricks_signature << std::endl;
+    out << std::scientific << std::setprecision(9);
+    out << "vsize = " << vs.vsize() << std::endl;
+    out << "bcuve = " << vs.bounding_cuve() << std::endl;
+    out.unsetf(std::ios::scientific);
+    out << "xsize = " << size[0] << std::endl;
+    out << "ysize = " << size[1] << std::endl;
+    out << "zsize = " << size[2] << std::endl;
+    out << "bricks = " << bricks[0] << ' ' << bricks[1] << ' ' << bricks[2]
+        << std::endl;
+    out << '#';
+
+    //The index is written when the sizes of the bricks are known.
+    std::vector<BrickEntry> index(n);
+    const std::streampos index_pos = out.tellp();
+    if (n > 0)
+        out.write(reinterpret_cast<const char*>(&index[0]), n * sizeof(BrickEntry));
+
+    std::vector<std::vector<Bytef>> packed(std::min(n, brick_batch));
+    std::uint64_t offset = 0;
+    for (size_t first = 0; first < n && out; first += brick_batch)
+    {
+        const size_t last = std::min(n, first + brick_batch);
+        bool error = false;
+#pragma omp parallel for schedule(dynamic) reduction(||:error)
+        for (size_t b = first; b < last; ++b)
+        {
+            std::uint32_t rows[BRICK_ROWS], full[BRICK_ROWS];
+            size_t b0[3];
+            brick_origin(bricks, b, b0);
+            get_brick_rows(vs, b0, rows);
+            full_brick_rows(size, b0, full);
+            std::vector<Bytef>& dest = packed[b - first];
+            dest.clear();
+            const bool empty = std::find_if(rows, rows + BRICK_ROWS,
+                                            [](std::uint32_t r) { return r != 0; })
+                    == rows + BRICK_ROWS;
+            if (empty)
+                index[b].kind = BRICK_EMPTY;
+            else if (std::equal(rows, rows + BRICK_ROWS, full))
+                index[b].kind = BRICK_FULL;
+            else
+            {
+                index[b].kind = BRICK_DEFLATED;
+                uLongf len = compressBound(sizeof(rows));
+                dest.resize(len);
+                if (compress2(&dest[0], &len, reinterpret_cast<const Bytef*>(rows),
+                              sizeof(rows), level) != Z_OK)
+                    error = true;
+                dest.resize(len);
+            }
+        }
+        if (error)
+            throw std::runtime_error("ZLIB error");
+        for (size_t b = first; b < last; ++b)
+        {
+            const std::vector<Bytef>& src = packed[b - first];
+            index[b].offset = offset;
+            index[b].size = std::uint32_t(src.size());
+            if (!src.empty())
+                out.write(reinterpret_cast<const char*>(&src[0]), src.size());
+            offset += src.size();
+        }
+    }
+    if (n > 0)
+    {
+        out.seekp(index_pos);
+        out.write(reinterpret_cast<const char*>(&index[0]), n * sizeof(BrickEntry));
+    }
+    return bool(out);
+}
+
+BrickedVoxelSet::BrickedVoxelSet():
+    _vsize(0.0f), _fd(-1), _map(nullptr), _map_size(0), _index(nullptr),
+    _data(nullptr)
+{
+    _size[0] = _size[1] = _size[2] = 0;
+    _bricks[0] = _bricks[1] = _bricks[2] = 0;
+}
+
+BrickedVoxelSet::~BrickedVoxelSet()
+{
+    close();
+}
+
+void
+BrickedVoxelSet::close()
+{
+    if (_map != nullptr)
+        munmap(const_cast<std::uint8_t*>(_map), _map_size);
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+    _map = _index = _data = nullptr;
+    _map_size = 0;
+    _size[0] = _size[1] = _size[2] = 0;
+    _bricks[0] = _bricks[1] = _bricks[2] = 0;
+    _cache.clear();
+    _cached.reset();
+}
+
+bool
+BrickedVoxelSet::is_open() const
+{
+    return _map != nullptr;
+}
+
+bool
+BrickedVoxelSet::open(const std::string& fname)
+{
+    close();
+    _fd = ::open(fname.c_str(), O_RDONLY);
+    if (_fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(_fd, &st) != 0 || st.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+    _map_size = size_t(st.st_size);
+    void* map = mmap(nullptr, _map_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (map == MAP_FAILED)
+    {
+        _map_size = 0;
+        close();
+        return false;
+    }
+    _map = static_cast<const std::uint8_t*>(map);
+
+    //The text header ends at the flag '#'.
+    const std::uint8_t* flag = std::find(_map, _map + std::min(_map_size, size_t(4096)),
+                                         std::uint8_t('#'));
+    if (flag == _map + std::min(_map_size, size_t(4096)))
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: binary flag.");
+    }
+    std::istringstream in(std::string(_map, flag));
+    std::string signature, key, sep;
+    in >> signature;
+    if (!in || signature != bricks_signature)
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: signature.");
+    }
+    in >> key >> sep >> _vsize;
+    if (!in || key != "vsize")
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: vsize");
+    }
+    in >> key >> sep >> _bcuve;
+    if (!in || key != "bcuve")
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: bounding cuve");
+    }
+    const char* size_keys[3] = {"xsize", "ysize", "zsize"};
+    for (int a = 0; a < 3; ++a)
+    {
+        in >> key >> sep >> _size[a];
+        if (!in || key != size_keys[a])
+        {
+            close();
+            throw std::runtime_error(std::string("Wrong Input Format: ") + size_keys[a]);
+        }
+    }
+    in >> key >> sep >> _bricks[0] >> _bricks[1] >> _bricks[2];
+    if (!in || key != "bricks" || _bricks[0] != bricks_for(_size[0]) ||
+            _bricks[1] != bricks_for(_size[1]) || _bricks[2] != bricks_for(_size[2]))
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: bricks");
+    }
+    _index = flag + 1;
+    _data = _index + n_bricks() * sizeof(BrickEntry);
+    if (_data > _map + _map_size)
+    {
+        close();
+        throw std::runtime_error("Wrong Input Format: brick index");
+    }
+    _cache.assign(n_bricks(), std::vector<std::uint32_t>());
+    _cached.reset(new std::atomic<const std::uint32_t*>[n_bricks()]);
+    for (size_t b = 0; b < n_bricks(); ++b)
+        _cached[b].store(nullptr);
+    return true;
+}
+
+size_t
+BrickedVoxelSet::x_size () const
+{
+    return _size[0];
+}
+
+size_t
+BrickedVoxelSet::y_size () const
+{
+    return _size[1];
+}
+
+size_t
+BrickedVoxelSet::z_size () const
+{
+    return _size[2];
+}
+
+float
+BrickedVoxelSet::vsize() const
+{
+    return _vsize;
+}
+
+const Voxel&
+BrickedVoxelSet::bounding_cuve() const
+{
+    return _bcuve;
+}
+
+Voxel
+BrickedVoxelSet::voxel(const size_t x, const size_t y, const size_t z) const
+{
+    CV_Assert (x<x_size() && y<y_size() && z<z_size());
+    return Voxel(_bcuve.x()+_vsize*x, _bcuve.y()+_vsize*y, _bcuve.z()+_vsize*z,
+                 _vsize, _vsize, _vsize);
+}
+
+size_t
+BrickedVoxelSet::x_bricks() const
+{
+    return _bricks[0];
+}
+
+size_t
+BrickedVoxelSet::y_bricks() const
+{
+    return _bricks[1];
+}
+
+size_t
+BrickedVoxelSet::z_bricks() const
+{
+    return _bricks[2];
+}
+
+size_t
+BrickedVoxelSet::n_bricks() const
+{
+    return _bricks[0] * _bricks[1] * _bricks[2];
+}
+
+size_t
+BrickedVoxelSet::brick_index(const size_t x, const size_t y, const size_t z) const
+{
+    return ((z / BRICK_SIZE) * _bricks[1] + y / BRICK_SIZE) * _bricks[0]
+            + x / BRICK_SIZE;
+}
+
+/** @brief Read an entry of the index (the mapped index may be unaligned).*/
+static BrickEntry
+brick_entry(const std::uint8_t* index, const size_t b)
+{
+    BrickEntry e;
+    std::memcpy(&e, index + b * sizeof(BrickEntry), sizeof(BrickEntry));
+    return e;
+}
+
+BrickKind
+BrickedVoxelSet::brick_kind(const size_t b) const
+{
+    CV_Assert(b < n_bricks());
+    return static_cast<BrickKind>(brick_entry(_index, b).kind);
+}
+
+void
+BrickedVoxelSet::read_brick(const size_t b, std::uint32_t* rows) const
+{
+    CV_Assert(b < n_bricks());
+    const BrickEntry e = brick_entry(_index, b);
+    if (e.kind == BRICK_EMPTY)
+        std::fill(rows, rows + BRICK_ROWS, std::uint32_t(0));
+    else if (e.kind == BRICK_FULL)
+    {
+        size_t b0[3];
+        brick_origin(_bricks, b, b0);
+        full_brick_rows(_size, b0, rows);
+    }
+    else
+    {
+        uLongf len = BRICK_ROWS * sizeof(std::uint32_t);
+        if (e.kind != BRICK_DEFLATED ||
+                e.offset + e.size > std::uint64_t((_map + _map_size) - _data) ||
+                uncompress(reinterpret_cast<Bytef*>(rows), &len, _data + e.offset,
+                           e.size) != Z_OK ||
+                len != BRICK_ROWS * sizeof(std::uint32_t))
+            throw std::runtime_error("Wrong Input Format: ZLIB uncompress error.");
+    }
+}
+
+const std::uint32_t*
+BrickedVoxelSet::cached_brick(const size_t b) const
+{
+    const std::uint32_t* rows = _cached[b].load(std::memory_order_acquire);
+    if (rows == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(_locks[b % 64]);
+        rows = _cached[b].load(std::memory_order_relaxed);
+        if (rows == nullptr)
+        {
+            _cache[b].resize(BRICK_ROWS);
+            read_brick(b, &_cache[b][0]);
+            rows = &_cache[b][0];
+            _cached[b].store(rows, std::memory_order_release);
+        }
+    }
+    return rows;
+}
+
+bool
+BrickedVoxelSet::occupancy(const size_t x, const size_t y, const size_t z) const
+{
+    const size_t b = brick_index(x, y, z);
+    const BrickKind kind = brick_kind(b);
+    if (kind != BRICK_DEFLATED)
+        return kind == BRICK_FULL;
+    const std::uint32_t* rows = cached_brick(b);
+    return (rows[(z % BRICK_SIZE) * BRICK_SIZE + y % BRICK_SIZE] >> (x % BRICK_SIZE)) & 1;
+}
+
+void
+BrickedVoxelSet::release_brick(const size_t b)
+{
+    CV_Assert(b < n_bricks());
+    _cached[b].store(nullptr);
+    std::vector<std::uint32_t>().swap(_cache[b]);
+}
+
+void
+BrickedVoxelSet::to_voxelset(VoxelSet& vs) const
+{
+    vs.reset(_bcuve, _vsize, false);
+    if (vs.x_size()!=x_size() || vs.y_size()!=y_size() || vs.z_size()!=z_size())
+        throw std::runtime_error("Wrong Input Format: wrong dimensions.");
+    bool error = false;
+#pragma omp parallel for schedule(dynamic) reduction(||:error)
+    for (size_t b = 0; b < n_bricks(); ++b)
+    {
+        if (brick_kind(b) == BRICK_EMPTY)
+            continue;
+        std::uint32_t rows[BRICK_ROWS];
+        try
+        {
+            read_brick(b, rows);
+        }
+        catch (std::exception&)
+        {
+            error = true;
+            continue;
+        }
+        size_t b0[3];
+        brick_origin(_bricks, b, b0);
+        for (size_t r = 0; r < BRICK_ROWS; ++r)
+            for (std::uint32_t bits = rows[r]; bits; bits &= bits - 1)
+                vs.set_occupancy(b0[0] + __builtin_ctz(bits),
+                                 b0[1] + r % BRICK_SIZE, b0[2] + r / BRICK_SIZE,
+                                 true);
+    }
+    if (error)
+        throw std::runtime_error("Wrong Input Format: ZLIB uncompress error.");
+}
+
+void
+save_as_pointcloud_WRML (std::ostream& out, const BrickedVoxelSet& vs,
+                         const cv::Scalar & _color)
+{
+  out << "#VRML V2.0 utf8\n";
+  out << "Transform\n";
+  out << "{\n";
+  out << "  children\n";
+  out << "  Shape\n";
+  out << "  {\n";
+  out << "    appearance Appearance\n";
+  out << "    {\n";
+  out << "      material Material\n";
+  out << "      {\n";
+  out << "       emissiveColor " << _color[0]/255.0 << ' ' << _color[1]/255.0 << ' ' << _color[2]/255.0 << "\n";
+  out << "      }\n";
+  out << "    }\n";
+  out << "    geometry PointSet\n";
+  out << "    {\n";
+  out << "      coord Coordinate\n";
+  out << "      {\n";
+  out << "        point\n";
+  out << "          [\n";
+  std::vector<std::uint32_t> rows(BRICK_ROWS);
+  const Voxel& bc = vs.bounding_cuve();
+  const float half = vs.vsize() / 2;
+  size_t b0[3];
+  const size_t bricks[3] = {vs.x_bricks(), vs.y_bricks(), vs.z_bricks()};
+  for (size_t b = 0; b < vs.n_bricks(); ++b)
+  {
+    if (vs.brick_kind(b) == BRICK_EMPTY)
+      continue;
+    vs.read_brick(b, &rows[0]);
+    brick_origin(bricks, b, b0);
+    for (size_t r = 0; r < BRICK_ROWS; ++r)
+      for (std::uint32_t bits = rows[r]; bits; bits &= bits - 1)
+      {
+        const size_t x = b0[0] + __builtin_ctz(bits);
+        const size_t y = b0[1] + r % BRICK_SIZE;
+        const size_t z = b0[2] + r / BRICK_SIZE;
+        out << (bc.x() + vs.vsize()*x) + half << ' '
+            << (bc.y() + vs.vsize()*y) + half << ' '
+            << (bc.z() + vs.vsize()*z) + half << std::endl;
+      }
+  }
+  out << "         ]\n";
+  out << "      }\n";
+  out << "    }\n";
+  out << "  }\n";
+  out << "}\n";
+}
+
+bool
+is_bricked_file(const std::string& fname)
+{
+    std::ifstream in(fname);
+    std::string signature;
+    in >> signature;
+    return in && signature == bricks_signature;
+}
+
+bool
+load_voxelset(const std::string& fname, VoxelSet& vs)
+{
+    if (is_bricked_file(fname))
+    {
+        BrickedVoxelSet bvs;
+        if (!bvs.open(fname))
+            return false;
+        bvs.to_voxelset(vs);
+        return true;
+    }
+    std::ifstream in(fname);
+    if (!in)
+        return false;
+    in >> vs;
+    return true;
+}
+
+} //namespace fsiv
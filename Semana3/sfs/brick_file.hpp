@@ -0,0 +1,159 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#include "voxel.hpp"
+#include "voxelset.hpp"
+
+namespace fsiv
+{
+
+/*
+ * The chunked (bricked) voxelset file format.
+ *
+ * The voxelset is split in bricks of 32x32x32 voxels, each one compressed on
+ * its own, so a brick can be read without inflating the rest of the file.
+ * The file is:
+ *  - a text header as the one of operator<<(std::ostream&, const VoxelSet&)
+ *    with the signature "voxelbricks" plus the number of bricks per axis,
+ *  - the flag '#',
+ *  - the brick index: a BrickEntry per brick (x fastest, then y, then z),
+ *  - the brick data.
+ * A brick is 32*32 rows of 32 voxels, a row is a 32 bits little endian word
+ * where bit x is the voxel x. The voxels out of the voxelset are zero.
+ * Uniform bricks (all empty or all full) are only stored in the index.
+ */
+
+/** @brief Voxels per side of a brick. */
+static const size_t BRICK_SIZE = 32;
+/** @brief Rows of voxels of a brick. */
+static const size_t BRICK_ROWS = BRICK_SIZE * BRICK_SIZE;
+
+/** @brief Kinds of brick in the brick index. */
+typedef enum {
+    BRICK_EMPTY=0,   //all the voxels are empty (no data).
+    BRICK_FULL=1,    //all the voxels are occupied (no data).
+    BRICK_DEFLATED=2 //zlib compressed rows.
+} BrickKind;
+
+/** @brief An entry of the brick index. */
+struct BrickEntry
+{
+    std::uint64_t offset; //from the start of the brick data.
+    std::uint32_t size;   //compressed size in bytes.
+    std::uint32_t kind;   //a BrickKind.
+};
+
+/**
+ * @brief Save a voxelset in the bricked format.
+ * The bricks are compressed in parallel (OpenMP) by batches, so only a batch
+ * of compressed bricks is kept in memory.
+ * @return true if success.
+ */
+bool save_bricked(const std::string& fname, const VoxelSet& vs,
+                  const int level=6);
+
+/**
+ * @brief The BrickedVoxelSet class.
+ * Read only access to a voxelset saved in the bricked format. The file is
+ * memory mapped and each brick is inflated on the first access to it,
+ * so grids that do not fit in memory can be processed brick by brick.
+ */
+class BrickedVoxelSet
+{
+public:
+    BrickedVoxelSet();
+    ~BrickedVoxelSet();
+
+    /**
+     * @brief Map a bricked voxelset file.
+     * @throw std::runtime_error if the file has a wrong format.
+     * @return false if the file could not be opened.
+     */
+    bool open(const std::string& fname);
+
+    /** @brief Unmap the file and release the inflated bricks.*/
+    void close();
+
+    bool is_open() const;
+
+    size_t x_size () const;
+    size_t y_size () const;
+    size_t z_size () const;
+    float vsize() const;
+    const Voxel& bounding_cuve() const;
+    Voxel voxel(const size_t x, const size_t y, const size_t z) const;
+
+    /** @brief Number of bricks along each axis and in total.*/
+    size_t x_bricks() const;
+    size_t y_bricks() const;
+    size_t z_bricks() const;
+    size_t n_bricks() const;
+
+    /** @brief Index of the brick with the voxel (x,y,z).*/
+    size_t brick_index(const size_t x, const size_t y, const size_t z) const;
+
+    BrickKind brick_kind(const size_t b) const;
+
+    /**
+     * @brief Inflate a brick into an user buffer (no cache, thread safe).
+     * @param[out] rows are the BRICK_ROWS rows of the brick (row ly + 32*lz).
+     */
+    void read_brick(const size_t b, std::uint32_t* rows) const;
+
+    /**
+     * @brief Get the occupancy of a voxel.
+     * The brick is inflated and cached on the first access to it (thread safe).
+     * The coordinates are not checked.
+     */
+    bool occupancy(const size_t x, const size_t y, const size_t z) const;
+
+    /** @brief Release the cached rows of a brick.
+     * @warning it is not thread safe with accesses to the same brick. */
+    void release_brick(const size_t b);
+
+    /** @brief Inflate all the bricks into a dense voxelset (in parallel).
+     * The storage and layout of vs are kept. */
+    void to_voxelset(VoxelSet& vs) const;
+
+private:
+    const std::uint32_t* cached_brick(const size_t b) const;
+
+    Voxel _bcuve;
+    float _vsize;
+    size_t _size[3];
+    size_t _bricks[3];
+    int _fd;
+    const std::uint8_t* _map;
+    size_t _map_size;
+    const std::uint8_t* _index;
+    const std::uint8_t* _data;
+    mutable std::vector<std::vector<std::uint32_t>> _cache;
+    mutable std::unique_ptr<std::atomic<const std::uint32_t*>[]> _cached;
+    mutable std::mutex _locks[64];
+};
+
+/** @brief Save a bricked voxelset as a point cloud in vrml 2.0 format.
+ * The bricks are streamed one by one, so the voxelset is never fully
+ * inflated (the points are sorted by bricks).*/
+void save_as_pointcloud_WRML (std::ostream& out, const BrickedVoxelSet& vs,
+                              const cv::Scalar & color=cv::Scalar(255, 255, 255));
+
+/** @brief Test if a file is a bricked voxelset by its signature.*/
+bool is_bricked_file(const std::string& fname);
+
+/**
+ * @brief Load a voxelset file in the plain or the bricked format.
+ * The format is given by the signature of the file. The storage and layout
+ * of vs are kept.
+ * @return false if the file could not be opened.
+ */
+bool load_voxelset(const std::string& fname, VoxelSet& vs);
+
+} //namespace fsiv
@@ -1,5 +1,11 @@
 #include <cmath>
+#include <cstdlib>
+#include <algorithm>
 #include "sfs.hpp"
+#include "morton.hpp"
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
@@ -89,17 +95,60 @@ namespace fsiv
         _z_size = bc.z_dim() / vsize;
         _xy_size = _x_size * _y_size;
 
+        _bcuve = bc;
         _vsize = vsize;
 
-        if (init_occ_state)
-            _occupancy_map = cv::Mat::ones(1, _x_size * _y_size * _z_size, CV_8UC1);
+        if (_layout == MORTON_LAYOUT)
+        {
+            //Bits needed by each axis and the encoding LUTs.
+            const size_t dims[3] = {_x_size, _y_size, _z_size};
+            int bits[3] = {0, 0, 0};
+            for (int a = 0; a < 3; ++a)
+                while ((size_t(1) << bits[a]) < dims[a])
+                    ++bits[a];
+            morton_masks(bits[0], bits[1], bits[2],
+                         _morton_mask[0], _morton_mask[1], _morton_mask[2]);
+            _morton_bits = bits[0] + bits[1] + bits[2];
+            CV_Assert(_morton_bits < 64);
+            std::vector<std::uint64_t>* luts[3] = {&_morton_x, &_morton_y, &_morton_z};
+            for (int a = 0; a < 3; ++a)
+            {
+                luts[a]->resize(dims[a]);
+                for (size_t i = 0; i < dims[a]; ++i)
+                    (*luts[a])[i] = deposit_bits(i, _morton_mask[a]);
+            }
+        }
+
+        if (_storage == BIT_STORAGE)
+        {
+            _occupancy_map.release();
+            _occupancy_bits.assign(n_words(), 0);
+        }
         else
-            _occupancy_map = cv::Mat::zeros(1, _x_size * _y_size * _z_size, CV_8UC1);
+        {
+            _occupancy_bits.clear();
+            _occupancy_map = cv::Mat::zeros(1, size(), CV_8UC1);
+        }
+        if (init_occ_state)
+        {
+            //The padding of the morton layout is never occupied.
+            if (_layout == MORTON_LAYOUT)
+            {
+                for (size_t idx = 0; idx < size(); ++idx)
+                    if (valid_index(idx))
+                        set_occupancy(idx, true);
+            }
+            else
+                fill_occupancy(0, size(), true);
+        }
+        //The scores are kept with their depth.
+        set_score_depth(_score_depth);
 
         //
-        CV_Assert(size() == x_size() * y_size() * z_size());
-        CV_Assert(_occupancy_map.type() == CV_8UC1);
-        CV_Assert(_occupancy_map.rows == 1 && _occupancy_map.cols == size());
+        CV_Assert(_layout == MORTON_LAYOUT || size() == x_size() * y_size() * z_size());
+        CV_Assert(_storage == BIT_STORAGE || _occupancy_map.type() == CV_8UC1);
+        CV_Assert(_storage == BIT_STORAGE ||
+                  (_occupancy_map.rows == 1 && size_t(_occupancy_map.cols) == size()));
     }
 
     size_t
@@ -109,7 +158,10 @@ namespace fsiv
         size_t idx = 0;
         //TODO
 
-        idx = z * _xy_size + y * _x_size + x;
+        if (_layout == MORTON_LAYOUT)
+            idx = _morton_x[x] | _morton_y[y] | _morton_z[z];
+        else
+            idx = z * _xy_size + y * _x_size + x;
         // idx = z * x * _xy_size + y * x * _x_size + x;
 
         //
@@ -122,10 +174,19 @@ namespace fsiv
     {
         CV_Assert(index < size());
         //TODO
-        z = index / _xy_size;
-        size_t resto = index % _xy_size;
-        y = resto / _x_size;
-        x = resto % _x_size;
+        if (_layout == MORTON_LAYOUT)
+        {
+            x = extract_bits(index, _morton_mask[0]);
+            y = extract_bits(index, _morton_mask[1]);
+            z = extract_bits(index, _morton_mask[2]);
+        }
+        else
+        {
+            z = index / _xy_size;
+            size_t resto = index % _xy_size;
+            y = resto / _x_size;
+            x = resto % _x_size;
+        }
 
         //
         CV_Assert(x < x_size());
@@ -134,33 +195,27 @@ namespace fsiv
     }
 
     bool
-    VoxelSet::is_external(const size_t x, const size_t y, const size_t z) const
+    VoxelSet::is_external(const size_t x, const size_t y, const size_t z,
+                          const int connectivity) const
     {
         CV_Assert(x < x_size() && y < y_size() && z < z_size());
+        CV_Assert(connectivity == 6 || connectivity == 26);
         bool is_external = false;
-        //TODO
         //Remember: A voxel is considered external if it is in the limits
         //of the voxelset or any of its neighbors voxels is not occupied.
-        //Vamos, que si esta en la superficie de la figura
-
-        //Cada voxel tiene 26 vecinos
-
-        for (int i = 1; i <= 13; i++)
-        {
-            // En primer lugar será external si alguna de sus x, y, z valen 0, ya que esto indica que esta en una capa exterior
-            if (x == 0 || y == 0 || z == 0)
-            {
-                is_external = true;
-                break; // Si le falta un vecino ya es externo, no hay que seguir comprobando más
-            }
-            // Sera external si en las 13 posiciones anteriores y posteriores en occupancy no hay voxel (es 0)
-            if (this->_occupancy_map.at<uchar>(xyz2index(x, y, z) + i) == 0 || this->_occupancy_map.at<uchar>(xyz2index(x, y, z) - i) == 0)
-            {
-                is_external = true;
-                break; // Si le falta un vecino ya es externo, no hay que seguir comprobando más
-            }
-        }
-
+        if (x == 0 || y == 0 || z == 0 || x + 1 == x_size() ||
+            y + 1 == y_size() || z + 1 == z_size())
+            is_external = true;
+        for (int dz = -1; dz <= 1 && !is_external; ++dz)
+            for (int dy = -1; dy <= 1 && !is_external; ++dy)
+                for (int dx = -1; dx <= 1 && !is_external; ++dx)
+                {
+                    const int d = std::abs(dx) + std::abs(dy) + std::abs(dz);
+                    if (d == 0 || (connectivity == 6 && d > 1))
+                        continue;
+                    if (!occupancy(x + dx, y + dy, z + dz))
+                        is_external = true;
+                }
         //
         return is_external;
     }
@@ -222,6 +277,9 @@ namespace fsiv
 
         //
         CV_Assert(iimg().type() == CV_32S);
+        init_row_sums();
+        init_distances();
+        init_projection();
     }
 
     cv::Mat View::project_points(const cv::Mat &_3dPoints) const
@@ -321,9 +379,36 @@ namespace fsiv
         return area;
     }
 
+    /**
+     * @brief Occupied area rate of a voxel in one view.
+     * @return the OAR, or 1 if the projection is out of the image frame.
+     */
+    static float
+    voxelset_view_oar(const View &view, const cv::Point2f uv[8],
+                      const FootprintMode footprint)
+    {
+        int area = 0;
+        const int occupied = view.compute_occupied_area(uv, 8, footprint, area);
+        //Not take into account a view if the projection is out of the image frame (area==0).
+        if (area > 0)
+            return float(occupied) / area;
+        return 1.0f;
+    }
+
+    /**
+     * @brief Projection test of a voxel against one view.
+     * @return false if the projected bbox has not enough foreground area.
+     */
+    static bool
+    voxelset_view_test(const View &view, const cv::Point2f uv[8], const float OAR_th,
+                       const FootprintMode footprint)
+    {
+        return voxelset_view_oar(view, uv, footprint) >= OAR_th;
+    }
+
     static bool
     voxelset_projection_test(const Voxel &voxel, std::vector<View> const &views,
-                             const float OAR_th)
+                             const float OAR_th, const FootprintMode footprint)
     {
         bool is_occupied = true;
         //TODO:
@@ -333,130 +418,675 @@ namespace fsiv
         {
             // std::cout << "Vertices:\n"
             //           << voxel.vertices() << std::endl;
-            cv::Rect bbox = views[i].compute_bounding_box(voxel.vertices());
+            cv::Point2f uv[8];
+            views[i].project_voxel(voxel, uv);
 
             // if(bbox.contains(cv::Point(400,300)) && bbox.area()<=2000){
             //     std::cout<<"Entra";
             // }
 
+            is_occupied = voxelset_view_test(views[i], uv, OAR_th, footprint);
+        }
 
-            if (bbox.area() > 0)
+        //
+        return is_occupied;
+    }
+
+    /** @brief Voxels projected at once by the per voxel method. */
+    static const size_t voxel_block = 256;
+
+    /** @brief Work buffers of a block of voxels (structure of arrays). */
+    struct VoxelBlock
+    {
+        VoxelBlock():
+            idx(voxel_block), X(8 * voxel_block), Y(8 * voxel_block),
+            Z(8 * voxel_block), u(8 * voxel_block), v(8 * voxel_block),
+            oar(voxel_block)
+        {}
+        std::vector<size_t> idx; //the voxels still occupied.
+        std::vector<float> X, Y, Z; //their 8 corners (voxel k at [8k, 8k+8)).
+        std::vector<float> u, v; //the projected corners.
+        std::vector<float> oar; //the minimum OAR of the voxels (scores).
+    };
+
+    /**
+     * @brief Projection test of the voxels [begin, end) against all the views.
+     * For each view the corners of the voxels not rejected yet are projected
+     * in one batch (see View::project_points()) and then tested as
+     * voxelset_projection_test() does, so the result is the same.
+     * The voxels already empty are skipped and the ones rejected are set to
+     * empty.
+     * @return the number of voxels rejected.
+     */
+    static size_t
+    voxelset_block_test(const View *views, const size_t n_views, VoxelSet &vs,
+                        const size_t begin, const size_t end,
+                        const float OAR_th, const FootprintMode footprint,
+                        VoxelBlock &block)
+    {
+        size_t rejected = 0;
+        size_t n = 0;
+        for (size_t idx = begin; idx < end; ++idx)
+        {
+            if (!vs.valid_index(idx) || !vs.occupancy(idx))
+                continue;
+            const Voxel voxel = vs.voxel(idx);
+            //Same vertex order as View::project_voxel().
+            for (int i = 0; i < 8; ++i)
             {
-                const float OAR = (views[i].compute_occupied_area(bbox) / bbox.area());
-                // std::cout<<"area ocupada= "<<views[i].compute_occupied_area(bbox)<<std::endl;
-                // std::cout<<"area bbox= "<<bbox.area()<<std::endl;
-                // std::cout<<"OAR= "<<OAR<<std::endl;
-                // std::cout<<"OAR= "<<views[i].compute_occupied_area(bbox) / bbox.area()<<std::endl;
-                is_occupied = (OAR >= OAR_th);
+                block.X[8 * n + i] = voxel.x() + ((i >> 2) & 1) * voxel.x_dim();
+                block.Y[8 * n + i] = voxel.y() + (i & 1) * voxel.y_dim();
+                block.Z[8 * n + i] = voxel.z() + ((i >> 1) & 1) * voxel.z_dim();
             }
+            block.idx[n++] = idx;
         }
+        cv::Point2f uv[8];
+        for (size_t v = 0; v < n_views && n > 0; ++v)
+        {
+            views[v].project_points(&block.X[0], &block.Y[0], &block.Z[0], 8 * n,
+                                    &block.u[0], &block.v[0]);
+            size_t kept = 0;
+            for (size_t k = 0; k < n; ++k)
+            {
+                for (int i = 0; i < 8; ++i)
+                    uv[i] = cv::Point2f(block.u[8 * k + i], block.v[8 * k + i]);
+                if (!voxelset_view_test(views[v], uv, OAR_th, footprint))
+                {
+                    vs.set_occupancy(block.idx[k], false);
+                    ++rejected;
+                    continue;
+                }
+                //Keep the corners of the occupied voxels packed.
+                if (kept != k)
+                {
+                    std::copy(&block.X[8 * k], &block.X[8 * k] + 8, &block.X[8 * kept]);
+                    std::copy(&block.Y[8 * k], &block.Y[8 * k] + 8, &block.Y[8 * kept]);
+                    std::copy(&block.Z[8 * k], &block.Z[8 * k] + 8, &block.Z[8 * kept]);
+                    block.idx[kept] = block.idx[k];
+                }
+                ++kept;
+            }
+            n = kept;
+        }
+        return rejected;
+    }
 
-        //
-        return is_occupied;
+    /**
+     * @brief Lower the scores of the voxels [begin, end) with their OAR in
+     * the views. The corners are projected by blocks as voxelset_block_test()
+     * does. A voxel is not projected any more once its score is zero.
+     */
+    static void
+    voxelset_block_scores(const View *views, const size_t n_views, VoxelSet &vs,
+                          const size_t begin, const size_t end,
+                          const FootprintMode footprint, VoxelBlock &block)
+    {
+        size_t n = 0;
+        for (size_t idx = begin; idx < end; ++idx)
+        {
+            if (!vs.valid_index(idx) || vs.score(idx) <= 0.0f)
+                continue;
+            const Voxel voxel = vs.voxel(idx);
+            for (int i = 0; i < 8; ++i)
+            {
+                block.X[8 * n + i] = voxel.x() + ((i >> 2) & 1) * voxel.x_dim();
+                block.Y[8 * n + i] = voxel.y() + (i & 1) * voxel.y_dim();
+                block.Z[8 * n + i] = voxel.z() + ((i >> 1) & 1) * voxel.z_dim();
+            }
+            block.oar[n] = vs.score(idx);
+            block.idx[n++] = idx;
+        }
+        cv::Point2f uv[8];
+        for (size_t v = 0; v < n_views && n > 0; ++v)
+        {
+            views[v].project_points(&block.X[0], &block.Y[0], &block.Z[0], 8 * n,
+                                    &block.u[0], &block.v[0]);
+            size_t kept = 0;
+            for (size_t k = 0; k < n; ++k)
+            {
+                for (int i = 0; i < 8; ++i)
+                    uv[i] = cv::Point2f(block.u[8 * k + i], block.v[8 * k + i]);
+                const float oar = std::min(block.oar[k],
+                                           voxelset_view_oar(views[v], uv, footprint));
+                if (oar <= 0.0f)
+                {
+                    vs.set_score(block.idx[k], 0.0f);
+                    continue;
+                }
+                if (kept != k)
+                {
+                    std::copy(&block.X[8 * k], &block.X[8 * k] + 8, &block.X[8 * kept]);
+                    std::copy(&block.Y[8 * k], &block.Y[8 * k] + 8, &block.Y[8 * kept]);
+                    std::copy(&block.Z[8 * k], &block.Z[8 * k] + 8, &block.Z[8 * kept]);
+                    block.idx[kept] = block.idx[k];
+                }
+                block.oar[kept++] = oar;
+            }
+            n = kept;
+        }
+        for (size_t k = 0; k < n; ++k)
+            vs.set_score(block.idx[k], block.oar[k]);
+    }
+
+    /**
+     * @brief Compute the scores of the voxels (per voxel method) and the
+     * occupancy for a threshold.
+     */
+    static void
+    compute_visual_hull_scores(const View *views, const size_t n_views, VoxelSet &vs,
+                               const float OAR_th, const FootprintMode footprint)
+    {
+        const size_t n_blocks = (vs.size() + voxel_block - 1) / voxel_block;
+#pragma omp parallel
+        {
+            VoxelBlock block;
+#pragma omp for schedule(dynamic)
+            for (size_t b = 0; b < n_blocks; ++b)
+                voxelset_block_scores(views, n_views, vs, b * voxel_block,
+                                      std::min(vs.size(), (b + 1) * voxel_block),
+                                      footprint, block);
+        }
+        vs.apply_threshold(OAR_th);
+    }
+
+    /**
+     * @brief Get the face coordinates of the voxels along an axis.
+     * They are computed as VoxelSet::voxel() and View::project_voxel() do:
+     * the min face of voxel k is o + vsize*k and its max face is that plus
+     * vsize. The max face of a voxel usually rounds to the min face of the
+     * next one, and then it is stored once.
+     * @param[out] coords are the face coordinates.
+     * @param[out] lo, hi are the indices in coords of the min and max faces
+     *  of each voxel.
+     */
+    static void
+    lattice_axis(const float o, const float vsize, const size_t n,
+                 std::vector<float> &coords, std::vector<size_t> &lo,
+                 std::vector<size_t> &hi)
+    {
+        coords.clear();
+        lo.resize(n);
+        hi.resize(n);
+        for (size_t k = 0; k < n; ++k)
+        {
+            const float min_face = o + vsize * k;
+            if (coords.empty() || coords.back() != min_face)
+                coords.push_back(min_face);
+            lo[k] = coords.size() - 1;
+            coords.push_back(min_face + vsize);
+            hi[k] = coords.size() - 1;
+        }
+    }
+
+    /**
+     * @brief Compute the visual hull sweeping the voxel lattice.
+     * The corner lattice is projected once per view, keeping only two z
+     * planes of projected corners in memory, so the eight corners of a voxel
+     * are shared with its neighbours. The corners have the same coordinates
+     * and projection as in the per voxel method, so the hull is the same.
+     */
+    static void
+    compute_visual_hull_sweep(std::vector<View> const &views, VoxelSet &vs,
+                              const float OAR_th, const FootprintMode footprint)
+    {
+        const Voxel &bc = vs.bounding_cuve();
+        const float vsize = vs.vsize();
+        std::vector<float> X, Y, Z;
+        std::vector<size_t> lo_x, hi_x, lo_y, hi_y, lo_z, hi_z;
+        lattice_axis(bc.x(), vsize, vs.x_size(), X, lo_x, hi_x);
+        lattice_axis(bc.y(), vsize, vs.y_size(), Y, lo_y, hi_y);
+        lattice_axis(bc.z(), vsize, vs.z_size(), Z, lo_z, hi_z);
+        const size_t nx = X.size();
+        std::vector<std::vector<cv::Point2f>> lo(views.size()), hi(views.size());
+        for (size_t v = 0; v < views.size(); ++v)
+        {
+            lo[v].resize(nx * Y.size());
+            hi[v].resize(nx * Y.size());
+        }
+        size_t lo_plane = Z.size();
+        for (size_t z = 0; z < vs.z_size(); ++z)
+        {
+            if (lo_plane != lo_z[z])
+            {
+#pragma omp parallel for
+                for (size_t v = 0; v < views.size(); ++v)
+                    views[v].project_lattice_plane(&X[0], nx, &Y[0], Y.size(),
+                                                   Z[lo_z[z]], &lo[v][0]);
+            }
+#pragma omp parallel for
+            for (size_t v = 0; v < views.size(); ++v)
+                views[v].project_lattice_plane(&X[0], nx, &Y[0], Y.size(),
+                                               Z[hi_z[z]], &hi[v][0]);
+
+#pragma omp parallel for
+            for (size_t y = 0; y < vs.y_size(); ++y)
+            {
+                cv::Point2f corners[8];
+                for (size_t x = 0; x < vs.x_size(); ++x)
+                {
+                    //Same corner order as View::project_voxel().
+                    const size_t c00 = lo_y[y] * nx + lo_x[x];
+                    const size_t c01 = hi_y[y] * nx + lo_x[x];
+                    const size_t c10 = lo_y[y] * nx + hi_x[x];
+                    const size_t c11 = hi_y[y] * nx + hi_x[x];
+                    bool is_occupied = true;
+                    for (size_t v = 0; v < views.size() && is_occupied; ++v)
+                    {
+                        corners[0] = lo[v][c00];
+                        corners[1] = lo[v][c01];
+                        corners[2] = hi[v][c00];
+                        corners[3] = hi[v][c01];
+                        corners[4] = lo[v][c10];
+                        corners[5] = lo[v][c11];
+                        corners[6] = hi[v][c10];
+                        corners[7] = hi[v][c11];
+                        is_occupied = voxelset_view_test(views[v], corners,
+                                                         OAR_th, footprint);
+                    }
+                    vs.set_occupancy(x, y, z, is_occupied);
+                }
+            }
+            lo.swap(hi);
+            lo_plane = hi_z[z];
+        }
+    }
+
+    /**
+     * @brief Carve a cell of side^3 voxels (clipped to the voxelset).
+     * The cell is classified against the views still to be tested: a view
+     * that passes all its voxels is not tested for the subcells and a view
+     * that rejects all its voxels empties the cell. Only the voxels of the
+     * cells that can not be decided are tested, against the remaining views,
+     * so the result is the same as testing each voxel.
+     * @param active are the indices of the views to be tested.
+     * \see View::classify_region()
+     */
+    static void
+    carve_cell(std::vector<View> const &views, VoxelSet &vs,
+               const size_t x0, const size_t y0, const size_t z0,
+               const size_t side, const std::vector<size_t> &active,
+               const float OAR_th, const FootprintMode footprint)
+    {
+        const size_t x1 = std::min(x0 + side, vs.x_size());
+        const size_t y1 = std::min(y0 + side, vs.y_size());
+        const size_t z1 = std::min(z0 + side, vs.z_size());
+        if (side == 1)
+        {
+            const Voxel voxel = vs.voxel(x0, y0, z0);
+            bool is_occupied = true;
+            cv::Point2f uv[8];
+            for (size_t i = 0; i < active.size() && is_occupied; ++i)
+            {
+                views[active[i]].project_voxel(voxel, uv);
+                is_occupied = voxelset_view_test(views[active[i]], uv, OAR_th, footprint);
+            }
+            vs.set_occupancy(x0, y0, z0, is_occupied);
+            return;
+        }
+        const float vsize = vs.vsize();
+        const Voxel region(vs.bounding_cuve().x() + vsize * x0,
+                           vs.bounding_cuve().y() + vsize * y0,
+                           vs.bounding_cuve().z() + vsize * z0,
+                           vsize * (x1 - x0), vsize * (y1 - y0), vsize * (z1 - z0));
+        std::vector<size_t> remaining;
+        remaining.reserve(active.size());
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            bool out_of_frame;
+            const RegionClass c = views[active[i]].classify_region(region, vsize,
+                                                                   out_of_frame);
+            //A voxel passes a view if its bbox has zero area or OAR>=OAR_th,
+            //where the OAR is 1 for foreground bboxes and 0 for background ones.
+            if (out_of_frame || (c == REGION_INSIDE && OAR_th <= 1.0f))
+                continue;
+            if (c == REGION_OUTSIDE && OAR_th > 0.0f)
+                return;
+            remaining.push_back(active[i]);
+        }
+        if (remaining.empty())
+        {
+            for (size_t z = z0; z < z1; ++z)
+                for (size_t y = y0; y < y1; ++y)
+                    for (size_t x = x0; x < x1; ++x)
+                        vs.set_occupancy(x, y, z, true);
+            return;
+        }
+        const size_t half = side / 2;
+        for (size_t c = 0; c < 8; ++c)
+        {
+            const size_t cx = x0 + ((c >> 2) & 1) * half;
+            const size_t cy = y0 + ((c >> 1) & 1) * half;
+            const size_t cz = z0 + (c & 1) * half;
+            if (cx < x1 && cy < y1 && cz < z1)
+                carve_cell(views, vs, cx, cy, cz, half, remaining, OAR_th, footprint);
+        }
+    }
+
+    /**
+     * @brief Compute the visual hull carving coarse cells first.
+     * The voxelset is split in cells of 8^3 voxels refined to 4^3, 2^3 and
+     * the voxels only where the cell is not fully inside or outside of the
+     * silhouettes (see carve_cell()).
+     */
+    static void
+    compute_visual_hull_coarse_to_fine(std::vector<View> const &views, VoxelSet &vs,
+                                       const float OAR_th, const FootprintMode footprint)
+    {
+        const size_t side = 8;
+        const size_t cells[3] = {(vs.x_size() + side - 1) / side,
+                                 (vs.y_size() + side - 1) / side,
+                                 (vs.z_size() + side - 1) / side};
+        std::vector<size_t> all_views(views.size());
+        for (size_t v = 0; v < views.size(); ++v)
+            all_views[v] = v;
+#pragma omp parallel for schedule(dynamic)
+        for (size_t c = 0; c < cells[0] * cells[1] * cells[2]; ++c)
+            carve_cell(views, vs, (c % cells[0]) * side,
+                       ((c / cells[0]) % cells[1]) * side,
+                       (c / (cells[0] * cells[1])) * side,
+                       side, all_views, OAR_th, footprint);
     }
 
     void
     compute_visual_hull(std::vector<View> const &views, VoxelSet &vs,
-                        const Voxel &scene, float vsize, const float OAR_th)
+                        const Voxel &scene, float vsize, const float OAR_th,
+                        const VoxelSetHullMethod method,
+                        const FootprintMode footprint)
     {
-        vs.reset(scene, vsize);
+        //The coarse to fine carving only sets the occupied voxels.
+        //The scores are computed with the per voxel method.
+        const bool scores = vs.score_depth() != NO_SCORES;
+        vs.reset(scene, vsize, method != VH_COARSE_TO_FINE || scores);
+        if (scores)
+        {
+            compute_visual_hull_scores(views.data(), views.size(), vs, OAR_th, footprint);
+            return;
+        }
+        if (method == VH_SWEEP)
+        {
+            compute_visual_hull_sweep(views, vs, OAR_th, footprint);
+            return;
+        }
+        if (method == VH_COARSE_TO_FINE)
+        {
+            compute_visual_hull_coarse_to_fine(views, vs, OAR_th, footprint);
+            return;
+        }
         //TODO
         // std::cout << vs.size() << std::endl;
         //Apply the SFS algorithm.
         //Do a projection test for each voxel.
         //Hint: use "#pragma omp parallel for" to parallelize the loop.
-#pragma omp parallel for
-        for (size_t voxel_idx = 0; voxel_idx < vs.size(); ++voxel_idx)
+        //The voxels are tested by blocks: the corners of the voxels of a
+        //block still occupied are projected onto a view in one batch.
+        const size_t n_blocks = (vs.size() + voxel_block - 1) / voxel_block;
+#pragma omp parallel
         {
-            // std::cout << "VOXEL:" << vs.voxel(voxel_idx) << std::endl;
-            bool is_occupied = voxelset_projection_test(vs.voxel(voxel_idx),
-                                                        views, OAR_th);
-            vs.set_occupancy(voxel_idx, is_occupied);
+            VoxelBlock block;
+#pragma omp for schedule(dynamic)
+            for (size_t b = 0; b < n_blocks; ++b)
+                voxelset_block_test(views.data(), views.size(), vs, b * voxel_block,
+                                    std::min(vs.size(), (b + 1) * voxel_block),
+                                    OAR_th, footprint, block);
         }
         //
     }
 
-    static OctantState
-    octree_projection_test(const Voxel &voxel, std::vector<View> const &views,
-                           const size_t level, const size_t max_levels,
-                           const size_t max_errors, const float OAR_th)
+    size_t
+    update_visual_hull(const View &view, VoxelSet &vs, const float OAR_th,
+                       const FootprintMode footprint)
     {
-        OctantState st = BLACK;
-        //TODO
-        //Apply the Projection Test for each view.
-        //Remeber: the inner nodes have three states:
-        //       WHITE (OAR==0 && errors<max_errors),
-        //           GREY((OAR==0 && errors<max_errors)||0<OAR<1), BLACK(OAR==1).
-        //while leaf nodes (at the last level) only have two states:
-        //       WHITE (OAR<OAR_th), BLACK(OAR>=OAR_th).
+        if (vs.has_scores())
+        {
+            //All the voxels with a score are updated, not only the occupied ones.
+            const size_t occupied = vs.count_occupied();
+            compute_visual_hull_scores(&view, 1, vs, OAR_th, footprint);
+            const size_t now = vs.count_occupied();
+            return occupied > now ? occupied - now : 0;
+        }
+        //The voxels of a block already empty are skipped before projecting,
+        //so only the occupied ones are tested against the new view.
+        const size_t n_blocks = (vs.size() + voxel_block - 1) / voxel_block;
+        size_t carved = 0;
+#pragma omp parallel reduction(+:carved)
+        {
+            VoxelBlock block;
+#pragma omp for schedule(dynamic)
+            for (size_t b = 0; b < n_blocks; ++b)
+                carved += voxelset_block_test(&view, 1, vs, b * voxel_block,
+                                              std::min(vs.size(), (b + 1) * voxel_block),
+                                              OAR_th, footprint, block);
+        }
+        return carved;
+    }
 
-        // Si un octante es white, siempre sera white por eso no hay que comprobar más y salimos del bucle
-        for (size_t i = 0; i < views.size() && (st != WHITE); i++)
+    void
+    compute_visual_hull(std::vector<View> const &views, SparseVoxelSet &vs,
+                        const Voxel &scene, float vsize, const float OAR_th,
+                        const FootprintMode footprint)
+    {
+        vs.reset(scene, vsize, false);
+        const size_t side = SparseVoxelSet::BRICK_SIDE;
+        //Each brick is carved apart and stored at once, so only the mixed
+        //bricks are allocated.
+#pragma omp parallel for schedule(dynamic)
+        for (size_t b = 0; b < vs.n_bricks(); ++b)
         {
+            size_t x0, y0, z0;
+            vs.brick_origin(b, x0, y0, z0);
+            const size_t x1 = std::min(x0 + side, vs.x_size());
+            const size_t y1 = std::min(y0 + side, vs.y_size());
+            const size_t z1 = std::min(z0 + side, vs.z_size());
+            std::uint64_t words[side] = {0, 0, 0, 0, 0, 0, 0, 0};
+            for (size_t z = z0; z < z1; ++z)
+                for (size_t y = y0; y < y1; ++y)
+                    for (size_t x = x0; x < x1; ++x)
+                        if (voxelset_projection_test(vs.voxel(x, y, z), views,
+                                                     OAR_th, footprint))
+                            words[z - z0] |= std::uint64_t(1) << ((y - y0) * side + x - x0);
+#pragma omp critical(sparse_voxelset)
+            vs.set_brick(b, words);
+        }
+    }
 
-            cv::Rect bbox = views[i].compute_bounding_box(voxel.vertices());
+    /**
+     * @brief Levels of the octree built before spawning a task per subtree.
+     * There must be enough subtrees to balance the load between the threads.
+     */
+    static size_t
+    octree_task_levels(const size_t max_levels)
+    {
+        size_t levels = 0;
+#ifdef USE_OPENMP
+        const size_t n_threads = omp_get_max_threads();
+        if (n_threads > 1)
+            while ((size_t(1) << (3*levels)) < 16*n_threads && levels < 4)
+                ++levels;
+#endif
+        return std::min(levels, max_levels);
+    }
 
-            cv::Mat copia = views[i].colored_view().clone();
-            cv::rectangle(copia,bbox,cv::Scalar(255,0,0));
+    /**
+     * @brief Order of the views in the octree projection test.
+     * The views that reject (WHITE) more octants are tested first, so the
+     * test of an empty octant ends sooner. The rejections are counted as the
+     * octants are tested and the order is sorted again every sort_period
+     * tests. The state of an octant does not depend on the order of the views.
+     */
+    class ViewOrder
+    {
+    public:
+        explicit ViewOrder(const size_t n_views=0):
+            order_(n_views), rejections_(n_views, 0), tests_(0)
+        {
+            for (size_t v = 0; v < n_views; ++v)
+                order_[v] = v;
+        }
 
-            // cv::imshow("Octree", copia);
-            // cv::waitKey(0);
+        size_t size() const
+        {
+            return order_.size();
+        }
 
+        /** @brief Get the index of the i-th view to test.*/
+        size_t operator[](const size_t i) const
+        {
+            return order_[i];
+        }
 
-            if (bbox.area() > 0)
+        /** @brief Account a test rejected by the view v (none if v>=size()).*/
+        void update(const size_t v)
+        {
+            if (v < size())
+                ++rejections_[v];
+            if (++tests_ % sort_period == 0)
             {
-                const float area_ocupada =  views[i].compute_occupied_area(bbox);
-                const float area_bbox =  bbox.area();
-                const float OAR = area_ocupada / area_bbox;
-                // std::cout<<"area ocupada= "<<views[i].compute_occupied_area(bbox)<<std::endl;
-                // std::cout<<"area bbox= "<<bbox.area()<<std::endl;
-                // std::cout<<"OAR= "<<OAR<<std::endl;
-                // std::cout<<"OAR= "<<area_ocupada / area_bbox<<std::endl;
-
-                // Porque empezamos con 0
-                if(level == max_levels){
-                    if(OAR < OAR_th){
-                        st = WHITE;
-                    }
+                const std::vector<size_t> &r = rejections_;
+                std::stable_sort(order_.begin(), order_.end(),
+                                 [&r](const size_t a, const size_t b)
+                {
+                    return r[a] > r[b];
+                });
+            }
+        }
+
+    private:
+        static const size_t sort_period = 256;
+        std::vector<size_t> order_;
+        std::vector<size_t> rejections_;
+        size_t tests_;
+    };
+
+    /** @brief Parameters of an octree visual hull and the view order of each thread. */
+    struct OctreeHullContext
+    {
+        OctreeHullContext(std::vector<View> const &views_, const size_t max_levels_,
+                          const size_t max_errors_, const float OAR_th_,
+                          const FootprintMode footprint_):
+            views(views_), max_levels(max_levels_), max_errors(max_errors_),
+            OAR_th(OAR_th_), footprint(footprint_),
+            task_levels(octree_task_levels(max_levels_))
+        {
+            size_t n_threads = 1;
+#ifdef USE_OPENMP
+            n_threads = omp_get_max_threads();
+#endif
+            orders.assign(n_threads, ViewOrder(views.size()));
+        }
+
+        /** @brief Get the view order of the calling thread.*/
+        ViewOrder &order()
+        {
+#ifdef USE_OPENMP
+            return orders[omp_get_thread_num()];
+#else
+            return orders[0];
+#endif
+        }
+
+        std::vector<View> const &views;
+        const size_t max_levels;
+        const size_t max_errors;
+        const float OAR_th;
+        const FootprintMode footprint;
+        const size_t task_levels;
+        std::vector<ViewOrder> orders;
+    };
+
+    /**
+     * @brief Projection test of an octant against one view.
+     * @param st is the state of the octant given by the views already tested.
+     * @param last_level is true for the octants of the last level.
+     * @return the state of the octant given by st and this view.
+     */
+    static OctantState
+    octant_view_test(const View &view, const Voxel &voxel, const bool last_level,
+                     const float OAR_th, const FootprintMode footprint,
+                     OctantState st)
+    {
+        cv::Point2f uv[8];
+        view.project_voxel(voxel, uv);
+        int area = 0;
+        const int occupied = view.compute_occupied_area(uv, 8, footprint, area);
+
+
+        if (area > 0)
+        {
+            const float area_ocupada =  occupied;
+            const float area_bbox =  area;
+            const float OAR = area_ocupada / area_bbox;
+            // std::cout<<"area ocupada= "<<views[i].compute_occupied_area(bbox)<<std::endl;
+            // std::cout<<"area bbox= "<<bbox.area()<<std::endl;
+            // std::cout<<"OAR= "<<OAR<<std::endl;
+            // std::cout<<"OAR= "<<area_ocupada / area_bbox<<std::endl;
+
+            // Porque empezamos con 0
+            if(last_level){
+                if(OAR < OAR_th){
+                    st = WHITE;
                 }
-    
-                
-                else
+            }
+
+
+            else
+            {
+                switch (st)
                 {
-                    switch (st)
-                    {
-                    case BLACK :
-                        if(OAR == 0.0f)
-                            st = WHITE;
-                        else if(OAR < 1.0f)
-                            st = GREY;
-                        
-                        break;
-                    
-                    case GREY:
-                        if(OAR == 0.0f)
-                            st = WHITE;
-                        break;
-                    
-                    default:
-                        st = WHITE; // No va a llegar
-                        break;
-                    }
+                case BLACK :
+                    if(OAR == 0.0f)
+                        st = WHITE;
+                    else if(OAR < 1.0f)
+                        st = GREY;
+
+                    break;
+
+                case GREY:
+                    if(OAR == 0.0f)
+                        st = WHITE;
+                    break;
 
+                default:
+                    st = WHITE; // No va a llegar
+                    break;
                 }
-                
+
             }
         }
-        
+        return st;
+    }
+
+    static OctantState
+    octree_projection_test(const Voxel &voxel, const size_t level,
+                           OctreeHullContext &ctx)
+    {
+        std::vector<View> const &views = ctx.views;
+        ViewOrder &order = ctx.order();
+        size_t rejected_by = order.size();
+        OctantState st = BLACK;
+        //TODO
+        //Apply the Projection Test for each view.
+        //Remeber: the inner nodes have three states:
+        //       WHITE (OAR==0 && errors<max_errors),
+        //           GREY((OAR==0 && errors<max_errors)||0<OAR<1), BLACK(OAR==1).
+        //while leaf nodes (at the last level) only have two states:
+        //       WHITE (OAR<OAR_th), BLACK(OAR>=OAR_th).
+
+        // Si un octante es white, siempre sera white por eso no hay que comprobar más y salimos del bucle
+        for (size_t i = 0; i < views.size() && (st != WHITE); i++)
+        {
+            st = octant_view_test(views[order[i]], voxel, level == ctx.max_levels,
+                                  ctx.OAR_th, ctx.footprint, st);
+            if (st == WHITE)
+                rejected_by = order[i];
+        }
+        order.update(rejected_by);
 
         //
         return st;
     }
 
     static void
-    process_octant(Octant &oct, std::vector<View> const &views,
-                   const size_t level, const size_t max_levels,
-                   const size_t max_errors, const float OAR_th)
+    process_octant(Octant &oct, const size_t level, OctreeHullContext &ctx)
     {
         //TODO
         //Apply the SFS algorithm on this octant.
@@ -464,12 +1094,15 @@ namespace fsiv
         //Second if the state is GREY, split and do recursion to go down in the tree.
         //Remenber to actualize level var in the recursion(level+1).
         
-        oct.set_state(octree_projection_test(oct.voxel(), views, level, max_levels, max_errors, OAR_th));
+        oct.set_state(octree_projection_test(oct.voxel(), level, ctx));
         
         if(oct.state() == GREY){
             oct.split();
+            //The children are already allocated, so each one can be
+            //processed by a task.
             for(size_t i = 0; i < 8; i++){
-                process_octant(oct.child(i), views, level+1, max_levels, max_errors, OAR_th);
+#pragma omp task if(level < ctx.task_levels) shared(oct, ctx)
+                process_octant(oct.child(i), level+1, ctx);
             }
 
         }
@@ -479,7 +1112,8 @@ namespace fsiv
     void
     compute_visual_hull(std::vector<View> const &views, Octree &octree,
                         const Voxel &scene, size_t max_levels,
-                        size_t max_errors, const float OAR_th)
+                        size_t max_errors, const float OAR_th,
+                        const FootprintMode footprint)
     {
         CV_Assert(max_errors <= views.size());
         //TODO
@@ -488,9 +1122,176 @@ namespace fsiv
         //Second, set the octant as the root node of the octree.
         octree.set_root(Octant(scene));
 
-        process_octant(octree.root(),views, 0, max_levels, max_errors, OAR_th );
+        OctreeHullContext ctx(views, max_levels, max_errors, OAR_th, footprint);
+#pragma omp parallel
+#pragma omp single
+        process_octant(octree.root(), 0, ctx);
 
         //
     }
 
+    /**
+     * @brief Carve an octant with a new view.
+     * The BLACK and GREY octants are tested against the new view only. The
+     * children of a BLACK octant may not be inside all the previous
+     * silhouettes (the bboxes are truncated and the views where they are out
+     * of the frame pass), so if it becomes GREY it is split and its children
+     * are built from all the views, as compute_visual_hull() does. A GREY
+     * octant whose children are all WHITE is merged.
+     * @param ctx has all the views, the new one is the last.
+     * @return the number of octants that became WHITE.
+     */
+    static size_t
+    update_octant(const View &view, Octant &oct, const size_t level,
+                  OctreeHullContext &ctx)
+    {
+        if (oct.state() == WHITE)
+            return 0;
+        const OctantState st = octant_view_test(view, oct.voxel(), level == ctx.max_levels,
+                                                ctx.OAR_th, ctx.footprint, oct.state());
+        if (st == BLACK)
+            return 0;
+        if (st == WHITE)
+        {
+            oct.set_state(WHITE);
+            if (!oct.is_leaf())
+                oct.merge();
+            return 1;
+        }
+        const bool split = oct.is_leaf();
+        if (split)
+            oct.split();
+        oct.set_state(GREY);
+        size_t carved[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (size_t i = 0; i < 8; i++)
+        {
+#pragma omp task if(level < ctx.task_levels) shared(view, oct, carved, ctx)
+            {
+                if (split)
+                    process_octant(oct.child(i), level+1, ctx);
+                else
+                    carved[i] = update_octant(view, oct.child(i), level+1, ctx);
+            }
+        }
+#pragma omp taskwait
+        size_t n = 0;
+        bool all_white = true;
+        for (size_t i = 0; i < 8; i++)
+        {
+            //Only the new children of a split octant are counted.
+            n += split ? (oct.child(i).state() == WHITE) : carved[i];
+            all_white = all_white && oct.child(i).state() == WHITE;
+        }
+        if (all_white)
+        {
+            oct.set_state(WHITE);
+            oct.merge();
+            ++n;
+        }
+        return n;
+    }
+
+    size_t
+    update_visual_hull(std::vector<View> const &views, Octree &octree, size_t max_levels,
+                       const float OAR_th, const FootprintMode footprint)
+    {
+        CV_Assert(!octree.is_empty() && !views.empty());
+        OctreeHullContext ctx(views, max_levels, 0, OAR_th, footprint);
+        size_t carved = 0;
+#pragma omp parallel
+#pragma omp single
+        carved = update_octant(views.back(), octree.root(), 0, ctx);
+        return carved;
+    }
+
+    /**
+     * @brief Process a node of a linear octree.
+     * @param depth is the depth of the node in oct, while level is its level
+     *  in the whole octree (oct may be a subtree).
+     */
+    static void
+    process_linear_octant(LinearOctree &oct, const size_t node,
+                          const size_t depth, const std::uint64_t code,
+                          const size_t level, OctreeHullContext &ctx)
+    {
+        oct.set_state(node, octree_projection_test(oct.voxel(depth, code), level, ctx));
+        if (oct.state(node) == GREY)
+        {
+            const size_t first = oct.split(node);
+            for (size_t i = 0; i < 8; i++)
+                process_linear_octant(oct, first + i, depth+1, (code << 3) | i,
+                                      level+1, ctx);
+        }
+    }
+
+    /** @brief A subtree of a linear octree to be built by a task. */
+    struct LinearOctreeTask
+    {
+        size_t node;
+        std::uint64_t code;
+        LinearOctree subtree;
+    };
+
+    /** @brief Process the top levels of a linear octree collecting the
+     *  nodes at level task_levels as tasks. */
+    static void
+    expand_linear_octant(LinearOctree &oct, const size_t node,
+                         const std::uint64_t code, const size_t level,
+                         OctreeHullContext &ctx,
+                         std::vector<LinearOctreeTask> &tasks)
+    {
+        if (level == ctx.task_levels)
+        {
+            tasks.push_back(LinearOctreeTask());
+            tasks.back().node = node;
+            tasks.back().code = code;
+            return;
+        }
+        oct.set_state(node, octree_projection_test(oct.voxel(level, code), level, ctx));
+        if (oct.state(node) == GREY)
+        {
+            const size_t first = oct.split(node);
+            for (size_t i = 0; i < 8; i++)
+                expand_linear_octant(oct, first + i, (code << 3) | i, level+1,
+                                     ctx, tasks);
+        }
+    }
+
+    void
+    compute_visual_hull(std::vector<View> const &views, LinearOctree &octree,
+                        const Voxel &scene, size_t max_levels,
+                        size_t max_errors, const float OAR_th,
+                        const FootprintMode footprint)
+    {
+        CV_Assert(max_errors <= views.size());
+        octree.reset(scene);
+        OctreeHullContext ctx(views, max_levels, max_errors, OAR_th, footprint);
+        if (ctx.task_levels == 0)
+        {
+            process_linear_octant(octree, 0, 0, 0, 0, ctx);
+            return;
+        }
+
+        //Each subtree is built by a task in its own node array, so the tree
+        //growth is not serialized, and then it is stitched in the tree.
+        std::vector<LinearOctreeTask> tasks;
+        expand_linear_octant(octree, 0, 0, 0, ctx, tasks);
+#pragma omp parallel
+#pragma omp single
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+#pragma omp task
+            {
+                LinearOctreeTask &task = tasks[t];
+                task.subtree.reset(octree.voxel(ctx.task_levels, task.code));
+                process_linear_octant(task.subtree, 0, 0, 0, ctx.task_levels, ctx);
+            }
+        }
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            octree.graft(tasks[t].node, tasks[t].subtree);
+            tasks[t].subtree.clear();
+        }
+    }
+
 } //namespace fsiv
@@ -0,0 +1,126 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<cstdlib>
+#include<stdexcept>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include "sfs.hpp"
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{max_stddev     |20    | Max. standard deviation of the colors of a consistent voxel.}"
+    "{iterations     |4     | Max. number of times the six plane sweeps are done.}"
+    "{carved         |      | Save the carved voxel set to this file.}"
+    "{nviews         |<none>| Number of views.}"
+    "{@input         |<none>| input voxel set data, plain or bricked (the visual hull).}"
+    "{@output        |<none>| output colored .ply file.}"
+    "{@cam_0         |<none>| Camera parameters for view 0...}"
+    "{@cam_n         |<none>| ... camera parameters for view N.}"
+    "{@view_0        |<none>| Foreground image for view 0...}"
+    "{@view_n        |<none>| ... foreground image for view N.}"
+    "{@image_0       |<none>| Color image for view 0...}"
+    "{@image_n       |<none>| ... color image for view N.}"
+    ;
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Carve the photo inconsistent voxels of a visual hull and save the colored surface.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+
+      size_t n_views = parser.get<int>("nviews");
+      int first_arg = 1;
+      while (first_arg<argc && argv[first_arg][0]=='-')
+          ++first_arg;
+      if (size_t(argc-first_arg) != 2+n_views*3)
+      {
+          std::cerr << "Error: wrong cli." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::ofstream output(argv[first_arg+1], std::ios::binary);
+      if (!output)
+      {
+          std::cerr << "Error: could not open the file ["
+                    << argv[first_arg+1] << "] to write." << std::endl;
+          return EXIT_FAILURE;
+      }
+      const std::string input_fname = argv[first_arg];
+      first_arg += 2;
+      std::vector<fsiv::View> views;
+      for(size_t v=0; v<n_views; ++v)
+      {
+          fsiv::CameraParameters cparams;
+          if (!cparams.read_from_file(argv[first_arg+v]))
+          {
+              std::cerr << "Error: could not load camera parameters form file["
+                        << argv[first_arg+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          cv::Mat fg_img = cv::imread(argv[first_arg+n_views+v], cv::IMREAD_GRAYSCALE);
+          if (fg_img.empty())
+          {
+              std::cerr << "Error: could not load forground image form file["
+                        << argv[first_arg+n_views+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          cv::Mat img = cv::imread(argv[first_arg+2*n_views+v], cv::IMREAD_COLOR);
+          if (img.empty() || img.size()!=fg_img.size())
+          {
+              std::cerr << "Error: could not load a color image with the size of the foreground from file["
+                        << argv[first_arg+2*n_views+v] << "]." << std::endl;
+              return EXIT_FAILURE;
+          }
+          views.push_back(fsiv::View(argv[first_arg+n_views+v], fg_img, cparams));
+          views.back().set_colored_view(img);
+      }
+
+      fsiv::VoxelSet vs;
+      if (!fsiv::load_voxelset(input_fname, vs))
+      {
+          std::cerr << "Error: could not open the file ["
+                    << input_fname << "] to read." << std::endl;
+          return EXIT_FAILURE;
+      }
+      const size_t occupied = vs.count_occupied();
+      fsiv::VoxelColors colors;
+      int64_t t0 = cv::getTickCount();
+      const size_t carved = fsiv::compute_voxel_coloring(views, vs, colors,
+                                                         parser.get<float>("max_stddev"),
+                                                         parser.get<int>("iterations"));
+      const double t_color = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      std::cout << "Carved: " << carved << " of " << occupied << " voxels in "
+                << t_color << " s" << std::endl;
+      if (!fsiv::save_mesh(output, vs, colors, fsiv::PLY_FORMAT))
+      {
+          std::cerr << "Error: could not write the mesh." << std::endl;
+          return EXIT_FAILURE;
+      }
+      if (parser.has("carved"))
+      {
+          std::ofstream carved_output(parser.get<std::string>("carved"));
+          carved_output << vs;
+      }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
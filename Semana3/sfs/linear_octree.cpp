@@ -0,0 +1,284 @@
+#include "linear_octree.hpp"
+#include "octree_file.hpp"
+
+namespace fsiv {
+
+LinearOctree::LinearOctree()
+{
+    CV_Assert(is_empty());
+}
+
+LinearOctree::LinearOctree(const Voxel& root)
+{
+    reset(root);
+}
+
+bool
+LinearOctree::is_empty() const
+{
+    return nodes_.empty();
+}
+
+void
+LinearOctree::reset(const Voxel& root)
+{
+    root_ = root;
+    nodes_.clear();
+    Node n = {0, BLACK};
+    nodes_.push_back(n);
+}
+
+void
+LinearOctree::clear()
+{
+    root_ = Voxel();
+    nodes_.clear();
+}
+
+void
+LinearOctree::reserve(const size_t n)
+{
+    nodes_.reserve(n);
+}
+
+size_t
+LinearOctree::size() const
+{
+    return nodes_.size();
+}
+
+const Voxel&
+LinearOctree::root_voxel() const
+{
+    return root_;
+}
+
+OctantState
+LinearOctree::state(const size_t node) const
+{
+    CV_Assert(node < size());
+    return static_cast<OctantState>(nodes_[node].state);
+}
+
+void
+LinearOctree::set_state(const size_t node, const OctantState new_state)
+{
+    CV_Assert(node < size());
+    nodes_[node].state = new_state;
+}
+
+bool
+LinearOctree::is_leaf(const size_t node) const
+{
+    CV_Assert(node < size());
+    return nodes_[node].first_child == 0;
+}
+
+size_t
+LinearOctree::child(const size_t node, const size_t i) const
+{
+    CV_Assert(!is_leaf(node) && i < 8);
+    return nodes_[node].first_child + i;
+}
+
+size_t
+LinearOctree::split(const size_t node)
+{
+    CV_Assert(is_leaf(node));
+    CV_Assert(size() + 8 <= size_t(UINT32_MAX));
+    const std::uint32_t first = std::uint32_t(size());
+    const Node n = {0, BLACK};
+    nodes_.insert(nodes_.end(), 8, n);
+    nodes_[node].first_child = first;
+    return first;
+}
+
+void
+LinearOctree::graft(const size_t node, const LinearOctree& subtree)
+{
+    CV_Assert(is_leaf(node) && !subtree.is_empty());
+    CV_Assert(size() + subtree.size() <= size_t(UINT32_MAX));
+    //The subtree node i>0 will be the node base+i.
+    const std::uint32_t base = std::uint32_t(size() - 1);
+    nodes_[node].state = subtree.nodes_[0].state;
+    if (subtree.is_leaf(0))
+        return;
+    nodes_[node].first_child = subtree.nodes_[0].first_child + base;
+    const size_t first = size();
+    nodes_.insert(nodes_.end(), subtree.nodes_.begin() + 1, subtree.nodes_.end());
+    for (size_t i = first; i < size(); ++i)
+        if (nodes_[i].first_child != 0)
+            nodes_[i].first_child += base;
+}
+
+Voxel
+LinearOctree::voxel(const size_t depth, const std::uint64_t code) const
+{
+    CV_Assert(3*depth <= 64);
+    //The same arithmetic as Octant::split() so both trees have the same geometry.
+    float o[3] = {root_.x(), root_.y(), root_.z()};
+    float d[3] = {root_.x_dim(), root_.y_dim(), root_.z_dim()};
+    for (size_t l = 1; l <= depth; ++l)
+    {
+        const unsigned c = unsigned(code >> (3*(depth - l))) & 7;
+        for (int a = 0; a < 3; ++a)
+        {
+            d[a] *= 0.5f;
+            if ((c >> (2 - a)) & 1)
+                o[a] += d[a];
+        }
+    }
+    return Voxel(o[0], o[1], o[2], d[0], d[1], d[2]);
+}
+
+const std::vector<LinearOctree::Node>&
+LinearOctree::nodes() const
+{
+    return nodes_;
+}
+
+static std::string octree_signature="octree";
+
+static void
+write_node(std::ostream& out, const LinearOctree& oct, const size_t node)
+{
+    out << oct.state(node) << ' ';
+    if (oct.state(node)==GREY)
+        for (size_t c=0; c<8; c++)
+            write_node(out, oct, oct.child(node, c));
+}
+
+static void
+read_node(std::istream& in, LinearOctree& oct, const size_t node)
+{
+    int state;
+    in >> state;
+    if (in)
+    {
+        oct.set_state(node, static_cast<OctantState>(state));
+        if (oct.state(node)==GREY)
+        {
+            const size_t first = oct.split(node);
+            for (size_t c=0; c<8 && in; c++)
+                read_node(in, oct, first + c);
+        }
+    }
+}
+
+std::ostream&
+operator << (std::ostream& out, const LinearOctree& octree)
+{
+    out << octree_signature << std::endl;
+    if (octree.is_empty())
+        out << Voxel();
+    else
+    {
+        out << octree.root_voxel() << ' ';
+        write_node(out, octree, 0);
+    }
+    return out;
+}
+
+std::istream&
+operator >> (std::istream& in, LinearOctree& octree)
+{
+    std::string signature;
+    in >> signature;
+    if (in && signature==octree_signature)
+    {
+        Voxel voxel;
+        in >> voxel;
+        octree.clear();
+        if (voxel.volume()>0.0)
+        {
+            octree.reset(voxel);
+            read_node(in, octree, 0);
+        }
+    }
+    else if (in && signature==octree_binary_signature())
+    {
+        Octree tree;
+        read_binary_octree_data(in, tree);
+        convert(tree, octree);
+    }
+    return in;
+}
+
+static void
+convert_node(const Octant& src, LinearOctree& dst, const size_t node)
+{
+    dst.set_state(node, src.state());
+    if (!src.is_leaf())
+    {
+        const size_t first = dst.split(node);
+        for (size_t c=0; c<8; ++c)
+            convert_node(src.child(c), dst, first + c);
+    }
+}
+
+void
+convert(const Octree& src, LinearOctree& dst)
+{
+    dst.clear();
+    if (!src.is_empty())
+    {
+        dst.reset(src.root().voxel());
+        convert_node(src.root(), dst, 0);
+    }
+}
+
+static void
+convert_node(const LinearOctree& src, const size_t node, Octant& dst)
+{
+    dst.set_state(src.state(node));
+    if (!src.is_leaf(node))
+    {
+        dst.split();
+        for (size_t c=0; c<8; ++c)
+            convert_node(src, src.child(node, c), dst.child(c));
+    }
+}
+
+void
+convert(const LinearOctree& src, Octree& dst)
+{
+    dst = Octree();
+    if (!src.is_empty())
+    {
+        Octant root(src.root_voxel());
+        convert_node(src, 0, root);
+        dst.set_root(root);
+    }
+}
+
+static void
+save_as_cubes_WRML (std::ostream& out, const LinearOctree& oct,
+                    const size_t node, const size_t depth,
+                    const std::uint64_t code, const cv::Scalar & color)
+{
+    if (oct.state(node)==BLACK)
+    {
+        const Voxel v = oct.voxel(depth, code);
+        out << "Transform {\n";
+        out << "  translation " << v.x()+v.x_dim()/2.0f << ' ' << v.y()+v.y_dim()/2.0f << ' ' << v.z()+v.z_dim()/2.0f << std::endl;
+        out << "  children Shape {\n";
+        out << "     appearance Appearance  { material Material { diffuseColor " << color[0]/255.0 << ' ' << color[1]/255.0 << ' ' << color[2]/255.0 << "} }\n";
+        out << "     geometry Box { size " << v.x_dim() << ' ' << v.y_dim() << ' ' << v.z_dim() << " }\n";
+        out << "  }\n";
+        out << "}\n";
+    }
+    else if (oct.state(node)==GREY && !oct.is_leaf(node))
+        for (size_t c=0; c<8; ++c)
+            save_as_cubes_WRML(out, oct, oct.child(node, c), depth+1,
+                               (code << 3) | c, color);
+}
+
+void save_as_cubes_WRML (std::ostream& out, const LinearOctree& oct,
+            const cv::Scalar & color)
+{
+    out << "#VRML V2.0 utf8\n";
+    if (!oct.is_empty())
+        save_as_cubes_WRML(out, oct, 0, 0, 0, color);
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "voxel.hpp"
+#include "octree.hpp"
+
+
+namespace fsiv {
+
+/**
+ * @brief The LinearOctree class.
+ * Models an octree without pointers: the nodes are kept in a contiguous
+ * array where the 8 children of a node are a block of consecutive nodes
+ * addressed by the index of the first one.
+ *
+ * A node only stores its state and the index of its first child. The
+ * geometry of a node is not stored but derived from the root voxel, its
+ * depth and its Morton code (the child indices from the root, three bits
+ * x*4+y*2+z per level), which are known when the tree is traversed.
+ */
+class LinearOctree
+{
+public:
+
+    /** @brief A node of the linear octree.*/
+    struct Node
+    {
+        std::uint32_t first_child; //0 if it is a leaf (0 is the root).
+        std::uint8_t state;        //an OctantState.
+    };
+
+    LinearOctree();
+
+    /** @brief Create a tree with only the root node (BLACK).*/
+    explicit LinearOctree(const Voxel& root);
+
+    bool is_empty() const;
+
+    /** @brief Remove all the nodes and set the root node (BLACK).*/
+    void reset(const Voxel& root);
+
+    /** @brief Remove all the nodes.*/
+    void clear();
+
+    /** @brief Reserve memory for n nodes.*/
+    void reserve(const size_t n);
+
+    /** @brief Number of nodes (the root has index 0).*/
+    size_t size() const;
+
+    const Voxel& root_voxel() const;
+
+    OctantState state(const size_t node) const;
+    void set_state(const size_t node, const OctantState new_state);
+    bool is_leaf(const size_t node) const;
+
+    /** @brief Get the index of the i-th child of a node.*/
+    size_t child(const size_t node, const size_t i) const;
+
+    /**
+     * @brief Split a leaf node appending a block of 8 BLACK children.
+     * @warning the indices are stable but the references to nodes are
+     *  invalidated.
+     * @return the index of the first child.
+     */
+    size_t split(const size_t node);
+
+    /**
+     * @brief Replace a leaf node by the root of other tree.
+     * The nodes of the subtree are appended as a block, so subtrees built
+     * apart (i.e. by different threads) can be stitched in the tree.
+     * @warning the references to nodes are invalidated.
+     */
+    void graft(const size_t node, const LinearOctree& subtree);
+
+    /**
+     * @brief Get the geometry of a node.
+     * @param depth is the level of the node (0 for the root).
+     * @param code is the Morton code of the node: the child indices from the
+     *  root, the first one in the most significant bits.
+     */
+    Voxel voxel(const size_t depth, const std::uint64_t code) const;
+
+    const std::vector<Node>& nodes() const;
+
+private:
+    Voxel root_;
+    std::vector<Node> nodes_;
+};
+
+std::ostream& operator << (std::ostream& out, const LinearOctree& octree);
+std::istream& operator >> (std::istream& in, LinearOctree& octree);
+
+/** @brief Convert a pointer based octree into a linear octree.*/
+void convert(const Octree& src, LinearOctree& dst);
+
+/** @brief Convert a linear octree into a pointer based octree.*/
+void convert(const LinearOctree& src, Octree& dst);
+
+void save_as_cubes_WRML (std::ostream& out, const LinearOctree& oct,
+            const cv::Scalar & color=cv::Scalar(255, 255, 255));
+
+} //namespace fsiv
@@ -0,0 +1,333 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "marching_cubes.hpp"
+
+namespace fsiv {
+
+/*
+ * The corner c of a cell is at the offset (c&1, (c>>1)&1, (c>>2)&1) and an
+ * edge of a cell joins two corners that only differ in the bit of its axis.
+ */
+
+/** @brief An edge of a cell: its lower corner and its axis. */
+struct CellEdge
+{
+    int corner;
+    int axis;
+};
+
+/**
+ * @brief The CubeTable class.
+ * The triangles of each of the 256 cases of a cell. The table is built from
+ * the faces of the cell: on each face the edge crossings are joined with
+ * segments (an ambiguous face separates its two inside corners), the
+ * segments are chained in loops around the cell and each loop is fanned into
+ * triangles. Two cells sharing a face get the same segments on it, so the
+ * surface has not holes.
+ */
+class CubeTable
+{
+public:
+    CubeTable()
+    {
+        int n = 0;
+        for (int c = 0; c < 8; ++c)
+            for (int a = 0; a < 3; ++a)
+                if (!(c & (1 << a)))
+                {
+                    edges[n].corner = c;
+                    edges[n].axis = a;
+                    ++n;
+                }
+        //The corners of each face counter clockwise seen from out of the cell.
+        int faces[6][4];
+        const int uv[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+        for (int a = 0; a < 3; ++a)
+            for (int s = 0; s < 2; ++s)
+            {
+                const int u = (a + 1) % 3, v = (a + 2) % 3;
+                for (int k = 0; k < 4; ++k)
+                    faces[2 * a + s][s ? k : 3 - k] =
+                            (s << a) | (uv[k][0] << u) | (uv[k][1] << v);
+            }
+        //on_face[e] has the bit f set if the edge e is on the face f.
+        int on_face[12] = {0};
+        for (int f = 0; f < 6; ++f)
+            for (int k = 0; k < 4; ++k)
+                on_face[edge_of(faces[f][k], faces[f][(k + 1) % 4])] |= 1 << f;
+        for (int cube = 0; cube < 256; ++cube)
+        {
+            //next[e] is the edge where the segment starting at e ends.
+            int next[12];
+            std::fill(next, next + 12, -1);
+            for (int f = 0; f < 6; ++f)
+                for (int k = 0; k < 4; ++k)
+                {
+                    const int p = faces[f][k], q = faces[f][(k + 1) % 4];
+                    if (inside(cube, p) || !inside(cube, q))
+                        continue;
+                    //From the edge entering the inside corner q to the
+                    //first edge leaving the inside.
+                    for (int j = (k + 1) % 4; ; j = (j + 1) % 4)
+                    {
+                        const int r = faces[f][j], s = faces[f][(j + 1) % 4];
+                        if (inside(cube, r) && !inside(cube, s))
+                        {
+                            next[edge_of(p, q)] = edge_of(r, s);
+                            break;
+                        }
+                    }
+                }
+            bool used[12] = {false};
+            for (int e = 0; e < 12; ++e)
+            {
+                if (next[e] < 0 || used[e])
+                    continue;
+                std::vector<int> loop;
+                for (int i = e; !used[i]; i = next[i])
+                {
+                    used[i] = true;
+                    loop.push_back(i);
+                }
+                //The fan apex is chosen so no diagonal lays on a face of the
+                //cell, where it could overlap the triangles of the neighbour.
+                const size_t n_loop = loop.size();
+                size_t apex = 0;
+                while (apex < n_loop && !good_apex(loop, apex, on_face))
+                    ++apex;
+                CV_Assert(apex < n_loop);
+                for (size_t i = 1; i + 1 < n_loop; ++i)
+                {
+                    triangles[cube].push_back(loop[apex]);
+                    triangles[cube].push_back(loop[(apex + i) % n_loop]);
+                    triangles[cube].push_back(loop[(apex + i + 1) % n_loop]);
+                }
+            }
+        }
+    }
+
+    CellEdge edges[12];
+    std::vector<int> triangles[256]; //3 edges per triangle.
+
+private:
+    /** @brief Test if the fan from loop[apex] has not diagonals on a face.*/
+    static bool good_apex(const std::vector<int>& loop, const size_t apex,
+                          const int on_face[12])
+    {
+        for (size_t i = 2; i + 1 < loop.size(); ++i)
+            if (on_face[loop[apex]] & on_face[loop[(apex + i) % loop.size()]])
+                return false;
+        return true;
+    }
+
+    static bool inside(const int cube, const int corner)
+    {
+        return (cube >> corner) & 1;
+    }
+
+    int edge_of(const int c0, const int c1) const
+    {
+        const int corner = std::min(c0, c1), axis = (c0 ^ c1) == 1 ? 0 : (c0 ^ c1) == 2 ? 1 : 2;
+        for (int e = 0; e < 12; ++e)
+            if (edges[e].corner == corner && edges[e].axis == axis)
+                return e;
+        return -1;
+    }
+};
+
+static const CubeTable&
+cube_table()
+{
+    static const CubeTable table;
+    return table;
+}
+
+/** @brief A temporary file to spool the data of an element of the PLY.*/
+class Spool
+{
+public:
+    Spool(): _file(std::tmpfile())
+    {
+        if (!_file)
+            throw std::runtime_error("Could not create a temporary file.");
+    }
+    ~Spool()
+    {
+        std::fclose(_file);
+    }
+    void write(const void* data, const size_t size)
+    {
+        if (std::fwrite(data, 1, size, _file) != size)
+            throw std::runtime_error("Could not write a temporary file.");
+    }
+    /** @brief Copy the spooled data to a stream.*/
+    bool copy_to(std::ostream& out)
+    {
+        std::vector<char> buffer(1 << 20);
+        std::rewind(_file);
+        size_t n;
+        while ((n = std::fread(&buffer[0], 1, buffer.size(), _file)) > 0 && out)
+            out.write(&buffer[0], n);
+        return !std::ferror(_file) && bool(out);
+    }
+private:
+    Spool(const Spool&);
+    Spool& operator=(const Spool&);
+    std::FILE* _file;
+};
+
+/**
+ * @brief Extract the surface slab by slab.
+ * The planes of samples are padded with a zero border, so the corner (i,j,k)
+ * is the center of the voxel (i-1,j-1,k-1).
+ * @param read_plane(z, plane) writes the values of the voxels of the plane z
+ *  at plane[(x+1) + (y+1)*(nx+2)].
+ */
+template <class PlaneReader>
+static bool
+marching_cubes(std::ostream& out, const size_t nx, const size_t ny, const size_t nz,
+               const Voxel& bc, const float vsize, const float iso,
+               PlaneReader& read_plane)
+{
+    const CubeTable& table = cube_table();
+    const size_t NX = nx + 2, NY = ny + 2, NZ = nz + 2;
+    const float origin[3] = {bc.x() - 0.5f * vsize, bc.y() - 0.5f * vsize,
+                             bc.z() - 0.5f * vsize};
+    std::vector<float> lo(NX * NY, 0.0f), hi(NX * NY, 0.0f);
+    //The vertex of each edge of the planes lo/hi (x and y edges) and of the
+    //edges between them (z edges), -1 if not computed yet.
+    std::vector<std::int32_t> xedges[2], yedges[2], zedges(NX * NY, -1);
+    for (int p = 0; p < 2; ++p)
+    {
+        xedges[p].assign((NX - 1) * NY, -1);
+        yedges[p].assign(NX * (NY - 1), -1);
+    }
+    Spool vertices, faces;
+    std::int64_t n_vertices = 0, n_faces = 0;
+    char face[1 + 3 * sizeof(std::int32_t)];
+    face[0] = 3;
+
+    for (size_t z = 0; z + 1 < NZ; ++z)
+    {
+        std::fill(hi.begin(), hi.end(), 0.0f);
+        if (z < nz)
+            read_plane(z, &hi[0]);
+        const float* planes[2] = {&lo[0], &hi[0]};
+        for (size_t y = 0; y + 1 < NY; ++y)
+            for (size_t x = 0; x + 1 < NX; ++x)
+            {
+                float value[8];
+                int cube = 0;
+                for (int c = 0; c < 8; ++c)
+                {
+                    value[c] = planes[c >> 2][(x + (c & 1)) + (y + ((c >> 1) & 1)) * NX];
+                    if (value[c] >= iso)
+                        cube |= 1 << c;
+                }
+                const std::vector<int>& tri = table.triangles[cube];
+                if (tri.empty())
+                    continue;
+                std::int32_t ids[3];
+                for (size_t t = 0; t < tri.size(); ++t)
+                {
+                    const CellEdge& e = table.edges[tri[t]];
+                    const size_t ex = x + (e.corner & 1), ey = y + ((e.corner >> 1) & 1);
+                    const int ez = e.corner >> 2;
+                    std::int32_t& id = e.axis == 0 ? xedges[ez][ey * (NX - 1) + ex] :
+                                       e.axis == 1 ? yedges[ez][ey * NX + ex] :
+                                                     zedges[ey * NX + ex];
+                    if (id < 0)
+                    {
+                        const float a = value[e.corner], b = value[e.corner | (1 << e.axis)];
+                        float pos[3] = {float(ex), float(ey), float(z + ez)};
+                        pos[e.axis] += (iso - a) / (b - a);
+                        for (int i = 0; i < 3; ++i)
+                            pos[i] = origin[i] + vsize * pos[i];
+                        vertices.write(pos, sizeof(pos));
+                        if (n_vertices == INT32_MAX)
+                            throw std::runtime_error("Too many vertices for a PLY file.");
+                        id = std::int32_t(n_vertices++);
+                    }
+                    ids[t % 3] = id;
+                    if (t % 3 == 2)
+                    {
+                        std::memcpy(face + 1, ids, sizeof(ids));
+                        faces.write(face, sizeof(face));
+                        ++n_faces;
+                    }
+                }
+            }
+        //Roll the planes: the upper plane is the lower one of the next slab.
+        lo.swap(hi);
+        xedges[0].swap(xedges[1]);
+        yedges[0].swap(yedges[1]);
+        std::fill(xedges[1].begin(), xedges[1].end(), -1);
+        std::fill(yedges[1].begin(), yedges[1].end(), -1);
+        std::fill(zedges.begin(), zedges.end(), -1);
+    }
+
+    std::ostringstream header;
+    header << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "element vertex " << n_vertices << '\n'
+           << "property float x\nproperty float y\nproperty float z\n"
+           << "element face " << n_faces << '\n'
+           << "property list uchar int vertex_indices\n"
+           << "end_header\n";
+    const std::string h = header.str();
+    out.write(h.data(), h.size());
+    return vertices.copy_to(out) && faces.copy_to(out);
+}
+
+bool
+save_marching_cubes(std::ostream& out, const VoxelSet& vs, const float iso,
+                    const float* values)
+{
+    const size_t nx = vs.x_size(), ny = vs.y_size();
+    const bool scores = vs.has_scores();
+    auto read_plane = [&vs, values, scores, nx, ny](const size_t z, float* plane)
+    {
+        for (size_t y = 0; y < ny; ++y)
+        {
+            float* row = plane + (y + 1) * (nx + 2) + 1;
+            for (size_t x = 0; x < nx; ++x)
+            {
+                const size_t idx = vs.xyz2index(x, y, z);
+                row[x] = values ? values[idx] :
+                         scores ? vs.score(idx) : float(vs.occupancy(idx));
+            }
+        }
+    };
+    return marching_cubes(out, nx, ny, vs.z_size(), vs.bounding_cuve(),
+                          vs.vsize(), iso, read_plane);
+}
+
+bool
+save_marching_cubes(std::ostream& out, BrickedVoxelSet& vs, const float iso)
+{
+    const size_t nx = vs.x_size(), ny = vs.y_size(), nz = vs.z_size();
+    auto read_plane = [&vs, nx, ny, nz](const size_t z, float* plane)
+    {
+        for (size_t y = 0; y < ny; ++y)
+        {
+            float* row = plane + (y + 1) * (nx + 2) + 1;
+            for (size_t x = 0; x < nx; ++x)
+                row[x] = float(vs.occupancy(x, y, z));
+        }
+        //The layer of bricks is not read again.
+        if ((z + 1) % BRICK_SIZE == 0 || z + 1 == nz)
+            for (size_t by = 0; by < vs.y_bricks(); ++by)
+                for (size_t bx = 0; bx < vs.x_bricks(); ++bx)
+                    vs.release_brick(vs.brick_index(bx * BRICK_SIZE, by * BRICK_SIZE, z));
+    };
+    return marching_cubes(out, nx, ny, nz, vs.bounding_cuve(), vs.vsize(),
+                          iso, read_plane);
+}
+
+} //namespace fsiv
@@ -0,0 +1,46 @@
+#pragma once
+#include <iostream>
+
+#include "voxelset.hpp"
+#include "brick_file.hpp"
+
+namespace fsiv
+{
+
+/**
+ * @brief Extract a marching cubes surface of a voxelset and save it as a
+ * binary little endian PLY with triangle faces.
+ *
+ * The scalar field is sampled at the voxel centers and it is zero out of
+ * the voxelset, so the surface is closed. The grid is processed slab by
+ * slab, with only two planes of samples in memory, and the vertices are
+ * shared between neighbour cells with rolling caches of the edges of the
+ * two planes. The vertices and faces are spooled to temporary files until
+ * their number is known, so the memory used does not depend on the depth
+ * of the grid.
+ *
+ * The triangulation of a cell is built from its faces: the ambiguous faces
+ * always separate the inside corners, so neighbour cells agree on their
+ * common face and the surface is watertight.
+ *
+ * @param out is the output stream (open it in binary mode).
+ * @param vs is the voxelset.
+ * @param iso is the iso level of the surface.
+ * @param values are optional values per voxel (indexed as vs), e.g. the OAR
+ *  of the voxels. If null, the scores of vs are used if it has them (so iso
+ *  is an OAR threshold) or the occupancy of the voxels (0 or 1) otherwise.
+ * @return true if success.
+ */
+bool save_marching_cubes(std::ostream& out, const VoxelSet& vs,
+                         const float iso=0.5f, const float* values=nullptr);
+
+/**
+ * @brief Extract a marching cubes surface of a bricked voxelset.
+ * The bricks are inflated as the slabs reach them and released after them,
+ * so only a layer of bricks is kept in memory.
+ * \see save_marching_cubes(std::ostream&, const VoxelSet&, ...)
+ */
+bool save_marching_cubes(std::ostream& out, BrickedVoxelSet& vs,
+                         const float iso=0.5f);
+
+} //namespace fsiv
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include "mesh_export.hpp"
+
+namespace fsiv
+{
+
+/** @brief Read the occupancy of the slice s along axis d as a 2D byte mask.*/
+static void
+read_slice(const VoxelSet& vs, const int d, const size_t s,
+           std::vector<uchar>& slice)
+{
+    const int u = (d + 1) % 3, v = (d + 2) % 3;
+    const size_t n[3] = {vs.x_size(), vs.y_size(), vs.z_size()};
+    size_t pos[3];
+    pos[d] = s;
+    for (size_t j = 0; j < n[v]; ++j)
+    {
+        pos[v] = j;
+        for (size_t i = 0; i < n[u]; ++i)
+        {
+            pos[u] = i;
+            slice[j * n[u] + i] = vs.occupancy(pos[0], pos[1], pos[2]);
+        }
+    }
+}
+
+/**
+ * @brief Greedy meshing of a 2D face mask.
+ * The mask values are +1 (face with positive normal), -1 (negative normal)
+ * or 0 (no face). Each non zero cell is covered by the widest run of equal
+ * cells and this run is grown along v while the rows are equal.
+ * @post the mask is zeroed.
+ */
+static void
+greedy_quads(std::vector<signed char>& mask, const int nu, const int nv,
+             const int axis, const int w, std::vector<MeshQuad>& quads)
+{
+    for (int j = 0; j < nv; ++j)
+        for (int i = 0; i < nu;)
+        {
+            const signed char m = mask[j * nu + i];
+            if (m == 0)
+            {
+                ++i;
+                continue;
+            }
+            int width = 1;
+            while (i + width < nu && mask[j * nu + i + width] == m)
+                ++width;
+            int height = 1;
+            bool grow = true;
+            while (grow && j + height < nv)
+            {
+                for (int k = 0; k < width && grow; ++k)
+                    grow = mask[(j + height) * nu + i + k] == m;
+                if (grow)
+                    ++height;
+            }
+            for (int h = 0; h < height; ++h)
+                std::fill(mask.begin() + (j + h) * nu + i,
+                          mask.begin() + (j + h) * nu + i + width, 0);
+            MeshQuad q = {axis, m > 0, w, i, i + width, j, j + height};
+            quads.push_back(q);
+            i += width;
+        }
+}
+
+void
+compute_mesh(const VoxelSet& vs, QuadMesh& mesh)
+{
+    const Voxel& bc = vs.bounding_cuve();
+    mesh.origin[0] = bc.x();
+    mesh.origin[1] = bc.y();
+    mesh.origin[2] = bc.z();
+    mesh.scale[0] = mesh.scale[1] = mesh.scale[2] = vs.vsize();
+    mesh.quads.clear();
+
+    const int n[3] = {int(vs.x_size()), int(vs.y_size()), int(vs.z_size())};
+    std::vector<uchar> lo, hi;
+    std::vector<signed char> mask;
+    for (int d = 0; d < 3; ++d)
+    {
+        const int nu = n[(d + 1) % 3], nv = n[(d + 2) % 3];
+        const size_t plane = size_t(nu) * nv;
+        lo.assign(plane, 0);
+        hi.assign(plane, 0);
+        mask.assign(plane, 0);
+        //The faces of the plane s are between the slices s-1 (lo) and s (hi).
+        for (int s = 0; s <= n[d]; ++s)
+        {
+            if (s < n[d])
+                read_slice(vs, d, s, hi);
+            else
+                std::fill(hi.begin(), hi.end(), 0);
+            bool any = false;
+            for (size_t k = 0; k < plane; ++k)
+            {
+                mask[k] = (lo[k] && !hi[k]) ? 1 : ((!lo[k] && hi[k]) ? -1 : 0);
+                any = any || mask[k];
+            }
+            if (any)
+                greedy_quads(mask, nu, nv, d, s, mesh.quads);
+            lo.swap(hi);
+        }
+    }
+}
+
+void
+compute_mesh(const VoxelSet& vs, const VoxelColors& colors, QuadMesh& mesh)
+{
+    CV_Assert(colors.rgb.size() == vs.size() && colors.has_color.size() == vs.size());
+    const Voxel& bc = vs.bounding_cuve();
+    mesh.origin[0] = bc.x();
+    mesh.origin[1] = bc.y();
+    mesh.origin[2] = bc.z();
+    mesh.scale[0] = mesh.scale[1] = mesh.scale[2] = vs.vsize();
+    mesh.quads.clear();
+    mesh.colors.clear();
+
+    const int n[3] = {int(vs.x_size()), int(vs.y_size()), int(vs.z_size())};
+    const cv::Vec3b gray(128, 128, 128);
+    int p[3];
+    for (p[2] = 0; p[2] < n[2]; ++p[2])
+        for (p[1] = 0; p[1] < n[1]; ++p[1])
+            for (p[0] = 0; p[0] < n[0]; ++p[0])
+            {
+                if (!vs.occupancy(p[0], p[1], p[2]))
+                    continue;
+                const size_t idx = vs.xyz2index(p[0], p[1], p[2]);
+                for (int d = 0; d < 3; ++d)
+                    for (int s = -1; s <= 1; s += 2)
+                    {
+                        int q[3] = {p[0], p[1], p[2]};
+                        q[d] += s;
+                        if (q[d] >= 0 && q[d] < n[d] && vs.occupancy(q[0], q[1], q[2]))
+                            continue;
+                        const int u = (d + 1) % 3, v = (d + 2) % 3;
+                        MeshQuad quad = {d, s > 0, p[d] + (s > 0 ? 1 : 0),
+                                         p[u], p[u] + 1, p[v], p[v] + 1};
+                        mesh.quads.push_back(quad);
+                        mesh.colors.push_back(colors.has_color[idx] ? colors.rgb[idx] : gray);
+                    }
+            }
+}
+
+/** @brief An octant with its position and size on the finest lattice.*/
+struct LatticeOctant
+{
+    const Octant* octant;
+    int p[3];
+    int size;
+};
+
+static const int axis_bit[3] = {4, 2, 1}; //child index is x*4+y*2+z.
+
+static bool
+is_split(const LatticeOctant& n)
+{
+    return n.octant->state() == GREY && !n.octant->is_leaf();
+}
+
+static LatticeOctant
+child(const LatticeOctant& n, const int c)
+{
+    LatticeOctant ch;
+    ch.octant = &n.octant->child(c);
+    ch.size = n.size / 2;
+    for (int a = 0; a < 3; ++a)
+        ch.p[a] = n.p[a] + ((c & axis_bit[a]) ? ch.size : 0);
+    return ch;
+}
+
+/** @brief The 4 children indices with bit d cleared.*/
+static void
+face_children(const int d, int c[4])
+{
+    const int b1 = axis_bit[(d + 1) % 3], b2 = axis_bit[(d + 2) % 3];
+    c[0] = 0;
+    c[1] = b1;
+    c[2] = b2;
+    c[3] = b1 | b2;
+}
+
+static int
+max_depth(const Octant& oct)
+{
+    int depth = 0;
+    if (oct.state() == GREY && !oct.is_leaf())
+        for (size_t c = 0; c < 8; ++c)
+            depth = std::max(depth, 1 + max_depth(oct.child(c)));
+    return depth;
+}
+
+static void
+push_face(const LatticeOctant& n, const int d, const int w, const bool positive,
+          std::vector<MeshQuad>& quads)
+{
+    const int u = (d + 1) % 3, v = (d + 2) % 3;
+    MeshQuad q = {d, positive, w, n.p[u], n.p[u] + n.size,
+                  n.p[v], n.p[v] + n.size};
+    quads.push_back(q);
+}
+
+/** @brief Faces between the octant a and the octant b next to it along +d.*/
+static void
+face_proc(const LatticeOctant& a, const LatticeOctant& b, const int d,
+          std::vector<MeshQuad>& quads)
+{
+    const bool a_split = is_split(a), b_split = is_split(b);
+    if (a_split || b_split)
+    {
+        int c[4];
+        face_children(d, c);
+        for (int i = 0; i < 4; ++i)
+            face_proc(a_split ? child(a, c[i] | axis_bit[d]) : a,
+                      b_split ? child(b, c[i]) : b, d, quads);
+        return;
+    }
+    const bool a_occ = a.octant->state() == BLACK;
+    const bool b_occ = b.octant->state() == BLACK;
+    if (a_occ != b_occ)
+        push_face(a.size < b.size ? a : b, d, b.p[d], a_occ, quads);
+}
+
+/** @brief Faces of the octant on the limit of the octree (side hi or lo of d).*/
+static void
+boundary_proc(const LatticeOctant& n, const int d, const bool hi,
+              std::vector<MeshQuad>& quads)
+{
+    if (is_split(n))
+    {
+        int c[4];
+        face_children(d, c);
+        for (int i = 0; i < 4; ++i)
+            boundary_proc(child(n, c[i] | (hi ? axis_bit[d] : 0)), d, hi, quads);
+    }
+    else if (n.octant->state() == BLACK)
+        push_face(n, d, hi ? n.p[d] + n.size : n.p[d], hi, quads);
+}
+
+static void
+cell_proc(const LatticeOctant& n, std::vector<MeshQuad>& quads)
+{
+    if (!is_split(n))
+        return;
+    for (int c = 0; c < 8; ++c)
+        cell_proc(child(n, c), quads);
+    for (int d = 0; d < 3; ++d)
+    {
+        int c[4];
+        face_children(d, c);
+        for (int i = 0; i < 4; ++i)
+            face_proc(child(n, c[i]), child(n, c[i] | axis_bit[d]), d, quads);
+    }
+}
+
+/**
+ * @brief Merge the coplanar quads that share a full edge.
+ * @param along_u if true merge along u, else along v.
+ */
+static void
+merge_quads(std::vector<MeshQuad>& quads, const bool along_u)
+{
+    if (quads.empty())
+        return;
+    //Sort by plane, then by the fixed range, then by the start of the free one.
+    std::sort(quads.begin(), quads.end(),
+              [along_u](const MeshQuad& a, const MeshQuad& b)
+    {
+        const int ka[] = {a.axis, a.positive, a.w,
+                          along_u ? a.v0 : a.u0, along_u ? a.v1 : a.u1,
+                          along_u ? a.u0 : a.v0};
+        const int kb[] = {b.axis, b.positive, b.w,
+                          along_u ? b.v0 : b.u0, along_u ? b.v1 : b.u1,
+                          along_u ? b.u0 : b.v0};
+        return std::lexicographical_compare(ka, ka + 6, kb, kb + 6);
+    });
+    size_t last = 0;
+    for (size_t i = 1; i < quads.size(); ++i)
+    {
+        MeshQuad& m = quads[last];
+        const MeshQuad& q = quads[i];
+        const bool same_plane = m.axis == q.axis && m.positive == q.positive &&
+                m.w == q.w;
+        if (same_plane && along_u && m.v0 == q.v0 && m.v1 == q.v1 && m.u1 == q.u0)
+            m.u1 = q.u1;
+        else if (same_plane && !along_u && m.u0 == q.u0 && m.u1 == q.u1 && m.v1 == q.v0)
+            m.v1 = q.v1;
+        else
+            quads[++last] = q;
+    }
+    quads.resize(last + 1);
+}
+
+void
+compute_mesh(const Octree& oct, QuadMesh& mesh)
+{
+    mesh.quads.clear();
+    if (oct.is_empty())
+    {
+        mesh.origin[0] = mesh.origin[1] = mesh.origin[2] = 0.0f;
+        mesh.scale[0] = mesh.scale[1] = mesh.scale[2] = 1.0f;
+        return;
+    }
+    const Voxel& rv = oct.root().voxel();
+    const int depth = max_depth(oct.root());
+    CV_Assert(depth < 30);
+    const int res = 1 << depth;
+    mesh.origin[0] = rv.x();
+    mesh.origin[1] = rv.y();
+    mesh.origin[2] = rv.z();
+    mesh.scale[0] = rv.x_dim() / res;
+    mesh.scale[1] = rv.y_dim() / res;
+    mesh.scale[2] = rv.z_dim() / res;
+
+    LatticeOctant root;
+    root.octant = &oct.root();
+    root.p[0] = root.p[1] = root.p[2] = 0;
+    root.size = res;
+    cell_proc(root, mesh.quads);
+    for (int d = 0; d < 3; ++d)
+    {
+        boundary_proc(root, d, false, mesh.quads);
+        boundary_proc(root, d, true, mesh.quads);
+    }
+    merge_quads(mesh.quads, true);
+    merge_quads(mesh.quads, false);
+}
+
+/**
+ * @brief Pack the data in a buffer and write it to the stream when it is full.
+ */
+class BufferedWriter
+{
+public:
+    BufferedWriter(std::ostream& out, char* buffer, const size_t size):
+        out_(out), buffer_(buffer), size_(size), used_(0)
+    {
+        if (buffer_ == nullptr)
+        {
+            own_.resize(size_);
+            buffer_ = &own_[0];
+        }
+    }
+    void write(const void* data, size_t n)
+    {
+        const char* src = static_cast<const char*>(data);
+        while (n > 0)
+        {
+            const size_t c = std::min(n, size_ - used_);
+            std::memcpy(buffer_ + used_, src, c);
+            used_ += c;
+            src += c;
+            n -= c;
+            if (used_ == size_)
+                flush();
+        }
+    }
+    bool flush()
+    {
+        out_.write(buffer_, used_);
+        used_ = 0;
+        return bool(out_);
+    }
+private:
+    std::ostream& out_;
+    char* buffer_;
+    size_t size_;
+    size_t used_;
+    std::vector<char> own_;
+};
+
+/** @brief Get the four lattice corners of a quad in counterclockwise order
+ *  seen from the normal side.*/
+static void
+quad_corners(const MeshQuad& q, int corner[4][3])
+{
+    const int u = (q.axis + 1) % 3, v = (q.axis + 2) % 3;
+    const int cu[4] = {q.u0, q.u1, q.u1, q.u0};
+    const int cv[4] = {q.v0, q.v0, q.v1, q.v1};
+    for (int i = 0; i < 4; ++i)
+    {
+        const int k = q.positive ? i : 3 - i;
+        corner[i][q.axis] = q.w;
+        corner[i][u] = cu[k];
+        corner[i][v] = cv[k];
+    }
+}
+
+/** @brief Get the WCS position of a lattice point.*/
+static void
+lattice_to_wcs(const QuadMesh& mesh, const int p[3], float pos[3])
+{
+    for (int a = 0; a < 3; ++a)
+        pos[a] = mesh.origin[a] + mesh.scale[a] * float(p[a]);
+}
+
+/** @brief Get the four WCS vertices of a quad in counterclockwise order
+ *  seen from the normal side.*/
+static void
+quad_vertices(const QuadMesh& mesh, const MeshQuad& q, float vtx[4][3])
+{
+    int corner[4][3];
+    quad_corners(q, corner);
+    for (int i = 0; i < 4; ++i)
+        lattice_to_wcs(mesh, corner[i], vtx[i]);
+}
+
+/** @brief A mesh vertex: a lattice point with the color of its quads.*/
+struct MeshVertex
+{
+    int p[3];
+    cv::Vec3b color;
+    bool operator==(const MeshVertex& o) const
+    {
+        return p[0] == o.p[0] && p[1] == o.p[1] && p[2] == o.p[2] &&
+                color[0] == o.color[0] && color[1] == o.color[1] && color[2] == o.color[2];
+    }
+};
+
+struct MeshVertexHash
+{
+    size_t operator()(const MeshVertex& v) const
+    {
+        std::uint64_t h = std::uint64_t(std::uint32_t(v.p[0]));
+        h = h * 0x9E3779B97F4A7C15ull + std::uint32_t(v.p[1]);
+        h = h * 0x9E3779B97F4A7C15ull + std::uint32_t(v.p[2]);
+        h = h * 0x9E3779B97F4A7C15ull + ((v.color[0] << 16) | (v.color[1] << 8) | v.color[2]);
+        return size_t(h ^ (h >> 29));
+    }
+};
+
+/**
+ * @brief Get the vertices shared by the quads and the four vertex indices
+ *  of each quad.
+ * The corners are hashed by their integer lattice coordinates (and color),
+ * so the adjacent quads share their vertices.
+ */
+static void
+index_vertices(const QuadMesh& mesh, const bool colored,
+               std::vector<MeshVertex>& vertices, std::vector<std::int32_t>& faces)
+{
+    std::unordered_map<MeshVertex, std::int32_t, MeshVertexHash> index;
+    index.reserve(2 * mesh.quads.size());
+    vertices.clear();
+    faces.resize(4 * mesh.quads.size());
+    int corner[4][3];
+    for (size_t i = 0; i < mesh.quads.size(); ++i)
+    {
+        quad_corners(mesh.quads[i], corner);
+        for (int k = 0; k < 4; ++k)
+        {
+            MeshVertex v;
+            std::copy(corner[k], corner[k] + 3, v.p);
+            v.color = colored ? mesh.colors[i] : cv::Vec3b(0, 0, 0);
+            const auto it = index.emplace(v, std::int32_t(vertices.size()));
+            if (it.second)
+                vertices.push_back(v);
+            faces[4 * i + k] = it.first->second;
+        }
+    }
+}
+
+//Note: the binary data is written in the host byte order, so the files are
+//little endian on x86/ARM hosts as the headers say.
+
+static void
+write_ply(BufferedWriter& writer, const QuadMesh& mesh)
+{
+    const bool colored = mesh.colors.size() == mesh.quads.size() && !mesh.quads.empty();
+    std::vector<MeshVertex> vertices;
+    std::vector<std::int32_t> faces;
+    index_vertices(mesh, colored, vertices, faces);
+
+    std::ostringstream header;
+    header << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "element vertex " << vertices.size() << '\n'
+           << "property float x\nproperty float y\nproperty float z\n";
+    if (colored)
+        header << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+    header << "element face " << mesh.quads.size() << '\n'
+           << "property list uchar int vertex_indices\n"
+           << "end_header\n";
+    const std::string h = header.str();
+    writer.write(h.data(), h.size());
+    float pos[3];
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        lattice_to_wcs(mesh, vertices[i].p, pos);
+        writer.write(pos, sizeof(pos));
+        if (colored)
+            writer.write(&vertices[i].color[0], 3);
+    }
+    char face[1 + 4 * sizeof(std::int32_t)];
+    face[0] = 4;
+    for (size_t i = 0; i < mesh.quads.size(); ++i)
+    {
+        std::memcpy(face + 1, &faces[4 * i], 4 * sizeof(std::int32_t));
+        writer.write(face, sizeof(face));
+    }
+}
+
+static void
+write_stl(BufferedWriter& writer, const QuadMesh& mesh)
+{
+    char header[80];
+    std::memset(header, ' ', sizeof(header));
+    const char title[] = "fsiv binary stl";
+    std::memcpy(header, title, sizeof(title) - 1);
+    writer.write(header, sizeof(header));
+    const std::uint32_t n_triangles = std::uint32_t(2 * mesh.quads.size());
+    writer.write(&n_triangles, sizeof(n_triangles));
+    float vtx[4][3];
+    //normal, 3 vertices and a 16 bits attribute.
+    char triangle[12 * sizeof(float) + sizeof(std::uint16_t)];
+    std::memset(triangle, 0, sizeof(triangle));
+    for (size_t i = 0; i < mesh.quads.size(); ++i)
+    {
+        const MeshQuad& q = mesh.quads[i];
+        quad_vertices(mesh, q, vtx);
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        normal[q.axis] = q.positive ? 1.0f : -1.0f;
+        std::memcpy(triangle, normal, sizeof(normal));
+        const int tris[2][3] = {{0, 1, 2}, {0, 2, 3}};
+        for (int t = 0; t < 2; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                std::memcpy(triangle + (3 + 3 * k) * sizeof(float),
+                            vtx[tris[t][k]], 3 * sizeof(float));
+            writer.write(triangle, sizeof(triangle));
+        }
+    }
+}
+
+bool
+save_mesh(std::ostream& out, const QuadMesh& mesh, const MeshFormat format,
+          char* buffer, size_t buffer_size)
+{
+    CV_Assert(buffer_size > 0);
+    BufferedWriter writer(out, buffer, buffer_size);
+    if (format == STL_FORMAT)
+        write_stl(writer, mesh);
+    else
+        write_ply(writer, mesh);
+    return writer.flush();
+}
+
+bool
+save_mesh(std::ostream& out, const VoxelSet& vs, const MeshFormat format,
+          char* buffer, size_t buffer_size)
+{
+    QuadMesh mesh;
+    compute_mesh(vs, mesh);
+    return save_mesh(out, mesh, format, buffer, buffer_size);
+}
+
+bool
+save_mesh(std::ostream& out, const VoxelSet& vs, const VoxelColors& colors,
+          const MeshFormat format, char* buffer, size_t buffer_size)
+{
+    QuadMesh mesh;
+    compute_mesh(vs, colors, mesh);
+    return save_mesh(out, mesh, format, buffer, buffer_size);
+}
+
+bool
+save_mesh(std::ostream& out, const Octree& oct, const MeshFormat format,
+          char* buffer, size_t buffer_size)
+{
+    QuadMesh mesh;
+    compute_mesh(oct, mesh);
+    return save_mesh(out, mesh, format, buffer, buffer_size);
+}
+
+} //namespace fsiv
@@ -0,0 +1,98 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "voxelset.hpp"
+#include "octree.hpp"
+#include "voxel_coloring.hpp"
+
+namespace fsiv
+{
+
+/** @brief Binary mesh file formats. */
+typedef enum {
+    PLY_FORMAT=0, //binary little endian PLY with quad faces.
+    STL_FORMAT=1  //binary STL (two triangles per quad).
+} MeshFormat;
+
+/**
+ * @brief The MeshQuad struct.
+ * Models an axis aligned rectangle on an integer lattice.
+ * The quad lays on the plane coord[axis]==w and spans [u0,u1)x[v0,v1) on the
+ * axes (axis+1)%3 and (axis+2)%3. The normal points to +axis if positive.
+ */
+struct MeshQuad
+{
+    int axis;
+    bool positive;
+    int w, u0, u1, v0, v1;
+};
+
+/**
+ * @brief The QuadMesh struct.
+ * A set of quads plus the transform from the lattice to WCS:
+ * X = origin + scale * lattice point.
+ * The quads may have a color (only saved in PLY format).
+ */
+struct QuadMesh
+{
+    float origin[3];
+    float scale[3];
+    std::vector<MeshQuad> quads;
+    std::vector<cv::Vec3b> colors; //empty or the RGB color of each quad.
+};
+
+/**
+ * @brief Compute the exposed faces of a voxelset.
+ * Only the faces between an occupied voxel and an empty one (or the limits
+ * of the voxelset) are generated and the coplanar faces of each slice are
+ * merged with greedy meshing.
+ */
+void compute_mesh(const VoxelSet& vs, QuadMesh& mesh);
+
+/**
+ * @brief Compute the colored exposed faces of a voxelset.
+ * Each exposed face is a quad with the color of its voxel (gray if the
+ * voxel has not a color), so the faces are not merged.
+ * \see compute_voxel_coloring()
+ */
+void compute_mesh(const VoxelSet& vs, const VoxelColors& colors, QuadMesh& mesh);
+
+/**
+ * @brief Compute the exposed faces of the BLACK octants of an octree.
+ * The faces between octants of different levels are clipped to the smaller
+ * one and the resulting coplanar faces are merged.
+ */
+void compute_mesh(const Octree& oct, QuadMesh& mesh);
+
+/**
+ * @brief Save a quad mesh in a binary format.
+ * @param out is the output stream (open it in binary mode).
+ * @param mesh is the mesh to save.
+ * @param format is the file format.
+ * @param buffer is an optional user buffer to pack the data before writing.
+ * @param buffer_size is the size of the buffer. If buffer is null, a buffer
+ *  of this size is allocated.
+ * @return true if success.
+ */
+bool save_mesh(std::ostream& out, const QuadMesh& mesh,
+               const MeshFormat format=PLY_FORMAT,
+               char* buffer=nullptr, size_t buffer_size=1<<22);
+
+/** @brief Save the exposed faces of a voxelset in a binary mesh format.*/
+bool save_mesh(std::ostream& out, const VoxelSet& vs,
+               const MeshFormat format=PLY_FORMAT,
+               char* buffer=nullptr, size_t buffer_size=1<<22);
+
+/** @brief Save the colored exposed faces of a voxelset in a binary mesh format.*/
+bool save_mesh(std::ostream& out, const VoxelSet& vs, const VoxelColors& colors,
+               const MeshFormat format=PLY_FORMAT,
+               char* buffer=nullptr, size_t buffer_size=1<<22);
+
+/** @brief Save the exposed faces of an octree in a binary mesh format.*/
+bool save_mesh(std::ostream& out, const Octree& oct,
+               const MeshFormat format=PLY_FORMAT,
+               char* buffer=nullptr, size_t buffer_size=1<<22);
+
+} //namespace fsiv
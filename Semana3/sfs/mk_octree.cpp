@@ -16,6 +16,11 @@ const cv::String keys =
 #endif
     "{max_errors     |0     | specifies how many fouls are allowed before a voxel is considered empty.}"
     "{oar_th         |0.5   | Occupancy area rate.}"
+    "{linear         |      | Build a pointer free linear octree.}"
+    "{binary         |      | Save the octree in the binary format (2 bits per octant).}"
+    "{codec          |1     | Codec of the binary format: 0 none, 1 zlib.}"
+    "{voxelset       |      | Also save the octree converted into a voxel set (voxel size vsize) to this file.}"
+    "{footprint      |0     | Projected octant footprint: 0 bbox, 1 convex hull.}"
     "{scene          |<none>| Set the scene dimensions in WCS units. Format xorig:yorig:zorig:xsize:ysize:zsize}"    
     "{vsize          |<none>| Set the max size of a voxel.}"
     "{output         |<none>| Output file to save the computed voxel set.}"
@@ -26,6 +31,16 @@ const cv::String keys =
     "{@view_n        |<none>| ... foreground image for view N.}"
     ;
 
+static size_t
+count_octants(const fsiv::Octant& oct)
+{
+    size_t n = 1;
+    if (!oct.is_leaf())
+        for (size_t c=0; c<8; ++c)
+            n += count_octants(oct.child(c));
+    return n;
+}
+
 int
 main (int argc, char* const* argv)
 {
@@ -63,7 +78,7 @@ main (int argc, char* const* argv)
           return EXIT_FAILURE;
       }
       size_t n_views = parser.get<int>("nviews");
-      std::ofstream output (parser.get<std::string>("output"));
+      std::ofstream output (parser.get<std::string>("output"), std::ios::binary);
       std::ofstream output_wrl(parser.get<std::string>("output")+".wrl");
       if (!output)
       {
@@ -105,12 +120,69 @@ main (int argc, char* const* argv)
       float max_dim = std::max(scene.x_dim(), scene.y_dim());
       max_dim = std::max(max_dim, scene.z_dim());
       size_t max_levels = std::ceil(std::log2(max_dim/vsize));
-      fsiv::Octree octree;
-      fsiv::compute_visual_hull(views, octree, scene, max_levels, max_errors,
-                                parser.get<float>("oar_th"));
-      output << octree;
+      const fsiv::FootprintMode footprint =
+              static_cast<fsiv::FootprintMode>(parser.get<int>("footprint"));
+      const bool binary = parser.has("binary");
+      const fsiv::OctreeCodec codec = static_cast<fsiv::OctreeCodec>(parser.get<int>("codec"));
+      if (parser.has("linear"))
+      {
+          fsiv::LinearOctree octree;
+          fsiv::compute_visual_hull(views, octree, scene, max_levels, max_errors,
+                                    parser.get<float>("oar_th"), footprint);
+          if (binary)
+          {
+              fsiv::Octree tree;
+              fsiv::convert(octree, tree);
+              fsiv::write_binary(output, tree, codec);
+          }
+          else
+              output << octree;
+          std::cout << "Nodes: " << octree.size() << std::endl;
+
+          fsiv::save_as_cubes_WRML(output_wrl, octree);
+          if (parser.has("voxelset"))
+          {
+              fsiv::Octree tree;
+              fsiv::VoxelSet vs;
+              fsiv::convert(octree, tree);
+              fsiv::convert(tree, vs, vsize);
+              std::ofstream output_vs(parser.get<std::string>("voxelset"));
+              if (!output_vs)
+              {
+                  std::cerr << "Error: could not open file ["
+                            << parser.get<std::string>("voxelset") << "] to write." << std::endl;
+                  return EXIT_FAILURE;
+              }
+              output_vs << vs;
+          }
+      }
+      else
+      {
+          fsiv::Octree octree;
+          fsiv::compute_visual_hull(views, octree, scene, max_levels, max_errors,
+                                    parser.get<float>("oar_th"), footprint);
+          if (binary)
+              fsiv::write_binary(output, octree, codec);
+          else
+              output << octree;
+          std::cout << "Nodes: " << (octree.is_empty() ? 0 : count_octants(octree.root()))
+                    << std::endl;
 
-      fsiv::save_as_cubes_WRML(output_wrl, octree);
+          fsiv::save_as_cubes_WRML(output_wrl, octree);
+          if (parser.has("voxelset"))
+          {
+              fsiv::VoxelSet vs;
+              fsiv::convert(octree, vs, vsize);
+              std::ofstream output_vs(parser.get<std::string>("voxelset"));
+              if (!output_vs)
+              {
+                  std::cerr << "Error: could not open file ["
+                            << parser.get<std::string>("voxelset") << "] to write." << std::endl;
+                  return EXIT_FAILURE;
+              }
+              output_vs << vs;
+          }
+      }
   }
   catch (std::exception& e)
   {
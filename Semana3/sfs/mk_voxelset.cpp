@@ -33,6 +33,16 @@ const cv::String keys =
     "{help h usage ? |      | print this message.}"
     "{verbose        |0     | Verbose level.}"
     "{oar_th         |0.5   | Occupancy area rate.}"
+    "{method         |0     | Visual hull method: 0 per voxel, 1 lattice sweep, 2 coarse to fine.}"
+    "{check          |      | Also carve the voxels one by one and fail if the hull of the method differs.}"
+    "{footprint      |0     | Projected voxel footprint: 0 bbox, 1 convex hull.}"
+    "{bits           |      | Use a bit packed occupancy map.}"
+    "{morton         |      | Use a Z-order layout for the voxels.}"
+    "{sparse         |      | Carve a sparse (8^3 bricks) voxel set (per voxel method).}"
+    "{bricks         |      | Save the voxel set in the chunked (32^3 bricks) format.}"
+    "{octree         |      | Also save the voxel set converted into an octree to this file.}"
+    "{scores         |0     | Keep the min OAR of the voxels with 8 or 16 bits (0 no scores).}"
+    "{mc             |      | Also save a marching cubes surface of the scores (iso oar_th) to this PLY file.}"
     "{scene          |<none>| Set the scene dimensions in WCS units. Format xorig:yorig:zorig:xsize:ysize:zsize}"
     "{vsize          |<none>| Set the voxel side size in WCS units.}"
     "{output         |<none>| Output file to save the computed voxel set.}"
@@ -109,12 +119,87 @@ int main(int argc, char *const *argv)
             }
             views.push_back(fsiv::View(view_name.str(), fg_img, cparams));
         }
-        fsiv::VoxelSet vs;
+        if (parser.has("sparse"))
+        {
+            fsiv::SparseVoxelSet svs;
+            fsiv::compute_visual_hull(views, svs, scene, voxel_size,
+                                      parser.get<float>("oar_th"),
+                                      static_cast<fsiv::FootprintMode>(parser.get<int>("footprint")));
+            std::cout << "Mixed bricks: " << svs.n_mixed_bricks() << " of "
+                      << svs.n_bricks() << " (" << svs.memory_size()
+                      << " bytes)." << std::endl;
+            output << svs;
+            fsiv::save_as_pointcloud_WRML(output_wrl, svs);
+            return EXIT_SUCCESS;
+        }
+        fsiv::VoxelSet vs(parser.has("bits") ? fsiv::BIT_STORAGE : fsiv::BYTE_STORAGE,
+                          parser.has("morton") ? fsiv::MORTON_LAYOUT : fsiv::LINEAR_LAYOUT);
+        const int score_bits = parser.get<int>("scores");
+        if (score_bits != 0 && score_bits != 8 && score_bits != 16)
+        {
+            std::cerr << "Error: wrong cli parameter scores." << std::endl;
+            return EXIT_FAILURE;
+        }
+        vs.set_score_depth(score_bits == 16 ? fsiv::SCORES_16U :
+                           score_bits == 8 ? fsiv::SCORES_8U : fsiv::NO_SCORES);
         fsiv::compute_visual_hull(views, vs, scene, voxel_size,
-                                  parser.get<float>("oar_th"));
-        output << vs;
+                                  parser.get<float>("oar_th"),
+                                  static_cast<fsiv::VoxelSetHullMethod>(parser.get<int>("method")),
+                                  static_cast<fsiv::FootprintMode>(parser.get<int>("footprint")));
+        if (parser.has("check"))
+        {
+            fsiv::VoxelSet ref;
+            fsiv::compute_visual_hull(views, ref, scene, voxel_size,
+                                      parser.get<float>("oar_th"), fsiv::VH_PER_VOXEL,
+                                      static_cast<fsiv::FootprintMode>(parser.get<int>("footprint")));
+            size_t n_diffs = 0;
+            for (size_t z = 0; z < vs.z_size(); ++z)
+                for (size_t y = 0; y < vs.y_size(); ++y)
+                    for (size_t x = 0; x < vs.x_size(); ++x)
+                        n_diffs += vs.occupancy(x, y, z) != ref.occupancy(x, y, z);
+            std::cout << "Voxels different from the per voxel hull: " << n_diffs << std::endl;
+            if (n_diffs > 0)
+                return EXIT_FAILURE;
+        }
+        if (parser.has("bricks"))
+        {
+            output.close();
+            if (!fsiv::save_bricked(parser.get<std::string>("output"), vs))
+            {
+                std::cerr << "Error: could not write the file ["
+                          << parser.get<std::string>("output") << "]." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else
+            output << vs;
 
         fsiv::save_as_pointcloud_WRML(output_wrl, vs);
+        if (parser.has("mc"))
+        {
+            std::ofstream output_mc(parser.get<std::string>("mc"), std::ios::binary);
+            if (!output_mc ||
+                    !fsiv::save_marching_cubes(output_mc, vs, parser.get<float>("oar_th")))
+            {
+                std::cerr << "Error: could not write the file ["
+                          << parser.get<std::string>("mc") << "]." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        if (parser.has("octree"))
+        {
+            fsiv::Octree octree;
+            const size_t levels = fsiv::convert(vs, octree);
+            std::ofstream output_octree(parser.get<std::string>("octree"));
+            if (!output_octree)
+            {
+                std::cerr << "Error: could not open file ["
+                          << parser.get<std::string>("octree") << "] to write." << std::endl;
+                return EXIT_FAILURE;
+            }
+            output_octree << octree;
+            std::cout << "Octree levels: " << levels << std::endl;
+        }
 
         // save_as_cubes_WRML(output_wrl, vs);
     }
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace fsiv
+{
+
+/**
+ * @brief Scatter the low bits of a value to the bit positions set in a mask.
+ * It is the PDEP operation: with BMI2 support it is a single instruction.
+ */
+inline std::uint64_t
+deposit_bits(const std::uint64_t value, std::uint64_t mask)
+{
+#if defined(__BMI2__)
+    return _pdep_u64(value, mask);
+#else
+    std::uint64_t ret = 0;
+    for (std::uint64_t bit = 1; mask; bit += bit)
+    {
+        if (value & bit)
+            ret |= mask & (~mask + 1);
+        mask &= mask - 1;
+    }
+    return ret;
+#endif
+}
+
+/**
+ * @brief Gather the bits of a value at the positions set in a mask.
+ * It is the PEXT operation: with BMI2 support it is a single instruction.
+ */
+inline std::uint64_t
+extract_bits(const std::uint64_t value, std::uint64_t mask)
+{
+#if defined(__BMI2__)
+    return _pext_u64(value, mask);
+#else
+    std::uint64_t ret = 0;
+    for (std::uint64_t bit = 1; mask; bit += bit)
+    {
+        if (value & mask & (~mask + 1))
+            ret |= bit;
+        mask &= mask - 1;
+    }
+    return ret;
+#endif
+}
+
+/**
+ * @brief Compute the Morton masks for a grid of 2^bx x 2^by x 2^bz cells.
+ * Bits are interleaved from the lsb as z, y, x (an octree child index is
+ * x*4+y*2+z) while each axis has bits left, so a non cubic grid is padded
+ * to powers of two on each axis and not to a cube.
+ */
+inline void
+morton_masks(const int bx, const int by, const int bz,
+             std::uint64_t& mx, std::uint64_t& my, std::uint64_t& mz)
+{
+    mx = my = mz = 0;
+    int pos = 0;
+    for (int b = 0; b < bx || b < by || b < bz; ++b)
+    {
+        if (b < bz)
+            mz |= std::uint64_t(1) << pos++;
+        if (b < by)
+            my |= std::uint64_t(1) << pos++;
+        if (b < bx)
+            mx |= std::uint64_t(1) << pos++;
+    }
+}
+
+} //namespace fsiv
@@ -0,0 +1,80 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<cstdlib>
+#include<stdexcept>
+#include<algorithm>
+#include <opencv2/core.hpp>
+#include "sfs.hpp"
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{stl            |      | save in binary stl format instead of binary ply.}"
+    "{buffer         |4     | size in MB of the write buffer.}"
+    "{@input         |<none>| input octree data.}"
+    "{@output        |<none>| output .ply/.stl file.}"
+    ;
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Save the surface of an octree as a binary mesh.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+
+      std::ifstream input (parser.get<std::string>("@input"), std::ios::binary);
+      if (!input)
+      {
+          std::cerr << "Error: could not open the file ["
+                    <<parser.get<std::string>("@input")
+                   << "] to read." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::ofstream output(parser.get<std::string>("@output"), std::ios::binary);
+      if (!output)
+      {
+          std::cerr << "Error: could not open the file ["
+                    <<parser.get<std::string>("@output")
+                   << "] to write." << std::endl;
+          return EXIT_FAILURE;
+      }
+      fsiv::Octree octree;
+      input >> octree;
+      std::vector<char> buffer(size_t(std::max(1, parser.get<int>("buffer"))) << 20);
+      int64_t t0 = cv::getTickCount();
+      fsiv::QuadMesh mesh;
+      fsiv::compute_mesh(octree, mesh);
+      const double t_mesh = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      t0 = cv::getTickCount();
+      if (!fsiv::save_mesh(output, mesh,
+                           parser.has("stl") ? fsiv::STL_FORMAT : fsiv::PLY_FORMAT,
+                           &buffer[0], buffer.size()))
+      {
+          std::cerr << "Error: could not write the mesh." << std::endl;
+          return EXIT_FAILURE;
+      }
+      const double t_write = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      std::cout << "Quads: " << mesh.quads.size() << " meshing: " << t_mesh
+                << " s writing: " << t_write << " s" << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
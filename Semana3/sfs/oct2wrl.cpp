@@ -9,6 +9,7 @@
 
 const cv::String keys =
     "{help h usage ? |      | print this message.}"
+    "{linear         |      | Load the octree as a pointer free linear octree.}"
     "{@input         |<none>| input voxel set data.}"
     "{@output        |<none>| output .wrl file.}"
     ;
@@ -28,7 +29,7 @@ main (int argc, char* const* argv)
           return 0;
       }
 
-      std::ifstream input (parser.get<std::string>("@input"));
+      std::ifstream input (parser.get<std::string>("@input"), std::ios::binary);
       if (!input)
       {
           std::cerr << "Error: could not open the file ["
@@ -44,9 +45,18 @@ main (int argc, char* const* argv)
                    << "] to write." << std::endl;
           return EXIT_FAILURE;
       }
-      fsiv::Octree octree;
-      input >> octree;
-      fsiv::save_as_cubes_WRML(output, octree);
+      if (parser.has("linear"))
+      {
+          fsiv::LinearOctree octree;
+          input >> octree;
+          fsiv::save_as_cubes_WRML(output, octree);
+      }
+      else
+      {
+          fsiv::Octree octree;
+          input >> octree;
+          fsiv::save_as_cubes_WRML(output, octree);
+      }
   }
   catch (std::exception& e)
   {
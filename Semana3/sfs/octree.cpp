@@ -1,4 +1,7 @@
+#include <cmath>
+#include <algorithm>
 #include "octree.hpp"
+#include "octree_file.hpp"
 
 namespace fsiv {
 
@@ -74,6 +77,12 @@ Octant::split()
 
 }
 
+void
+Octant::merge()
+{
+    std::vector<Octant>().swap(children_);
+}
+
 Octree::Octree():
     root_(nullptr)
 {
@@ -163,6 +172,8 @@ operator >> (std::istream& in, Octree& octree)
             octree.set_root(root);
         }
     }
+    else if (in && signature==octree_binary_signature())
+        read_binary_octree_data(in, octree);
     return in;
 }
 
@@ -196,4 +207,163 @@ void save_as_cubes_WRML (std::ostream& out, const Octree& oct,
 }
 
 
+
+/** @brief Collect the BLACK octants of a subtree.*/
+static void
+collect_black_octants(const Octant& oct, std::vector<const Octant*>& black)
+{
+    if (oct.state()==BLACK)
+        black.push_back(&oct);
+    else if (oct.state()==GREY && !oct.is_leaf())
+        for (size_t c=0; c<8; ++c)
+            collect_black_octants(oct.child(c), black);
+}
+
+/**
+ * @brief Get the voxels [i0, i1) of an axis whose center is inside of the
+ * octant range [o, o+d).
+ */
+static void
+voxel_range(const float o, const float d, const float b, const float vsize,
+            const size_t n, size_t& i0, size_t& i1)
+{
+    const float f0 = std::ceil((o - b)/vsize - 0.5f);
+    const float f1 = std::ceil((o + d - b)/vsize - 0.5f);
+    i0 = f0 < 0.0f ? 0 : std::min(n, size_t(f0));
+    i1 = f1 < 0.0f ? 0 : std::min(n, size_t(f1));
+}
+
+void
+convert(const Octree& src, VoxelSet& dst, const float vsize)
+{
+    CV_Assert(!src.is_empty());
+    const Voxel& scene = src.root().voxel();
+    dst.reset(scene, vsize, false);
+    //The voxel ranges of the octants are measured from the scene corner.
+    const Voxel& bc = dst.bounding_cuve();
+    CV_Assert(bc.x()==scene.x() && bc.y()==scene.y() && bc.z()==scene.z());
+    std::vector<const Octant*> black;
+    collect_black_octants(src.root(), black);
+    const float b[3] = {scene.x(), scene.y(), scene.z()};
+    const size_t n[3] = {dst.x_size(), dst.y_size(), dst.z_size()};
+    const bool runs = dst.layout()==LINEAR_LAYOUT;
+    //The octants are disjoint, so they are filled in parallel. With the
+    //linear layout each x run of voxels is a range of indices.
+#pragma omp parallel for schedule(dynamic, 16)
+    for (size_t k=0; k<black.size(); ++k)
+    {
+        const Voxel& v = black[k]->voxel();
+        const float o[3] = {v.x(), v.y(), v.z()};
+        const float d[3] = {v.x_dim(), v.y_dim(), v.z_dim()};
+        size_t i0[3], i1[3];
+        for (int a=0; a<3; ++a)
+            voxel_range(o[a], d[a], b[a], vsize, n[a], i0[a], i1[a]);
+        if (i0[0]>=i1[0])
+            continue;
+        for (size_t z=i0[2]; z<i1[2]; ++z)
+            for (size_t y=i0[1]; y<i1[1]; ++y)
+            {
+                if (runs)
+                {
+                    const size_t idx = dst.xyz2index(i0[0], y, z);
+                    dst.fill_occupancy(idx, idx + i1[0] - i0[0], true);
+                }
+                else
+                    for (size_t x=i0[0]; x<i1[0]; ++x)
+                        dst.set_occupancy(x, y, z, true);
+            }
+    }
+}
+
+/** @brief Levels of the octree built by tasks when converting a voxelset.*/
+static const size_t convert_task_levels = 2;
+
+/**
+ * @brief Build the octant covering the voxels [x0, x0+side)^3.
+ * The children are built first and a block of 8 leaves with the same state
+ * is merged, so the tree is built bottom-up.
+ */
+static void
+build_octant(const VoxelSet& vs, Octant& oct, const size_t x0, const size_t y0,
+             const size_t z0, const size_t side, const size_t level)
+{
+    //The padding of the cube is empty.
+    if (x0>=vs.x_size() || y0>=vs.y_size() || z0>=vs.z_size())
+    {
+        oct.set_state(WHITE);
+        return;
+    }
+    if (side==1)
+    {
+        oct.set_state(vs.occupancy(x0, y0, z0) ? BLACK : WHITE);
+        return;
+    }
+    if (side==2)
+    {
+        //The last level is read at once so the uniform blocks are not split.
+        bool occ[8];
+        size_t n_occ = 0;
+        for (size_t i=0; i<8; ++i)
+        {
+            const size_t x = x0 + ((i>>2)&1), y = y0 + ((i>>1)&1), z = z0 + (i&1);
+            occ[i] = x<vs.x_size() && y<vs.y_size() && z<vs.z_size() &&
+                     vs.occupancy(x, y, z);
+            n_occ += occ[i];
+        }
+        if (n_occ==0 || n_occ==8)
+        {
+            oct.set_state(n_occ ? BLACK : WHITE);
+            return;
+        }
+        oct.split();
+        oct.set_state(GREY);
+        for (size_t i=0; i<8; ++i)
+            oct.child(i).set_state(occ[i] ? BLACK : WHITE);
+        return;
+    }
+    oct.split();
+    const size_t half = side/2;
+    for (size_t i=0; i<8; ++i)
+    {
+#pragma omp task if(level < convert_task_levels) shared(vs, oct)
+        build_octant(vs, oct.child(i), x0 + ((i>>2)&1)*half, y0 + ((i>>1)&1)*half,
+                     z0 + (i&1)*half, half, level+1);
+    }
+#pragma omp taskwait
+    const OctantState st = oct.child(0).state();
+    bool uniform = st!=GREY;
+    for (size_t i=1; i<8 && uniform; ++i)
+        uniform = oct.child(i).state()==st;
+    if (uniform)
+    {
+        oct.merge();
+        oct.set_state(st);
+    }
+    else
+        oct.set_state(GREY);
+}
+
+size_t
+convert(const VoxelSet& src, Octree& dst)
+{
+    size_t levels = 0;
+    const size_t n = std::max(src.x_size(), std::max(src.y_size(), src.z_size()));
+    while ((size_t(1) << levels) < n)
+        ++levels;
+    const size_t side = size_t(1) << levels;
+    const Voxel& scene = src.bounding_cuve();
+    const float root_side = side * src.vsize();
+    Octant root(Voxel(scene.x(), scene.y(), scene.z(), root_side, root_side, root_side));
+    if (n==0)
+        root.set_state(WHITE);
+    else
+    {
+#pragma omp parallel
+#pragma omp single
+        build_octant(src, root, 0, 0, 0, side, 0);
+    }
+    dst.set_root(root);
+    return levels;
+}
+
 }
@@ -3,6 +3,7 @@
 #include <memory>
 #include <vector>
 #include "voxel.hpp"
+#include "voxelset.hpp"
 
 
 namespace fsiv {
@@ -27,6 +28,7 @@ public:
     OctantState state() const;
     void set_state(OctantState new_state);
     void split();
+    void merge();
     bool is_leaf() const;
     const Octant& child(size_t i) const;
     Octant& child(size_t i);
@@ -56,6 +58,23 @@ private:
 
 std::ostream& operator << (std::ostream& out, const Octree& octree);
 std::istream& operator >> (std::istream& in, Octree& octree);
+/**
+ * @brief Rasterise an octree into a voxelset.
+ * The voxelset covers the root octant and a voxel is occupied if its center
+ * is inside of a BLACK octant. The storage and layout of dst are kept.
+ * @param vsize is the voxel size of dst.
+ */
+void convert(const Octree& src, VoxelSet& dst, const float vsize);
+
+/**
+ * @brief Build an octree from a voxelset.
+ * The root is the cube of 2^L voxels per side (the padding is WHITE) and
+ * the uniform blocks of 2x2x2 octants are merged bottom-up, so each leaf
+ * of the last level is a voxel.
+ * @return the number of levels L of the octree.
+ */
+size_t convert(const VoxelSet& src, Octree& dst);
+
 void save_as_cubes_WRML (std::ostream& out, const Octree& oct,
             const cv::Scalar & color=cv::Scalar(255, 255, 255));
 
@@ -0,0 +1,217 @@
+#include <fstream>
+#include <iomanip>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <zlib.h>
+#include "octree_file.hpp"
+
+namespace fsiv {
+
+static std::string binary_signature = "octreebin";
+
+const std::string&
+octree_binary_signature()
+{
+    return binary_signature;
+}
+
+/** @brief Get the octant states in breadth-first order packed 4 per byte.*/
+static size_t
+pack_codes(const Octree& octree, std::vector<std::uint8_t>& codes)
+{
+    codes.clear();
+    if (octree.is_empty())
+        return 0;
+    size_t n = 0;
+    std::deque<const Octant*> queue(1, &octree.root());
+    while (!queue.empty())
+    {
+        const Octant& oct = *queue.front();
+        queue.pop_front();
+        if (n % 4 == 0)
+            codes.push_back(0);
+        codes.back() |= std::uint8_t(oct.state()) << (2 * (n % 4));
+        ++n;
+        if (oct.state()==GREY)
+            for (size_t c=0; c<8; ++c)
+                queue.push_back(&oct.child(c));
+    }
+    return n;
+}
+
+static void
+write_uint32(std::ostream& out, const std::uint32_t v)
+{
+    const std::uint8_t bytes[4] = {std::uint8_t(v), std::uint8_t(v >> 8),
+                                   std::uint8_t(v >> 16), std::uint8_t(v >> 24)};
+    out.write(reinterpret_cast<const char*>(bytes), 4);
+}
+
+static bool
+read_uint32(std::istream& in, std::uint32_t& v)
+{
+    std::uint8_t bytes[4];
+    if (!in.read(reinterpret_cast<char*>(bytes), 4))
+        return false;
+    v = std::uint32_t(bytes[0]) | (std::uint32_t(bytes[1]) << 8) |
+        (std::uint32_t(bytes[2]) << 16) | (std::uint32_t(bytes[3]) << 24);
+    return true;
+}
+
+std::ostream&
+write_binary(std::ostream& out, const Octree& octree, const OctreeCodec codec,
+             const int level)
+{
+    std::vector<std::uint8_t> codes;
+    const size_t n = pack_codes(octree, codes);
+    const size_t n_blocks = (codes.size() + OCTREE_BLOCK_BYTES - 1) / OCTREE_BLOCK_BYTES;
+
+    out << binary_signature << std::endl;
+    out << std::scientific << std::setprecision(9);
+    out << "root = " << (octree.is_empty() ? Voxel() : octree.root().voxel()) << std::endl;
+    out.unsetf(std::ios::scientific);
+    out << "nodes = " << n << std::endl;
+    out << "codec = " << int(codec) << std::endl;
+    out << "block = " << OCTREE_BLOCK_BYTES << std::endl;
+    out << '#';
+
+    std::vector<std::vector<Bytef>> packed(codec==OCTREE_CODEC_ZLIB ? n_blocks : 0);
+    bool error = false;
+#pragma omp parallel for schedule(dynamic) reduction(||:error)
+    for (size_t b = 0; b < packed.size(); ++b)
+    {
+        const size_t begin = b * OCTREE_BLOCK_BYTES;
+        const size_t size = std::min(codes.size() - begin, OCTREE_BLOCK_BYTES);
+        uLongf len = compressBound(size);
+        packed[b].resize(len);
+        if (compress2(&packed[b][0], &len, &codes[begin], size, level) != Z_OK)
+            error = true;
+        packed[b].resize(len);
+    }
+    if (error)
+        throw std::runtime_error("ZLIB error");
+    for (size_t b = 0; b < n_blocks && out; ++b)
+    {
+        const size_t begin = b * OCTREE_BLOCK_BYTES;
+        const size_t size = std::min(codes.size() - begin, OCTREE_BLOCK_BYTES);
+        write_uint32(out, std::uint32_t(size));
+        if (codec==OCTREE_CODEC_ZLIB)
+        {
+            write_uint32(out, std::uint32_t(packed[b].size()));
+            out.write(reinterpret_cast<const char*>(&packed[b][0]), packed[b].size());
+        }
+        else
+        {
+            write_uint32(out, std::uint32_t(size));
+            out.write(reinterpret_cast<const char*>(&codes[begin]), size);
+        }
+    }
+    return out;
+}
+
+std::istream&
+read_binary_octree_data(std::istream& in, Octree& octree)
+{
+    std::string key, sep;
+    Voxel root_voxel;
+    size_t n = 0, block = 0;
+    int codec = 0;
+    in >> key >> sep >> root_voxel;
+    if (!in || key != "root")
+        throw std::runtime_error("Wrong Input Format: root");
+    in >> key >> sep >> n;
+    if (!in || key != "nodes")
+        throw std::runtime_error("Wrong Input Format: nodes");
+    in >> key >> sep >> codec;
+    if (!in || key != "codec" || (codec != OCTREE_CODEC_NONE && codec != OCTREE_CODEC_ZLIB))
+        throw std::runtime_error("Wrong Input Format: codec");
+    in >> key >> sep >> block;
+    if (!in || key != "block" || block == 0)
+        throw std::runtime_error("Wrong Input Format: block");
+    char flag = 0;
+    in >> flag;
+    if (!in || flag != '#')
+        throw std::runtime_error("Wrong Input Format: binary flag.");
+
+    octree = Octree();
+    if (n == 0)
+        return in;
+    if (root_voxel.volume() <= 0.0)
+        throw std::runtime_error("Wrong Input Format: root");
+    //The tree is built in place.
+    octree.set_root(Octant(root_voxel));
+
+    //The octants waiting for their state in breadth-first order.
+    std::deque<Octant*> queue(1, &octree.root());
+    std::vector<std::uint8_t> stored, codes;
+    size_t decoded = 0;
+    while (decoded < n)
+    {
+        std::uint32_t raw_size = 0, stored_size = 0;
+        if (!read_uint32(in, raw_size) || !read_uint32(in, stored_size) ||
+                raw_size == 0 || raw_size > block)
+            throw std::runtime_error("Wrong Input Format: block header.");
+        stored.resize(stored_size);
+        if (stored_size > 0 && !in.read(reinterpret_cast<char*>(&stored[0]), stored_size))
+            throw std::runtime_error("Wrong Input Format: truncated block.");
+        if (codec == OCTREE_CODEC_ZLIB)
+        {
+            codes.resize(raw_size);
+            uLongf len = raw_size;
+            if (uncompress(&codes[0], &len, &stored[0], stored_size) != Z_OK ||
+                    len != raw_size)
+                throw std::runtime_error("Wrong Input Format: ZLIB uncompress error.");
+        }
+        else
+        {
+            if (stored_size != raw_size)
+                throw std::runtime_error("Wrong Input Format: block header.");
+            codes.swap(stored);
+        }
+        const size_t block_nodes = std::min(n - decoded, size_t(4) * raw_size);
+        for (size_t i = 0; i < block_nodes; ++i)
+        {
+            const int state = (codes[i / 4] >> (2 * (i % 4))) & 3;
+            if (state > BLACK || queue.empty())
+                throw std::runtime_error("Wrong Input Format: octant code.");
+            Octant& oct = *queue.front();
+            queue.pop_front();
+            oct.set_state(static_cast<OctantState>(state));
+            if (oct.state()==GREY)
+            {
+                //The children are not moved any more, so they can be queued.
+                oct.split();
+                for (size_t c=0; c<8; ++c)
+                    queue.push_back(&oct.child(c));
+            }
+        }
+        decoded += block_nodes;
+    }
+    if (!queue.empty())
+        throw std::runtime_error("Wrong Input Format: truncated octree.");
+    return in;
+}
+
+bool
+save_binary(const std::string& fname, const Octree& octree,
+            const OctreeCodec codec, const int level)
+{
+    std::ofstream out(fname, std::ios::binary);
+    if (!out)
+        return false;
+    write_binary(out, octree, codec, level);
+    return bool(out);
+}
+
+bool
+is_binary_octree_file(const std::string& fname)
+{
+    std::ifstream in(fname);
+    std::string signature;
+    in >> signature;
+    return in && signature == binary_signature;
+}
+
+} //namespace fsiv
@@ -0,0 +1,70 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+#include "octree.hpp"
+
+namespace fsiv
+{
+
+/*
+ * The binary octree file format.
+ *
+ * The states of the octants are written in breadth-first order with 2 bits
+ * per octant (a OctantState), four octants per byte with the first one in
+ * the low bits. As in the text format only the children of the GREY octants
+ * are written. The file is:
+ *  - a text header with the signature "octreebin", the root voxel, the
+ *    number of octants, the codec and the block size,
+ *  - the flag '#',
+ *  - the blocks of codes: the raw and the stored sizes (32 bits little
+ *    endian) and the stored bytes. Each block is compressed on its own, so
+ *    the codes can be decoded block by block.
+ * The operator>>(std::istream&, Octree&) reads both the text and the binary
+ * formats.
+ */
+
+/** @brief Codecs of the blocks of codes. */
+typedef enum {
+    OCTREE_CODEC_NONE=0, //raw codes.
+    OCTREE_CODEC_ZLIB=1  //zlib compressed codes.
+} OctreeCodec;
+
+/** @brief Bytes of codes (four octants per byte) of a block. */
+static const size_t OCTREE_BLOCK_BYTES = 1 << 16;
+
+/**
+ * @brief Write an octree in the binary format.
+ * The blocks are compressed in parallel (OpenMP).
+ * @param level is the zlib compression level.
+ * @throw std::runtime_error if there is a zlib error.
+ */
+std::ostream& write_binary(std::ostream& out, const Octree& octree,
+                           const OctreeCodec codec=OCTREE_CODEC_ZLIB,
+                           const int level=6);
+
+/**
+ * @brief Read the binary octree that follows the signature in a stream.
+ * The tree is built in breadth-first order with a queue of octants waiting
+ * for their state, so there is not recursion, and only a block of codes is
+ * kept in memory.
+ * @throw std::runtime_error if the data has a wrong format.
+ */
+std::istream& read_binary_octree_data(std::istream& in, Octree& octree);
+
+/**
+ * @brief Save an octree in the binary format.
+ * @return true if success.
+ */
+bool save_binary(const std::string& fname, const Octree& octree,
+                 const OctreeCodec codec=OCTREE_CODEC_ZLIB,
+                 const int level=6);
+
+/** @brief Test if a file has the binary octree signature.*/
+bool is_binary_octree_file(const std::string& fname);
+
+/** @brief Get the signature of the binary octree format.*/
+const std::string& octree_binary_signature();
+
+} //namespace fsiv
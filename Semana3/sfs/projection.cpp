@@ -0,0 +1,267 @@
+#include "projection.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FSIV_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FSIV_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+namespace fsiv {
+
+/** @brief Project the points [begin, n) one by one. */
+static void
+project_points_scalar(const ProjectionModel& m,
+                      const float* X, const float* Y, const float* Z,
+                      const size_t begin, const size_t n, float* u, float* v)
+{
+    const float* P = m.P;
+    const float* Rt = m.Rt;
+    const float* d = m.dist;
+    for (size_t i = begin; i < n; ++i)
+    {
+        if (!m.distorted)
+        {
+            const float w = P[8]*X[i] + P[9]*Y[i] + P[10]*Z[i] + P[11];
+            const float iw = (w!=0.0f) ? 1.0f/w : 1.0f;
+            u[i] = (P[0]*X[i] + P[1]*Y[i] + P[2]*Z[i] + P[3])*iw;
+            v[i] = (P[4]*X[i] + P[5]*Y[i] + P[6]*Z[i] + P[7])*iw;
+            continue;
+        }
+        const float xc = Rt[0]*X[i] + Rt[1]*Y[i] + Rt[2]*Z[i] + Rt[3];
+        const float yc = Rt[4]*X[i] + Rt[5]*Y[i] + Rt[6]*Z[i] + Rt[7];
+        const float zc = Rt[8]*X[i] + Rt[9]*Y[i] + Rt[10]*Z[i] + Rt[11];
+        const float iz = (zc!=0.0f) ? 1.0f/zc : 1.0f;
+        const float x = xc*iz;
+        const float y = yc*iz;
+        const float r2 = x*x + y*y;
+        const float radial = 1.0f + r2*(d[0] + r2*(d[1] + r2*d[4]));
+        const float xd = x*radial + 2.0f*d[2]*x*y + d[3]*(r2 + 2.0f*x*x);
+        const float yd = y*radial + d[2]*(r2 + 2.0f*y*y) + 2.0f*d[3]*x*y;
+        u[i] = m.fx*xd + m.cx;
+        v[i] = m.fy*yd + m.cy;
+    }
+}
+
+#ifdef FSIV_HAVE_AVX2_KERNEL
+
+/** @brief r[0]*x + r[1]*y + r[2]*z + r[3] with the same rounding as the scalar code.*/
+__attribute__((target("avx2"))) static inline __m256
+avx2_row(const float* r, const __m256 x, const __m256 y, const __m256 z)
+{
+    __m256 acc = _mm256_mul_ps(_mm256_set1_ps(r[0]), x);
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(r[1]), y));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(r[2]), z));
+    return _mm256_add_ps(acc, _mm256_set1_ps(r[3]));
+}
+
+/** @brief 1/w, or 1 where w is zero.*/
+__attribute__((target("avx2"))) static inline __m256
+avx2_inverse(const __m256 w)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    return _mm256_blendv_ps(_mm256_div_ps(one, w), one, zero);
+}
+
+__attribute__((target("avx2"))) static void
+project_points_avx2(const ProjectionModel& m,
+                    const float* X, const float* Y, const float* Z,
+                    const size_t n, float* u, float* v)
+{
+    const size_t n8 = n & ~size_t(7);
+    if (!m.distorted)
+    {
+        for (size_t i = 0; i < n8; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(X + i);
+            const __m256 y = _mm256_loadu_ps(Y + i);
+            const __m256 z = _mm256_loadu_ps(Z + i);
+            const __m256 iw = avx2_inverse(avx2_row(m.P + 8, x, y, z));
+            _mm256_storeu_ps(u + i, _mm256_mul_ps(avx2_row(m.P, x, y, z), iw));
+            _mm256_storeu_ps(v + i, _mm256_mul_ps(avx2_row(m.P + 4, x, y, z), iw));
+        }
+    }
+    else
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 k1 = _mm256_set1_ps(m.dist[0]);
+        const __m256 k2 = _mm256_set1_ps(m.dist[1]);
+        const __m256 p1 = _mm256_set1_ps(m.dist[2]);
+        const __m256 p2 = _mm256_set1_ps(m.dist[3]);
+        const __m256 k3 = _mm256_set1_ps(m.dist[4]);
+        const __m256 two_p1 = _mm256_set1_ps(2.0f*m.dist[2]);
+        const __m256 two_p2 = _mm256_set1_ps(2.0f*m.dist[3]);
+        for (size_t i = 0; i < n8; i += 8)
+        {
+            const __m256 X8 = _mm256_loadu_ps(X + i);
+            const __m256 Y8 = _mm256_loadu_ps(Y + i);
+            const __m256 Z8 = _mm256_loadu_ps(Z + i);
+            const __m256 iz = avx2_inverse(avx2_row(m.Rt + 8, X8, Y8, Z8));
+            const __m256 x = _mm256_mul_ps(avx2_row(m.Rt, X8, Y8, Z8), iz);
+            const __m256 y = _mm256_mul_ps(avx2_row(m.Rt + 4, X8, Y8, Z8), iz);
+            const __m256 xx = _mm256_mul_ps(x, x);
+            const __m256 yy = _mm256_mul_ps(y, y);
+            const __m256 r2 = _mm256_add_ps(xx, yy);
+            __m256 radial = _mm256_add_ps(k2, _mm256_mul_ps(r2, k3));
+            radial = _mm256_add_ps(k1, _mm256_mul_ps(r2, radial));
+            radial = _mm256_add_ps(one, _mm256_mul_ps(r2, radial));
+            __m256 xd = _mm256_mul_ps(x, radial);
+            xd = _mm256_add_ps(xd, _mm256_mul_ps(_mm256_mul_ps(two_p1, x), y));
+            xd = _mm256_add_ps(xd, _mm256_mul_ps(p2, _mm256_add_ps(r2, _mm256_mul_ps(two, xx))));
+            __m256 yd = _mm256_mul_ps(y, radial);
+            yd = _mm256_add_ps(yd, _mm256_mul_ps(p1, _mm256_add_ps(r2, _mm256_mul_ps(two, yy))));
+            yd = _mm256_add_ps(yd, _mm256_mul_ps(_mm256_mul_ps(two_p2, x), y));
+            _mm256_storeu_ps(u + i, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.fx), xd),
+                                                  _mm256_set1_ps(m.cx)));
+            _mm256_storeu_ps(v + i, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.fy), yd),
+                                                  _mm256_set1_ps(m.cy)));
+        }
+    }
+    project_points_scalar(m, X, Y, Z, n8, n, u, v);
+}
+
+#endif //FSIV_HAVE_AVX2_KERNEL
+
+#ifdef FSIV_HAVE_NEON_KERNEL
+
+/** @brief r[0]*x + r[1]*y + r[2]*z + r[3] with the same rounding as the scalar code.*/
+static inline float32x4_t
+neon_row(const float* r, const float32x4_t x, const float32x4_t y, const float32x4_t z)
+{
+    float32x4_t acc = vmulq_n_f32(x, r[0]);
+    acc = vaddq_f32(acc, vmulq_n_f32(y, r[1]));
+    acc = vaddq_f32(acc, vmulq_n_f32(z, r[2]));
+    return vaddq_f32(acc, vdupq_n_f32(r[3]));
+}
+
+/** @brief 1/w, or 1 where w is zero.*/
+static inline float32x4_t
+neon_inverse(const float32x4_t w)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const uint32x4_t zero = vceqq_f32(w, vdupq_n_f32(0.0f));
+    return vbslq_f32(zero, one, vdivq_f32(one, w));
+}
+
+static void
+project_points_neon(const ProjectionModel& m,
+                    const float* X, const float* Y, const float* Z,
+                    const size_t n, float* u, float* v)
+{
+    const size_t n4 = n & ~size_t(3);
+    if (!m.distorted)
+    {
+        for (size_t i = 0; i < n4; i += 4)
+        {
+            const float32x4_t x = vld1q_f32(X + i);
+            const float32x4_t y = vld1q_f32(Y + i);
+            const float32x4_t z = vld1q_f32(Z + i);
+            const float32x4_t iw = neon_inverse(neon_row(m.P + 8, x, y, z));
+            vst1q_f32(u + i, vmulq_f32(neon_row(m.P, x, y, z), iw));
+            vst1q_f32(v + i, vmulq_f32(neon_row(m.P + 4, x, y, z), iw));
+        }
+    }
+    else
+    {
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        for (size_t i = 0; i < n4; i += 4)
+        {
+            const float32x4_t X4 = vld1q_f32(X + i);
+            const float32x4_t Y4 = vld1q_f32(Y + i);
+            const float32x4_t Z4 = vld1q_f32(Z + i);
+            const float32x4_t iz = neon_inverse(neon_row(m.Rt + 8, X4, Y4, Z4));
+            const float32x4_t x = vmulq_f32(neon_row(m.Rt, X4, Y4, Z4), iz);
+            const float32x4_t y = vmulq_f32(neon_row(m.Rt + 4, X4, Y4, Z4), iz);
+            const float32x4_t xx = vmulq_f32(x, x);
+            const float32x4_t yy = vmulq_f32(y, y);
+            const float32x4_t r2 = vaddq_f32(xx, yy);
+            float32x4_t radial = vaddq_f32(vdupq_n_f32(m.dist[1]), vmulq_n_f32(r2, m.dist[4]));
+            radial = vaddq_f32(vdupq_n_f32(m.dist[0]), vmulq_f32(r2, radial));
+            radial = vaddq_f32(one, vmulq_f32(r2, radial));
+            float32x4_t xd = vmulq_f32(x, radial);
+            xd = vaddq_f32(xd, vmulq_f32(vmulq_n_f32(x, 2.0f*m.dist[2]), y));
+            xd = vaddq_f32(xd, vmulq_n_f32(vaddq_f32(r2, vmulq_n_f32(xx, 2.0f)), m.dist[3]));
+            float32x4_t yd = vmulq_f32(y, radial);
+            yd = vaddq_f32(yd, vmulq_n_f32(vaddq_f32(r2, vmulq_n_f32(yy, 2.0f)), m.dist[2]));
+            yd = vaddq_f32(yd, vmulq_f32(vmulq_n_f32(x, 2.0f*m.dist[3]), y));
+            vst1q_f32(u + i, vaddq_f32(vmulq_n_f32(xd, m.fx), vdupq_n_f32(m.cx)));
+            vst1q_f32(v + i, vaddq_f32(vmulq_n_f32(yd, m.fy), vdupq_n_f32(m.cy)));
+        }
+    }
+    project_points_scalar(m, X, Y, Z, n4, n, u, v);
+}
+
+#endif //FSIV_HAVE_NEON_KERNEL
+
+bool
+projection_kernel_supported(const ProjectionKernel kernel)
+{
+    switch (kernel)
+    {
+    case PROJECTION_SCALAR:
+        return true;
+#ifdef FSIV_HAVE_AVX2_KERNEL
+    case PROJECTION_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef FSIV_HAVE_NEON_KERNEL
+    case PROJECTION_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+ProjectionKernel
+best_projection_kernel()
+{
+    static const ProjectionKernel best =
+            projection_kernel_supported(PROJECTION_AVX2) ? PROJECTION_AVX2 :
+            projection_kernel_supported(PROJECTION_NEON) ? PROJECTION_NEON :
+                                                           PROJECTION_SCALAR;
+    return best;
+}
+
+const char*
+projection_kernel_name(const ProjectionKernel kernel)
+{
+    switch (kernel)
+    {
+    case PROJECTION_AVX2:
+        return "avx2";
+    case PROJECTION_NEON:
+        return "neon";
+    default:
+        return "scalar";
+    }
+}
+
+void
+project_points(const ProjectionModel& model,
+               const float* X, const float* Y, const float* Z,
+               const size_t n, float* u, float* v,
+               const ProjectionKernel kernel)
+{
+#ifdef FSIV_HAVE_AVX2_KERNEL
+    if (kernel == PROJECTION_AVX2)
+    {
+        project_points_avx2(model, X, Y, Z, n, u, v);
+        return;
+    }
+#endif
+#ifdef FSIV_HAVE_NEON_KERNEL
+    if (kernel == PROJECTION_NEON)
+    {
+        project_points_neon(model, X, Y, Z, n, u, v);
+        return;
+    }
+#endif
+    project_points_scalar(model, X, Y, Z, 0, n, u, v);
+}
+
+} //namespace fsiv
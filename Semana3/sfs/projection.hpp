@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+
+namespace fsiv
+{
+
+/** @brief Kernels to project batches of points. */
+typedef enum {
+    PROJECTION_SCALAR=0, //portable C++.
+    PROJECTION_AVX2=1,   //8 points per instruction (x86 with AVX2).
+    PROJECTION_NEON=2    //4 points per instruction (aarch64).
+} ProjectionKernel;
+
+/**
+ * @brief The projection of a view precomputed from its CameraParameters.
+ * The 5 coeffs. radial/tangential distortion model of cv::projectPoints()
+ * is used (k1, k2, p1, p2, k3).
+ */
+struct ProjectionModel
+{
+    float Rt[12];    //the WCS to camera transform [R|t] (row major).
+    float P[12];     //the projection matrix K[R|t] (row major).
+    float fx, fy, cx, cy; //the intrinsics.
+    float dist[5];   //the distortion coeffs. k1, k2, p1, p2, k3.
+    bool distorted;  //is there any non zero distortion coeff?
+};
+
+/**
+ * @brief Get the fastest kernel supported by the cpu.
+ * The cpu is queried at runtime (the first call), so a build for a generic
+ * x86 uses AVX2 if it is available.
+ */
+ProjectionKernel best_projection_kernel();
+
+/** @brief Test if a kernel can be used in this cpu.*/
+bool projection_kernel_supported(const ProjectionKernel kernel);
+
+/** @brief Get the name of a kernel.*/
+const char* projection_kernel_name(const ProjectionKernel kernel);
+
+/**
+ * @brief Project a batch of 3D points (WCS).
+ * The points are given as a structure of arrays, so the kernels load
+ * consecutive coordinates of several points at once. The arithmetic is the
+ * one of View::project_point() (no fused multiply-add is used).
+ * @param[in] X, Y, Z are the coordinates of the n points.
+ * @param[out] u, v are the 2d coordinates of the n points.
+ * @param[in] kernel to use, it must be supported by the cpu.
+ */
+void project_points(const ProjectionModel& model,
+                    const float* X, const float* Y, const float* Z,
+                    const size_t n, float* u, float* v,
+                    const ProjectionKernel kernel=best_projection_kernel());
+
+} //namespace fsiv
@@ -2,9 +2,17 @@
 
 #include "voxel.hpp"
 #include "voxelset.hpp"
+#include "sparse_voxelset.hpp"
 #include "camera_parameters.hpp"
+#include "projection.hpp"
 #include "view.hpp"
 #include "octree.hpp"
+#include "linear_octree.hpp"
+#include "voxel_coloring.hpp"
+#include "mesh_export.hpp"
+#include "brick_file.hpp"
+#include "octree_file.hpp"
+#include "marching_cubes.hpp"
 
 namespace fsiv
 {
@@ -13,16 +21,61 @@ namespace fsiv
 extern int DebugLevel_;
 #endif
 
+/** @brief Methods to compute a voxelset based visual hull. */
+typedef enum {
+    VH_PER_VOXEL=0, //project each voxel independently.
+    VH_SWEEP=1,     //sweep the voxel lattice projecting each corner once per view.
+    VH_COARSE_TO_FINE=2 //carve blocks of 8^3, 4^3, 2^3 voxels before the voxels.
+} VoxelSetHullMethod;
+
 /** @brief Compute a voxelset based visual hull from a group of views.
  * @param views is the set of views for the scene.
  * @param vs is the output voxelset.
  * @param scene is the 3D volumen to be analysed.
  * @param vsize specifies the size of a voxel in WCS units.
  * @param OAR_th specifies the minimum area rate to consider a full voxel.
+ * @param method specifies how the voxels are projected.
+ * @param footprint specifies the footprint of a projected voxel used to compute its OAR.
+ *
+ * If vs has a score depth (see VoxelSet::set_score_depth()) the minimum OAR
+ * of each voxel over the views is kept in its scores and the occupancy is
+ * set with VoxelSet::apply_threshold(OAR_th), so the hull can be thresholded
+ * again without projecting the voxels. The per voxel method is always used
+ * in this mode.
  */
 void compute_visual_hull(std::vector<View> const& views, VoxelSet& vs,
                          const Voxel& scene, float vsize,
-                         const float OAR_th=0.5);
+                         const float OAR_th=0.5,
+                         const VoxelSetHullMethod method=VH_PER_VOXEL,
+                         const FootprintMode footprint=FOOTPRINT_BBOX);
+
+/** @brief Compute a sparse voxelset based visual hull from a group of views.
+ * The voxels are carved by bricks, so the memory used scales with the
+ * surface of the hull and fine voxel sizes can be used for big scenes.
+ * \see compute_visual_hull(std::vector<View> const&, VoxelSet&, ...)
+ */
+void compute_visual_hull(std::vector<View> const& views, SparseVoxelSet& vs,
+                         const Voxel& scene, float vsize,
+                         const float OAR_th=0.5,
+                         const FootprintMode footprint=FOOTPRINT_BBOX);
+
+/**
+ * @brief Carve a voxelset based visual hull with a new view.
+ * Only the voxels still occupied are projected onto the view, so adding a
+ * view costs O(occupied voxels) instead of rebuilding the hull with all the
+ * views. The result is the same as computing the hull with all the views.
+ * If vs has scores, they are lowered with the OAR of the view for all the
+ * voxels with a score greater than zero and the occupancy is thresholded
+ * again.
+ * @param view is the new view.
+ * @param vs is the visual hull to update.
+ * @param OAR_th specifies the minimum area rate to consider a full voxel.
+ * @param footprint specifies the footprint of a projected voxel used to compute its OAR.
+ * @return the number of voxels carved.
+ */
+size_t update_visual_hull(const View& view, VoxelSet& vs,
+                          const float OAR_th=0.5,
+                          const FootprintMode footprint=FOOTPRINT_BBOX);
 
 /**
  * @brief Compute a octree based visual hull from a group of views.
@@ -32,9 +85,41 @@ void compute_visual_hull(std::vector<View> const& views, VoxelSet& vs,
  * @param max_levels specifies the max height of the octree to be built.
  * @param max_errors specifies how many fouls are allowed before a voxel is considered empty.
  * @param OAR_th specifies the minimum area rate to consider a full voxel.
+ * @param footprint specifies the footprint of a projected octant used to
+ *  compute its OAR. FOOTPRINT_HULL gives fewer false GREY octants.
  */
 void compute_visual_hull(std::vector<View> const& views, Octree& octree,
                          const Voxel& scene, size_t max_levels,
-                         size_t max_erros=0, const float OAR_th=0.5);
+                         size_t max_erros=0, const float OAR_th=0.5,
+                         const FootprintMode footprint=FOOTPRINT_BBOX);
+
+/**
+ * @brief Carve an octree based visual hull with a new view.
+ * Only the BLACK and GREY octants are tested against the new view. A BLACK
+ * octant partially inside the new silhouette is split, and its children are
+ * tested against all the views, and a GREY octant whose children become
+ * WHITE is merged. The BLACK octants are the ones of compute_visual_hull()
+ * with all the views.
+ * @param views are the views seen so far, the new view is the last one.
+ * @param octree is the visual hull to update.
+ * @param max_levels must be the one used to build the octree.
+ * @param OAR_th specifies the minimum area rate to consider a full voxel.
+ * @param footprint specifies the footprint of a projected octant used to compute its OAR.
+ * @return the number of octants that became WHITE.
+ */
+size_t update_visual_hull(std::vector<View> const& views, Octree& octree, size_t max_levels,
+                          const float OAR_th=0.5,
+                          const FootprintMode footprint=FOOTPRINT_BBOX);
+
+/**
+ * @brief Compute a linear octree based visual hull from a group of views.
+ * The nodes are appended to the node array of the tree, so there are not
+ * per node heap allocations.
+ * \see compute_visual_hull(std::vector<View> const&, Octree&, ...)
+ */
+void compute_visual_hull(std::vector<View> const& views, LinearOctree& octree,
+                         const Voxel& scene, size_t max_levels,
+                         size_t max_erros=0, const float OAR_th=0.5,
+                         const FootprintMode footprint=FOOTPRINT_BBOX);
 
 } //namespacde fsiv
@@ -0,0 +1,466 @@
+#include <zlib.h>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include "sparse_voxelset.hpp"
+
+namespace fsiv {
+
+const size_t SparseVoxelSet::BRICK_SIDE;
+const std::uint32_t SparseVoxelSet::EMPTY_BRICK;
+const std::uint32_t SparseVoxelSet::FULL_BRICK;
+const std::uint32_t SparseVoxelSet::MIXED_BRICK;
+
+SparseVoxelSet::SparseVoxelSet ()
+    : _bcuve(), _vsize(0.0)
+{
+    _size[0] = _size[1] = _size[2] = 0;
+    _bricks[0] = _bricks[1] = _bricks[2] = 0;
+    CV_Assert(empty());
+}
+
+SparseVoxelSet::SparseVoxelSet(const Voxel& bc, const float vsize,
+                               const bool init_occ_state)
+{
+    reset(bc, vsize, init_occ_state);
+}
+
+bool
+SparseVoxelSet::empty() const
+{
+    return _table.empty();
+}
+
+void
+SparseVoxelSet::reset(const Voxel& bc, const float vsize,
+                      const bool init_occ_state)
+{
+    CV_Assert(vsize > 0.0f);
+    _bcuve = bc;
+    _vsize = vsize;
+    //The same (integer) discretization as VoxelSet::reset().
+    _size[0] = bc.x_dim() / vsize;
+    _size[1] = bc.y_dim() / vsize;
+    _size[2] = bc.z_dim() / vsize;
+    for (int a = 0; a < 3; ++a)
+        _bricks[a] = (_size[a] + BRICK_SIDE - 1) / BRICK_SIDE;
+    CV_Assert(n_bricks() < size_t(UINT32_MAX));
+    _table.assign(n_bricks(), init_occ_state ? FULL_BRICK : EMPTY_BRICK);
+    _mixed.clear();
+}
+
+Voxel
+SparseVoxelSet::voxel(const size_t x, const size_t y, const size_t z) const
+{
+    CV_Assert (x<x_size() && y<y_size() && z<z_size());
+    return Voxel(_bcuve.origin().at<float>(0)+_vsize*x,
+                 _bcuve.origin().at<float>(1)+_vsize*y,
+                 _bcuve.origin().at<float>(2)+_vsize*z,
+                 _vsize, _vsize, _vsize);
+}
+
+bool
+SparseVoxelSet::occupancy(const size_t x, const size_t y, const size_t z) const
+{
+    CV_Assert (x<x_size() && y<y_size() && z<z_size());
+    const std::uint32_t s = _table[brick_index(x, y, z)];
+    if (s < MIXED_BRICK)
+        return s == FULL_BRICK;
+    const size_t bit = (y % BRICK_SIDE) * BRICK_SIDE + x % BRICK_SIDE;
+    return (_mixed[s - MIXED_BRICK].words[z % BRICK_SIDE] >> bit) & 1;
+}
+
+void
+SparseVoxelSet::set_occupancy(const size_t x, const size_t y, const size_t z,
+                              const bool new_v)
+{
+    CV_Assert (x<x_size() && y<y_size() && z<z_size());
+    const size_t b = brick_index(x, y, z);
+    std::uint32_t s = _table[b];
+    if (s < MIXED_BRICK)
+    {
+        if ((s == FULL_BRICK) == new_v)
+            return;
+        Brick brick;
+        if (s == FULL_BRICK)
+            brick_mask(b, brick.words);
+        else
+            std::fill(brick.words, brick.words + BRICK_SIDE, std::uint64_t(0));
+        CV_Assert(_mixed.size() + MIXED_BRICK < size_t(UINT32_MAX));
+        s = std::uint32_t(_mixed.size() + MIXED_BRICK);
+        _mixed.push_back(brick);
+        _table[b] = s;
+    }
+    const std::uint64_t bit = std::uint64_t(1) <<
+            ((y % BRICK_SIDE) * BRICK_SIDE + x % BRICK_SIDE);
+    std::uint64_t& word = _mixed[s - MIXED_BRICK].words[z % BRICK_SIDE];
+    if (new_v)
+        word |= bit;
+    else
+        word &= ~bit;
+}
+
+size_t SparseVoxelSet::x_bricks() const
+{
+    return _bricks[0];
+}
+
+size_t SparseVoxelSet::y_bricks() const
+{
+    return _bricks[1];
+}
+
+size_t SparseVoxelSet::z_bricks() const
+{
+    return _bricks[2];
+}
+
+size_t SparseVoxelSet::n_bricks() const
+{
+    return _bricks[0] * _bricks[1] * _bricks[2];
+}
+
+size_t
+SparseVoxelSet::brick_index(const size_t x, const size_t y, const size_t z) const
+{
+    return ((z / BRICK_SIDE) * _bricks[1] + y / BRICK_SIDE) * _bricks[0]
+            + x / BRICK_SIDE;
+}
+
+void
+SparseVoxelSet::brick_origin(const size_t b, size_t& x, size_t& y, size_t& z) const
+{
+    CV_Assert(b < n_bricks());
+    x = (b % _bricks[0]) * BRICK_SIDE;
+    y = ((b / _bricks[0]) % _bricks[1]) * BRICK_SIDE;
+    z = (b / (_bricks[0] * _bricks[1])) * BRICK_SIDE;
+}
+
+std::uint32_t
+SparseVoxelSet::brick_state(const size_t b) const
+{
+    CV_Assert(b < n_bricks());
+    return _table[b];
+}
+
+void
+SparseVoxelSet::get_brick(const size_t b, std::uint64_t words[BRICK_SIDE]) const
+{
+    const std::uint32_t s = brick_state(b);
+    if (s == FULL_BRICK)
+        brick_mask(b, words);
+    else if (s == EMPTY_BRICK)
+        std::fill(words, words + BRICK_SIDE, std::uint64_t(0));
+    else
+        std::copy(_mixed[s - MIXED_BRICK].words,
+                  _mixed[s - MIXED_BRICK].words + BRICK_SIDE, words);
+}
+
+void
+SparseVoxelSet::brick_mask(const size_t b, std::uint64_t words[BRICK_SIDE]) const
+{
+    size_t o[3];
+    brick_origin(b, o[0], o[1], o[2]);
+    size_t n[3];
+    for (int a = 0; a < 3; ++a)
+        n[a] = std::min(BRICK_SIDE, _size[a] - o[a]);
+    const std::uint64_t row = (std::uint64_t(1) << n[0]) - 1;
+    std::uint64_t plane = 0;
+    for (size_t y = 0; y < n[1]; ++y)
+        plane |= row << (y * BRICK_SIDE);
+    for (size_t z = 0; z < BRICK_SIDE; ++z)
+        words[z] = z < n[2] ? plane : 0;
+}
+
+void
+SparseVoxelSet::set_brick(const size_t b, const std::uint64_t words[BRICK_SIDE])
+{
+    std::uint64_t mask[BRICK_SIDE];
+    brick_mask(b, mask);
+    Brick brick;
+    bool is_empty = true;
+    bool is_full = true;
+    for (size_t z = 0; z < BRICK_SIDE; ++z)
+    {
+        brick.words[z] = words[z] & mask[z];
+        is_empty = is_empty && brick.words[z] == 0;
+        is_full = is_full && brick.words[z] == mask[z];
+    }
+    //A stored brick that becomes uniform is released by compact().
+    if (is_empty || is_full)
+        _table[b] = is_full ? FULL_BRICK : EMPTY_BRICK;
+    else if (_table[b] >= MIXED_BRICK)
+        _mixed[_table[b] - MIXED_BRICK] = brick;
+    else
+    {
+        CV_Assert(_mixed.size() + MIXED_BRICK < size_t(UINT32_MAX));
+        _table[b] = std::uint32_t(_mixed.size() + MIXED_BRICK);
+        _mixed.push_back(brick);
+    }
+}
+
+void
+SparseVoxelSet::compact()
+{
+    std::vector<Brick> mixed;
+    std::uint64_t words[BRICK_SIDE];
+    for (size_t b = 0; b < n_bricks(); ++b)
+    {
+        if (_table[b] < MIXED_BRICK)
+            continue;
+        get_brick(b, words);
+        _table[b] = EMPTY_BRICK;
+        set_brick(b, words);
+        if (_table[b] >= MIXED_BRICK)
+        {
+            //set_brick() has appended it to the old second level.
+            mixed.push_back(_mixed.back());
+            _mixed.pop_back();
+            _table[b] = std::uint32_t(mixed.size() - 1 + MIXED_BRICK);
+        }
+    }
+    _mixed.swap(mixed);
+}
+
+size_t
+SparseVoxelSet::count_occupied() const
+{
+    size_t count = 0;
+    std::uint64_t words[BRICK_SIDE];
+    for (size_t b = 0; b < n_bricks(); ++b)
+    {
+        if (_table[b] == EMPTY_BRICK)
+            continue;
+        get_brick(b, words);
+        for (size_t z = 0; z < BRICK_SIDE; ++z)
+            count += __builtin_popcountll(words[z]);
+    }
+    return count;
+}
+
+size_t
+SparseVoxelSet::n_mixed_bricks() const
+{
+    return _mixed.size();
+}
+
+size_t
+SparseVoxelSet::memory_size() const
+{
+    return _table.capacity() * sizeof(std::uint32_t) +
+            _mixed.capacity() * sizeof(Brick);
+}
+
+size_t SparseVoxelSet::x_size () const
+{
+    return _size[0];
+}
+
+size_t SparseVoxelSet::y_size () const
+{
+    return _size[1];
+}
+
+size_t SparseVoxelSet::z_size () const
+{
+    return _size[2];
+}
+
+float SparseVoxelSet::vsize() const
+{
+    return _vsize;
+}
+
+const Voxel& SparseVoxelSet::bounding_cuve() const
+{
+    return _bcuve;
+}
+
+static std::string voxelset_signature = "voxelset";
+
+/** @brief Number of voxels compressed at once. */
+static const size_t zlib_chunk = 1 << 16;
+
+/** @brief Get the occupancy of the row (y,z) as one byte per voxel. */
+static void
+get_row_bytes(const SparseVoxelSet& vs, const size_t y, const size_t z,
+              Bytef* bytes)
+{
+    const size_t side = SparseVoxelSet::BRICK_SIDE;
+    std::uint64_t words[side];
+    for (size_t x0 = 0; x0 < vs.x_size(); x0 += side)
+    {
+        const size_t n = std::min(side, vs.x_size() - x0);
+        vs.get_brick(vs.brick_index(x0, y, z), words);
+        const unsigned row = unsigned(words[z % side] >> ((y % side) * side));
+        for (size_t x = 0; x < n; ++x)
+            bytes[x0 + x] = (row >> x) & 1;
+    }
+}
+
+std::ostream&
+operator<<(std::ostream& out, const SparseVoxelSet& vs)
+{
+  out.setf(std::ios::scientific);
+  out << voxelset_signature << std::endl;
+  out << "vsize = " << vs.vsize() << std::endl;
+  out << "bcuve = " << vs.bounding_cuve() << std::endl;
+  out << "xsize = " << vs.x_size()<< std::endl;
+  out << "ysize = " << vs.y_size()<< std::endl;
+  out << "zsize = " << vs.z_size()<< std::endl;
+  out.unsetf(std::ios::scientific);
+
+  //The dense format (one byte per voxel) is built by rows and compressed
+  //by chunks of rows.
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  if (deflateInit(&strm, Z_DEFAULT_COMPRESSION)!=Z_OK)
+    throw std::runtime_error("ZLIB error");
+  const size_t n_rows = vs.y_size() * vs.z_size();
+  const size_t chunk_rows = std::max(size_t(1), zlib_chunk / std::max(size_t(1), vs.x_size()));
+  std::vector<Bytef> chunk(chunk_rows * vs.x_size() + 1);
+  std::vector<Bytef> zbuf(zlib_chunk);
+  std::vector<Bytef> dest(1, '#');
+  for (size_t r = 0; ; r += chunk_rows)
+  {
+    const size_t r_end = std::min(n_rows, r + chunk_rows);
+    for (size_t i = r; i < r_end; ++i)
+      get_row_bytes(vs, i % vs.y_size(), i / vs.y_size(),
+                    &chunk[(i - r) * vs.x_size()]);
+    strm.next_in = &chunk[0];
+    strm.avail_in = (r_end - r) * vs.x_size();
+    const int flush = (r_end == n_rows) ? Z_FINISH : Z_NO_FLUSH;
+    do
+    {
+      strm.next_out = &zbuf[0];
+      strm.avail_out = zbuf.size();
+      if (deflate(&strm, flush) == Z_STREAM_ERROR)
+      {
+        deflateEnd(&strm);
+        throw std::runtime_error("ZLIB error");
+      }
+      dest.insert(dest.end(), zbuf.begin(), zbuf.end() - strm.avail_out);
+    } while (strm.avail_out == 0);
+    if (r_end == n_rows)
+      break;
+  }
+  deflateEnd(&strm);
+  out << "BinarySize = " << dest.size()-1 << std::endl;
+  out.write(reinterpret_cast<const char *>(&dest[0]), dest.size());
+  return out;
+}
+
+void
+save_as_pointcloud_WRML (std::ostream& out, const SparseVoxelSet& vs,
+              const cv::Scalar & _color)
+{
+  out << "#VRML V2.0 utf8\n";
+  out << "Transform\n";
+  out << "{\n";
+  out << "  children\n";
+  out << "  Shape\n";
+  out << "  {\n";
+  out << "    appearance Appearance\n";
+  out << "    {\n";
+  out << "      material Material\n";
+  out << "      {\n";
+  out << "       emissiveColor " << _color[0]/255.0 << ' ' << _color[1]/255.0 << ' ' << _color[2]/255.0 << "\n";
+  out << "      }\n";
+  out << "    }\n";
+  out << "    geometry PointSet\n";
+  out << "    {\n";
+  out << "      coord Coordinate\n";
+  out << "      {\n";
+  out << "        point\n";
+  out << "          [\n";
+  const size_t side = SparseVoxelSet::BRICK_SIDE;
+  std::uint64_t words[side];
+  const Voxel& bc = vs.bounding_cuve();
+  const float half = vs.vsize() / 2;
+  for (size_t b = 0; b < vs.n_bricks(); ++b)
+  {
+    if (vs.brick_state(b) == SparseVoxelSet::EMPTY_BRICK)
+      continue;
+    size_t x0, y0, z0;
+    vs.brick_origin(b, x0, y0, z0);
+    vs.get_brick(b, words);
+    for (size_t lz = 0; lz < side; ++lz)
+      for (std::uint64_t bits = words[lz]; bits; bits &= bits - 1)
+      {
+        const size_t i = __builtin_ctzll(bits);
+        const size_t x = x0 + i % side;
+        const size_t y = y0 + i / side;
+        const size_t z = z0 + lz;
+        out << (bc.x() + vs.vsize()*x) + half << ' '
+            << (bc.y() + vs.vsize()*y) + half << ' '
+            << (bc.z() + vs.vsize()*z) + half << std::endl;
+      }
+  }
+  out << "         ]\n";
+  out << "      }\n";
+  out << "    }\n";
+  out << "  }\n";
+  out << "}\n";
+}
+
+/** @brief Test if two bounding cubes place their voxels from the same corner. */
+static bool
+same_corner(const Voxel& a, const Voxel& b)
+{
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+void
+convert(const SparseVoxelSet& src, VoxelSet& dst)
+{
+    dst.reset(src.bounding_cuve(), src.vsize(), false);
+    CV_Assert(dst.x_size() == src.x_size() && dst.y_size() == src.y_size() &&
+              dst.z_size() == src.z_size() &&
+              same_corner(dst.bounding_cuve(), src.bounding_cuve()));
+    const size_t side = SparseVoxelSet::BRICK_SIDE;
+    std::uint64_t words[side];
+    for (size_t b = 0; b < src.n_bricks(); ++b)
+    {
+        if (src.brick_state(b) == SparseVoxelSet::EMPTY_BRICK)
+            continue;
+        size_t x0, y0, z0;
+        src.brick_origin(b, x0, y0, z0);
+        src.get_brick(b, words);
+        for (size_t lz = 0; lz < side; ++lz)
+            for (std::uint64_t bits = words[lz]; bits; bits &= bits - 1)
+            {
+                const size_t i = __builtin_ctzll(bits);
+                dst.set_occupancy(x0 + i % side, y0 + i / side, z0 + lz, true);
+            }
+    }
+}
+
+void
+convert(const VoxelSet& src, SparseVoxelSet& dst)
+{
+    dst.reset(src.bounding_cuve(), src.vsize(), false);
+    CV_Assert(dst.x_size() == src.x_size() && dst.y_size() == src.y_size() &&
+              dst.z_size() == src.z_size() &&
+              same_corner(dst.bounding_cuve(), src.bounding_cuve()));
+    const size_t side = SparseVoxelSet::BRICK_SIDE;
+    std::uint64_t words[side];
+    for (size_t b = 0; b < dst.n_bricks(); ++b)
+    {
+        size_t x0, y0, z0;
+        dst.brick_origin(b, x0, y0, z0);
+        const size_t x1 = std::min(x0 + side, src.x_size());
+        const size_t y1 = std::min(y0 + side, src.y_size());
+        const size_t z1 = std::min(z0 + side, src.z_size());
+        for (size_t z = z0; z < z0 + side; ++z)
+        {
+            words[z - z0] = 0;
+            for (size_t y = y0; y < y1 && z < z1; ++y)
+                for (size_t x = x0; x < x1; ++x)
+                    if (src.occupancy(x, y, z))
+                        words[z - z0] |= std::uint64_t(1) << ((y - y0) * side + x - x0);
+        }
+        dst.set_brick(b, words);
+    }
+}
+
+} //namespace fsiv
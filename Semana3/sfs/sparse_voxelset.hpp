@@ -0,0 +1,153 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#include "voxel.hpp"
+#include "voxelset.hpp"
+
+namespace fsiv
+{
+
+/**
+ * @brief The SparseVoxelSet class.
+ *
+ * Models the same discretized volumen as a VoxelSet but the voxels are
+ * grouped in bricks of 8x8x8 voxels kept in a two level table: the first
+ * level has an entry per brick and only the bricks with empty and occupied
+ * voxels (mixed bricks) are stored in the second level, as 8 words of 64
+ * bits (word z, bit y*8+x). Uniform bricks, all empty or all occupied, are
+ * only a flag in the first level, so the memory used scales with the
+ * surface of the objects instead of with the volumen of the scene.
+ *
+ * The voxels of the bricks of the border out of the voxelset are never
+ * occupied: a brick is full when all its valid voxels are occupied.
+ */
+class SparseVoxelSet
+{
+public:
+
+    /** @brief Voxels per side of a brick.*/
+    static const size_t BRICK_SIDE = 8;
+
+    /** @brief First level entries of uniform bricks. The other values are
+     * the index of a mixed brick plus MIXED_BRICK.*/
+    static const std::uint32_t EMPTY_BRICK = 0;
+    static const std::uint32_t FULL_BRICK = 1;
+    static const std::uint32_t MIXED_BRICK = 2;
+
+    SparseVoxelSet ();
+
+    SparseVoxelSet(const Voxel& bc, const float vsize,
+                   const bool init_occ_state=true);
+
+    bool empty() const;
+
+    /**
+     * @brief set voxel set attributes.
+     * @arg[in] bc define the 3D volumen represented.
+     * @arg[in] vsize define the size of the voxel in wcs units.
+     * @arg[in] init_occ_state is the initial state of occupancy for the voxels.
+     */
+    void reset(const Voxel& bc, const float vsize, const bool init_occ_state=true);
+
+    /** @brief Get a voxel.*/
+    Voxel voxel(const size_t x, const size_t y, const size_t z) const;
+
+    /** @brief get the occupancy value. **/
+    bool occupancy(const size_t x, const size_t y, const size_t z) const;
+
+    /** @brief set the occupancy value.
+     * A uniform brick is stored as a mixed one if needed (see compact()).
+     * \warning it is not thread safe.
+     **/
+    void set_occupancy(const size_t x, const size_t y, const size_t z, const bool new_v);
+
+    /** @brief Number of bricks along each axis and in total.*/
+    size_t x_bricks() const;
+    size_t y_bricks() const;
+    size_t z_bricks() const;
+    size_t n_bricks() const;
+
+    /** @brief Index of the brick with the voxel (x,y,z).*/
+    size_t brick_index(const size_t x, const size_t y, const size_t z) const;
+
+    /** @brief Coordinates of the first voxel of a brick.*/
+    void brick_origin(const size_t b, size_t& x, size_t& y, size_t& z) const;
+
+    /** @brief Get the first level entry of a brick.*/
+    std::uint32_t brick_state(const size_t b) const;
+
+    /** @brief Get the occupancy of a brick (word z, bit y*8+x).*/
+    void get_brick(const size_t b, std::uint64_t words[BRICK_SIDE]) const;
+
+    /** @brief Get the valid voxels of a brick (word z, bit y*8+x).*/
+    void brick_mask(const size_t b, std::uint64_t words[BRICK_SIDE]) const;
+
+    /**
+     * @brief Set the occupancy of a brick (word z, bit y*8+x).
+     * The voxels out of the voxelset are ignored. If the brick is uniform
+     * only its flag is stored.
+     * \warning it is not thread safe if a mixed brick is appended.
+     */
+    void set_brick(const size_t b, const std::uint64_t words[BRICK_SIDE]);
+
+    /** @brief Turn the mixed bricks that became uniform into flags. **/
+    void compact();
+
+    /** @brief get the number of occupied voxels. **/
+    size_t count_occupied() const;
+
+    /** @brief get the number of mixed (stored) bricks. **/
+    size_t n_mixed_bricks() const;
+
+    /** @brief get the memory used by the occupancy in bytes. **/
+    size_t memory_size() const;
+
+    /** @brief get the discritized size on X axis. **/
+    size_t x_size () const;
+
+    /** @brief get the discritized size on Y axis. **/
+    size_t y_size () const;
+
+    /** @brief get the discritized size on Z axis. **/
+    size_t z_size () const;
+
+    /** @brief get the side voxel size in WCS units. **/
+    float vsize() const;
+
+    /** @brief get the 3D space volumen represented by the voxel set. **/
+    const Voxel& bounding_cuve() const;
+
+private:
+
+    struct Brick
+    {
+        std::uint64_t words[BRICK_SIDE];
+    };
+
+    Voxel _bcuve;
+    float _vsize;
+    size_t _size[3];
+    size_t _bricks[3];
+    std::vector<std::uint32_t> _table; //first level.
+    std::vector<Brick> _mixed;         //second level.
+};
+
+/** @brief Save a sparse voxelset with the format of operator<<(std::ostream&, const VoxelSet&).
+ * The voxelset is never made dense, so the file can be read as a VoxelSet. **/
+std::ostream& operator<<(std::ostream& out, const SparseVoxelSet& vs);
+
+/** @brief Save a sparse voxelset as a point cloud of occupied voxel centers in vrml 2.0 format. **/
+void save_as_pointcloud_WRML (std::ostream& out, const SparseVoxelSet& vs,
+            const cv::Scalar & color=cv::Scalar(255, 255, 255));
+
+/** @brief Convert a sparse voxelset into a dense one.
+ * The storage and layout of dst are kept. **/
+void convert(const SparseVoxelSet& src, VoxelSet& dst);
+
+/** @brief Convert a dense voxelset into a sparse one. **/
+void convert(const VoxelSet& src, SparseVoxelSet& dst);
+
+} //namespace fsiv
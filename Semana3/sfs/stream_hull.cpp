@@ -0,0 +1,199 @@
+// Turntable capture: the views are written to a directory one at a time.
+// ./stream_hull --scene=-1.5:-1.5:0.0:3:3:2 --vsize=0.02 --output=my_voxelset --dir=../data/cone-4 --cams=ext_4-%d.yml --fgs=cone_4-%d.png --max_views=4
+// ./stream_hull --octree --scene=-1.5:-1.5:0.0:3:3:2 --vsize=0.02 --output=my_octree --dir=../data/cone-4 --cams=ext_4-%d.yml --fgs=cone_4-%d.png --max_views=4
+
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<cstdio>
+#include<cstdlib>
+#include<cmath>
+#include<chrono>
+#include<thread>
+#include<stdexcept>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include "sfs.hpp"
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{verbose        |0     | Verbose level.}"
+    "{oar_th         |0.5   | Occupancy area rate.}"
+    "{footprint      |0     | Projected voxel footprint: 0 bbox, 1 convex hull.}"
+    "{octree         |      | Build an octree instead of a voxel set.}"
+    "{dir            |.     | Directory where the views are written.}"
+    "{cams           |ext-%d.yml| Name pattern of the camera parameters of view i.}"
+    "{fgs            |fg-%d.png | Name pattern of the foreground image of view i.}"
+    "{first          |0     | Index of the first view.}"
+    "{max_views      |0     | Stop after this number of views (0 no limit).}"
+    "{timeout        |60    | Stop after waiting this number of seconds for a new view.}"
+    "{poll           |500   | Milliseconds between two looks at the directory.}"
+    "{scene          |<none>| Set the scene dimensions in WCS units. Format xorig:yorig:zorig:xsize:ysize:zsize}"
+    "{vsize          |<none>| Set the voxel side size in WCS units.}"
+    "{output         |<none>| Output file to save the visual hull after each view.}"
+    ;
+
+/** @brief Get the pathname of view i given a name pattern.*/
+static std::string
+view_pathname(const std::string& dir, const std::string& pattern, const int i)
+{
+    char name[1024];
+    std::snprintf(name, sizeof(name), pattern.c_str(), i);
+    return dir + "/" + name;
+}
+
+/**
+ * @brief Try to load a view.
+ * @return false if the files are not there yet or they can not be read
+ *  (they may be still being written).
+ */
+static bool
+load_view(const std::string& cam_pathname, const std::string& fg_pathname,
+          const std::string& name, std::vector<fsiv::View>& views)
+{
+    if (!std::ifstream(cam_pathname) || !std::ifstream(fg_pathname))
+        return false;
+    fsiv::CameraParameters cparams;
+    try
+    {
+        if (!cparams.read_from_file(cam_pathname))
+            return false;
+    }
+    catch (cv::Exception&)
+    {
+        return false;
+    }
+    cv::Mat fg_img = cv::imread(fg_pathname, cv::IMREAD_GRAYSCALE);
+    if (fg_img.empty())
+        return false;
+    views.push_back(fsiv::View(name, fg_img, cparams));
+    return true;
+}
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Update a visual hull each time a new view is written to a directory.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+      const int verbose = parser.get<int>("verbose");
+      std::istringstream buffer (parser.get<std::string>("scene"));
+      fsiv::Voxel scene;
+      buffer >> scene;
+      if (!buffer)
+      {
+          std::cerr << "Error: Worng: cli parameter scene." << std::endl;
+          return EXIT_FAILURE;
+      }
+      const float vsize = parser.get<float>("vsize");
+      const std::string output_pathname = parser.get<std::string>("output");
+      const std::string dir = parser.get<std::string>("dir");
+      const std::string cams = parser.get<std::string>("cams");
+      const std::string fgs = parser.get<std::string>("fgs");
+      const size_t max_views = parser.get<int>("max_views");
+      const float oar_th = parser.get<float>("oar_th");
+      const fsiv::FootprintMode footprint =
+              static_cast<fsiv::FootprintMode>(parser.get<int>("footprint"));
+      const bool use_octree = parser.has("octree");
+      if (!parser.check())
+      {
+          parser.printErrors();
+          return EXIT_FAILURE;
+      }
+
+      //The hull starts full and each view carves it.
+      fsiv::VoxelSet vs;
+      fsiv::Octree octree;
+      float max_dim = std::max(scene.x_dim(), scene.y_dim());
+      max_dim = std::max(max_dim, scene.z_dim());
+      const size_t max_levels = std::ceil(std::log2(max_dim/vsize));
+      if (use_octree)
+          octree.set_root(fsiv::Octant(scene));
+      else
+          vs.reset(scene, vsize);
+
+      const std::chrono::milliseconds poll(parser.get<int>("poll"));
+      const std::chrono::seconds timeout(parser.get<int>("timeout"));
+      std::vector<fsiv::View> views;
+      int next = parser.get<int>("first");
+      std::chrono::steady_clock::time_point last_view = std::chrono::steady_clock::now();
+      while (max_views == 0 || views.size() < max_views)
+      {
+          std::ostringstream view_name;
+          view_name << "View " << next;
+          const std::string cam_pathname = view_pathname(dir, cams, next);
+          const std::string fg_pathname = view_pathname(dir, fgs, next);
+          if (!load_view(cam_pathname, fg_pathname, view_name.str(), views))
+          {
+              if (std::chrono::steady_clock::now() - last_view > timeout)
+              {
+                  std::cout << "No new view after " << timeout.count()
+                            << " seconds." << std::endl;
+                  break;
+              }
+              std::this_thread::sleep_for(poll);
+              continue;
+          }
+          last_view = std::chrono::steady_clock::now();
+
+          size_t carved = 0;
+          if (use_octree)
+              carved = fsiv::update_visual_hull(views, octree, max_levels,
+                                                oar_th, footprint);
+          else
+              carved = fsiv::update_visual_hull(views.back(), vs, oar_th, footprint);
+          const double seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - last_view).count();
+          std::cout << view_name.str() << ": carved " << carved
+                    << (use_octree ? " octants" : " voxels") << " in "
+                    << seconds << " seconds." << std::endl;
+          if (verbose > 0)
+              std::cout << "\tcameras [" << cam_pathname << "] foreground ["
+                        << fg_pathname << "]." << std::endl;
+
+          //Keep on disk the hull given by the views seen so far.
+          std::ofstream output (output_pathname);
+          if (!output)
+          {
+              std::cerr << "Error: could not open file ["
+                        << output_pathname << "] to write." << std::endl;
+              return EXIT_FAILURE;
+          }
+          if (use_octree)
+              output << octree;
+          else
+              output << vs;
+          ++next;
+      }
+      if (views.empty())
+      {
+          std::cerr << "Error: no view was found." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::ofstream output_wrl(output_pathname+".wrl");
+      if (use_octree)
+          fsiv::save_as_cubes_WRML(output_wrl, octree);
+      else
+          fsiv::save_as_pointcloud_WRML(output_wrl, vs);
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/imgproc.hpp>
 #include "view.hpp"
 
 namespace fsiv {
@@ -30,4 +34,510 @@ View::foreground (void) const
   return _foreground;
 }
 
+void
+View::init_projection()
+{
+    cv::Mat R, t, K, D;
+    _cparams.rotation_matrix().convertTo(R, CV_32F);
+    _cparams.translation_vector().convertTo(t, CV_32F);
+    _cparams.camera_matrix().convertTo(K, CV_32F);
+    _cparams.distortion_coeffs().convertTo(D, CV_32F);
+    CV_Assert(R.rows==3 && R.cols==3 && t.total()==3);
+    CV_Assert(K.rows==3 && K.cols==3);
+    _proj.fx = K.at<float>(0, 0);
+    _proj.fy = K.at<float>(1, 1);
+    _proj.cx = K.at<float>(0, 2);
+    _proj.cy = K.at<float>(1, 2);
+    _proj.distorted = false;
+    for (int i=0; i<5; ++i)
+    {
+        _proj.dist[i] = (i<int(D.total())) ? D.at<float>(i) : 0.0f;
+        _proj.distorted = _proj.distorted || (_proj.dist[i]!=0.0f);
+    }
+    for (int r=0; r<3; ++r)
+    {
+        for (int c=0; c<3; ++c)
+            _proj.Rt[r*4+c] = R.at<float>(r, c);
+        _proj.Rt[r*4+3] = t.at<float>(r);
+    }
+    //P = K[R|t] (without skew as cv::projectPoints does).
+    for (int c=0; c<4; ++c)
+    {
+        _proj.P[c] = _proj.fx*_proj.Rt[c] + _proj.cx*_proj.Rt[8+c];
+        _proj.P[4+c] = _proj.fy*_proj.Rt[4+c] + _proj.cy*_proj.Rt[8+c];
+        _proj.P[8+c] = _proj.Rt[8+c];
+    }
+}
+
+cv::Point2f
+View::project_point(const float X, const float Y, const float Z) const
+{
+    const float* P = _proj.P;
+    const float* Rt = _proj.Rt;
+    if (!_proj.distorted)
+    {
+        const float w = P[8]*X + P[9]*Y + P[10]*Z + P[11];
+        const float iw = (w!=0.0f) ? 1.0f/w : 1.0f;
+        return cv::Point2f((P[0]*X + P[1]*Y + P[2]*Z + P[3])*iw,
+                           (P[4]*X + P[5]*Y + P[6]*Z + P[7])*iw);
+    }
+    return project_camera_point(Rt[0]*X + Rt[1]*Y + Rt[2]*Z + Rt[3],
+                                Rt[4]*X + Rt[5]*Y + Rt[6]*Z + Rt[7],
+                                Rt[8]*X + Rt[9]*Y + Rt[10]*Z + Rt[11]);
+}
+
+cv::Point2f
+View::project_camera_point(const float xc, const float yc, const float zc) const
+{
+    const float* d = _proj.dist;
+    const float iz = (zc!=0.0f) ? 1.0f/zc : 1.0f;
+    const float x = xc*iz;
+    const float y = yc*iz;
+    const float r2 = x*x + y*y;
+    const float radial = 1.0f + r2*(d[0] + r2*(d[1] + r2*d[4]));
+    const float xd = x*radial + 2.0f*d[2]*x*y + d[3]*(r2 + 2.0f*x*x);
+    const float yd = y*radial + d[2]*(r2 + 2.0f*y*y) + 2.0f*d[3]*x*y;
+    return cv::Point2f(_proj.fx*xd + _proj.cx, _proj.fy*yd + _proj.cy);
+}
+
+void
+View::project_lattice_plane(const float* X, const size_t nx,
+                            const float* Y, const size_t ny, const float Z,
+                            cv::Point2f* uv) const
+{
+    //Without distortion the homogeneous image point is used directly,
+    //otherwise the camera point is distorted. Each point is computed with
+    //the sums of project_point() in the same order, so it rounds the same;
+    //only the products of the row and plane coordinates are shared.
+    const float* M = _proj.distorted ? _proj.Rt : _proj.P;
+    for (size_t j=0; j<ny; ++j)
+    {
+        float py[3], pz[3];
+        for (int r=0; r<3; ++r)
+        {
+            py[r] = M[r*4+1]*Y[j];
+            pz[r] = M[r*4+2]*Z;
+        }
+        cv::Point2f* row = uv + j*nx;
+        for (size_t i=0; i<nx; ++i)
+        {
+            float p[3];
+            for (int r=0; r<3; ++r)
+                p[r] = M[r*4]*X[i] + py[r] + pz[r] + M[r*4+3];
+            if (_proj.distorted)
+                row[i] = project_camera_point(p[0], p[1], p[2]);
+            else
+            {
+                const float iw = (p[2]!=0.0f) ? 1.0f/p[2] : 1.0f;
+                row[i] = cv::Point2f(p[0]*iw, p[1]*iw);
+            }
+        }
+    }
+}
+
+void
+View::project_points(const float* X, const float* Y, const float* Z,
+                     const size_t n, float* u, float* v) const
+{
+    fsiv::project_points(_proj, X, Y, Z, n, u, v);
+}
+
+cv::Point3f
+View::camera_center() const
+{
+    //C = -R^t t
+    float c[3];
+    for (int i=0; i<3; ++i)
+        c[i] = -(_proj.Rt[i]*_proj.Rt[3] + _proj.Rt[4+i]*_proj.Rt[7] +
+                 _proj.Rt[8+i]*_proj.Rt[11]);
+    return cv::Point3f(c[0], c[1], c[2]);
+}
+
+const ProjectionModel&
+View::projection_model() const
+{
+    return _proj;
+}
+
+void
+View::project_voxel(const Voxel& voxel, cv::Point2f uv[8]) const
+{
+    //Same vertex order as Voxel::vertices().
+    for (int i=0; i<8; ++i)
+        uv[i] = project_point(voxel.x() + ((i>>2)&1)*voxel.x_dim(),
+                              voxel.y() + (i&1)*voxel.y_dim(),
+                              voxel.z() + ((i>>1)&1)*voxel.z_dim());
+}
+
+cv::Rect
+View::compute_bounding_box(const cv::Point2f* uv, const size_t n) const
+{
+    CV_Assert(n>0);
+    float min_x=uv[0].x, max_x=uv[0].x, min_y=uv[0].y, max_y=uv[0].y;
+    for (size_t i=1; i<n; ++i)
+    {
+        min_x = std::min(min_x, uv[i].x);
+        max_x = std::max(max_x, uv[i].x);
+        min_y = std::min(min_y, uv[i].y);
+        max_y = std::max(max_y, uv[i].y);
+    }
+    cv::Rect bbox(int(min_x), int(min_y), int(max_x-min_x), int(max_y-min_y));
+    return bbox & cv::Rect(0, 0, _view.cols, _view.rows);
+}
+
+cv::Rect
+View::compute_bounding_box(const Voxel& voxel) const
+{
+    cv::Point2f uv[8];
+    project_voxel(voxel, uv);
+    return compute_bounding_box(uv, 8);
+}
+
+void
+View::init_row_sums()
+{
+    _rows_fg = cv::Mat(_foreground.rows, _foreground.cols+1, CV_32SC1);
+    for (int y=0; y<_foreground.rows; ++y)
+    {
+        const uchar* fg = _foreground.ptr<uchar>(y);
+        int* sum = _rows_fg.ptr<int>(y);
+        sum[0] = 0;
+        for (int x=0; x<_foreground.cols; ++x)
+            sum[x+1] = sum[x] + (fg[x] ? 1 : 0);
+    }
+}
+
+void
+View::init_distances()
+{
+    //Exact euclidean distances: the classification must be conservative.
+    cv::distanceTransform(_foreground, _dist_fg, cv::DIST_L2, cv::DIST_MASK_PRECISE, CV_32F);
+    cv::Mat background = (_foreground == 0);
+    cv::distanceTransform(background, _dist_bg, cv::DIST_L2, cv::DIST_MASK_PRECISE, CV_32F);
+}
+
+RegionClass
+View::classify(const cv::Rect& bbox) const
+{
+    if (bbox.area()<=0)
+        return REGION_MIXED;
+    const int cx = bbox.x + bbox.width/2;
+    const int cy = bbox.y + bbox.height/2;
+    //Distance from the center pixel to the farthest pixel of the bbox.
+    const float dx = float(std::max(cx-bbox.x, bbox.x+bbox.width-1-cx));
+    const float dy = float(std::max(cy-bbox.y, bbox.y+bbox.height-1-cy));
+    const float radius = std::sqrt(dx*dx + dy*dy);
+    if (_foreground.at<uchar>(cy, cx))
+        return _dist_fg.at<float>(cy, cx) > radius ? REGION_INSIDE : REGION_MIXED;
+    return _dist_bg.at<float>(cy, cx) > radius ? REGION_OUTSIDE : REGION_MIXED;
+}
+
+/** @brief A closed interval to bound the projection of a region.
+ *  The operations round to nearest, the callers keep a margin for it.*/
+struct Interval
+{
+    float lo, hi;
+};
+
+static inline Interval
+operator+(const Interval& a, const Interval& b)
+{
+    return Interval{a.lo+b.lo, a.hi+b.hi};
+}
+
+static inline Interval
+operator*(const float s, const Interval& a)
+{
+    return s>=0.0f ? Interval{s*a.lo, s*a.hi} : Interval{s*a.hi, s*a.lo};
+}
+
+static inline Interval
+operator*(const Interval& a, const Interval& b)
+{
+    const float p[4] = {a.lo*b.lo, a.lo*b.hi, a.hi*b.lo, a.hi*b.hi};
+    return Interval{*std::min_element(p, p+4), *std::max_element(p, p+4)};
+}
+
+static inline Interval
+square(const Interval& a)
+{
+    const float l = a.lo*a.lo, h = a.hi*a.hi;
+    if (a.lo<=0.0f && a.hi>=0.0f)
+        return Interval{0.0f, std::max(l, h)};
+    return Interval{std::min(l, h), std::max(l, h)};
+}
+
+/** @brief The smallest absolute value of an interval that does not contain 0, else 0.*/
+static inline float
+min_abs(const Interval& a)
+{
+    return a.lo>0.0f ? a.lo : (a.hi<0.0f ? -a.hi : 0.0f);
+}
+
+/**
+ * @brief Bound the distorted normalized coordinates (and their jacobian)
+ * of the points whose undistorted normalized coordinates are in x, y.
+ * It is the interval extension of View::project_camera_point().
+ */
+static void
+bound_distortion(const float* d, const Interval& x, const Interval& y,
+                 Interval& xd, Interval& yd, Interval J[3])
+{
+    const Interval x2 = square(x), y2 = square(y), xy = x*y;
+    const Interval r2 = x2 + y2;
+    const Interval one{1.0f, 1.0f};
+    const Interval radial = one + r2*(Interval{d[0], d[0]} + r2*(Interval{d[1], d[1]}
+                                                             + d[4]*r2));
+    //d radial / d r2.
+    const Interval dradial = Interval{d[0], d[0]} + r2*(Interval{2.0f*d[1], 2.0f*d[1]}
+                                                        + (3.0f*d[4])*r2);
+    xd = x*radial + (2.0f*d[2])*xy + d[3]*(r2 + 2.0f*x2);
+    yd = y*radial + d[2]*(r2 + 2.0f*y2) + (2.0f*d[3])*xy;
+    //d xd/dx, d xd/dy = d yd/dx and d yd/dy.
+    J[0] = radial + 2.0f*(x2*dradial) + (2.0f*d[2])*y + (6.0f*d[3])*x;
+    J[1] = 2.0f*(xy*dradial) + (2.0f*d[2])*x + (2.0f*d[3])*y;
+    J[2] = radial + 2.0f*(y2*dradial) + (6.0f*d[2])*y + (2.0f*d[3])*x;
+}
+
+RegionClass
+View::classify_region(const Voxel& region, const float vsize,
+                      bool& out_of_frame) const
+{
+    out_of_frame = false;
+    float min_u=std::numeric_limits<float>::max(), max_u=-min_u;
+    float min_v=min_u, max_v=-min_u;
+    float max_w=0.0f;
+    const float* P = _proj.P;
+    const float* Rt = _proj.Rt;
+    //With distortion the normalized coordinates x/z, y/z and the depth of
+    //the region are bounded and the distortion is bounded over them.
+    Interval nx{min_u, max_u}, ny{min_u, max_u}, nz{min_u, max_u};
+    Interval J[3] = {};
+    for (int i=0; i<8; ++i)
+    {
+        const float X = region.x() + ((i>>2)&1)*region.x_dim();
+        const float Y = region.y() + (i&1)*region.y_dim();
+        const float Z = region.z() + ((i>>1)&1)*region.z_dim();
+        if (_proj.distorted)
+        {
+            const float zc = Rt[8]*X + Rt[9]*Y + Rt[10]*Z + Rt[11];
+            if (zc<=0.0f)
+                return REGION_MIXED;
+            const float x = (Rt[0]*X + Rt[1]*Y + Rt[2]*Z + Rt[3])/zc;
+            const float y = (Rt[4]*X + Rt[5]*Y + Rt[6]*Z + Rt[7])/zc;
+            nx = Interval{std::min(nx.lo, x), std::max(nx.hi, x)};
+            ny = Interval{std::min(ny.lo, y), std::max(ny.hi, y)};
+            nz = Interval{std::min(nz.lo, zc), std::max(nz.hi, zc)};
+            continue;
+        }
+        const float w = P[8]*X + P[9]*Y + P[10]*Z + P[11];
+        if (w<=0.0f)
+            return REGION_MIXED;
+        const float u = (P[0]*X + P[1]*Y + P[2]*Z + P[3])/w;
+        const float v = (P[4]*X + P[5]*Y + P[6]*Z + P[7])/w;
+        min_u = std::min(min_u, u);
+        max_u = std::max(max_u, u);
+        min_v = std::min(min_v, v);
+        max_v = std::max(max_v, v);
+        max_w = std::max(max_w, w);
+    }
+    if (_proj.distorted)
+    {
+        //x/z and y/z are linear-fractional, so their extremes over the region
+        //are at the vertices, and the distorted points are inside the bounds.
+        Interval xd, yd;
+        bound_distortion(_proj.dist, nx, ny, xd, yd, J);
+        const Interval u = _proj.fx*xd + Interval{_proj.cx, _proj.cx};
+        const Interval v = _proj.fy*yd + Interval{_proj.cy, _proj.cy};
+        min_u = u.lo;
+        max_u = u.hi;
+        min_v = v.lo;
+        max_v = v.hi;
+    }
+    //The pixels of a voxel bbox are in [floor(min), floor(max)] (see
+    //compute_bounding_box()). One more pixel absorbs the rounding errors.
+    const float cols = float(_view.cols);
+    const float rows = float(_view.rows);
+    const float x0 = std::floor(min_u)-1.0f, x1 = std::floor(max_u)+1.0f;
+    const float y0 = std::floor(min_v)-1.0f, y1 = std::floor(max_v)+1.0f;
+    if (x1<0.0f || y1<0.0f || x0>=cols || y0>=rows)
+    {
+        out_of_frame = true;
+        return REGION_MIXED;
+    }
+    if (x0<0.0f || y0<0.0f || x1>=cols || y1>=rows)
+        return REGION_MIXED;
+    const cv::Rect bbox(int(x0), int(y0), int(x1-x0)+1, int(y1-y0)+1);
+    const int occupied = compute_occupied_area(bbox);
+    if (occupied==bbox.area())
+        return REGION_INSIDE;
+    if (occupied>0)
+        return REGION_MIXED;
+
+    //A voxel bbox has zero area if its projection is thinner than a pixel.
+    //For the vertices p, p+vsize*e of a voxel (e is an edge or a diagonal):
+    //  u(p+vsize*e)-u(p) = vsize*(P[0].e - u(p)*P[2].e) / w(p+vsize*e)
+    //where u(p) is in [min_u, max_u] and w in (0, max_w], so the width of
+    //any voxel bbox is bounded below by the widest of them. The bbox size
+    //is truncated (see compute_bounding_box()), so it must be one pixel.
+    static const int dirs[13][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+                                    {1, 1, 0}, {1, -1, 0}, {1, 0, 1}, {1, 0, -1},
+                                    {0, 1, 1}, {0, 1, -1}, {1, 1, 1}, {1, 1, -1},
+                                    {1, -1, 1}, {1, -1, -1}};
+    float du=0.0f, dv=0.0f;
+    for (int k=0; k<13; ++k)
+    {
+        float Pe[3], Rte[3];
+        for (int r=0; r<3; ++r)
+        {
+            Pe[r] = P[r*4]*dirs[k][0] + P[r*4+1]*dirs[k][1] + P[r*4+2]*dirs[k][2];
+            Rte[r] = Rt[r*4]*dirs[k][0] + Rt[r*4+1]*dirs[k][1] + Rt[r*4+2]*dirs[k][2];
+        }
+        if (_proj.distorted)
+        {
+            //The same for the normalized coordinates, then the distorted
+            //displacement is bounded by the jacobian of the distortion (mean
+            //value theorem).
+            const Interval iz{1.0f/nz.hi, 1.0f/nz.lo};
+            const Interval ex = vsize*((Interval{Rte[0], Rte[0]} + (-Rte[2])*nx)*iz);
+            const Interval ey = vsize*((Interval{Rte[1], Rte[1]} + (-Rte[2])*ny)*iz);
+            du = std::max(du, std::abs(_proj.fx)*min_abs(J[0]*ex + J[1]*ey));
+            dv = std::max(dv, std::abs(_proj.fy)*min_abs(J[1]*ex + J[2]*ey));
+            continue;
+        }
+        const float u0 = Pe[0] - min_u*Pe[2], u1 = Pe[0] - max_u*Pe[2];
+        const float v0 = Pe[1] - min_v*Pe[2], v1 = Pe[1] - max_v*Pe[2];
+        if (u0*u1>0.0f)
+            du = std::max(du, vsize*std::min(std::abs(u0), std::abs(u1))/max_w);
+        if (v0*v1>0.0f)
+            dv = std::max(dv, vsize*std::min(std::abs(v0), std::abs(v1))/max_w);
+    }
+    //A small margin absorbs the rounding errors.
+    if (du>=1.01f && dv>=1.01f)
+        return REGION_OUTSIDE;
+    return REGION_MIXED;
+}
+
+/** @brief z of the cross product (a-o)x(b-o).*/
+static inline float
+cross(const cv::Point2f& o, const cv::Point2f& a, const cv::Point2f& b)
+{
+    return (a.x-o.x)*(b.y-o.y) - (a.y-o.y)*(b.x-o.x);
+}
+
+/** @brief Compute the convex hull (counterclockwise) of at most 8 points.
+ *  @return the number of vertices of the hull.*/
+static size_t
+convex_hull(const cv::Point2f* uv, const size_t n, cv::Point2f hull[16])
+{
+    cv::Point2f p[8];
+    std::copy(uv, uv+n, p);
+    std::sort(p, p+n, [](const cv::Point2f& a, const cv::Point2f& b)
+    {
+        return a.x<b.x || (a.x==b.x && a.y<b.y);
+    });
+    //Andrew's monotone chain.
+    size_t k=0;
+    for (size_t i=0; i<n; ++i)
+    {
+        while (k>=2 && cross(hull[k-2], hull[k-1], p[i])<=0.0f)
+            --k;
+        hull[k++] = p[i];
+    }
+    for (size_t i=n-1, t=k+1; i>0; --i)
+    {
+        while (k>=t && cross(hull[k-2], hull[k-1], p[i-1])<=0.0f)
+            --k;
+        hull[k++] = p[i-1];
+    }
+    return k>1 ? k-1 : k;
+}
+
+/** @brief The pixels whose centers the hull of the points may cover.
+ *  It also contains the bbox of compute_bounding_box(), which truncates its size.*/
+static cv::Rect
+pixel_extent(const cv::Point2f* uv, const size_t n, const cv::Size& size)
+{
+    float min_x=uv[0].x, max_x=uv[0].x, min_y=uv[0].y, max_y=uv[0].y;
+    for (size_t i=1; i<n; ++i)
+    {
+        min_x = std::min(min_x, uv[i].x);
+        max_x = std::max(max_x, uv[i].x);
+        min_y = std::min(min_y, uv[i].y);
+        max_y = std::max(max_y, uv[i].y);
+    }
+    const int x0 = int(std::floor(min_x)), y0 = int(std::floor(min_y));
+    const cv::Rect extent(x0, y0, int(std::floor(max_x))-x0+1, int(std::floor(max_y))-y0+1);
+    return extent & cv::Rect(0, 0, size.width, size.height);
+}
+
+int
+View::compute_occupied_area(const cv::Point2f* uv, const size_t n,
+                            const FootprintMode mode, int& area) const
+{
+    CV_Assert(n>0 && n<=8);
+    const cv::Rect bbox = compute_bounding_box(uv, n);
+    area = bbox.area();
+    if (area==0)
+        return 0;
+    //The hull may cover pixels out of the bbox, so its whole extent is classified.
+    const RegionClass region = classify(mode==FOOTPRINT_BBOX ? bbox
+                                        : pixel_extent(uv, n, _foreground.size()));
+    if (region==REGION_INSIDE)
+        return area;
+    if (region==REGION_OUTSIDE)
+        return 0;
+    if (mode==FOOTPRINT_BBOX)
+        return compute_occupied_area(bbox);
+
+    cv::Point2f hull[16];
+    const size_t m = convex_hull(uv, n, hull);
+    int hull_area=0, occupied=0;
+    if (m>=3)
+    {
+        float min_y=hull[0].y, max_y=hull[0].y;
+        for (size_t i=1; i<m; ++i)
+        {
+            min_y = std::min(min_y, hull[i].y);
+            max_y = std::max(max_y, hull[i].y);
+        }
+        //Rows whose pixel centers are inside [min_y, max_y].
+        const float rows = float(_rows_fg.rows);
+        const int y0 = int(std::min(rows, std::max(0.0f, std::ceil(min_y-0.5f))));
+        const int y1 = int(std::max(-1.0f, std::min(rows-1.0f, std::floor(max_y-0.5f))));
+        for (int y=y0; y<=y1; ++y)
+        {
+            const float yc = y+0.5f;
+            float xl = std::numeric_limits<float>::max();
+            float xr = -std::numeric_limits<float>::max();
+            for (size_t i=0; i<m; ++i)
+            {
+                const cv::Point2f& a = hull[i];
+                const cv::Point2f& b = hull[(i+1)%m];
+                if ((a.y<=yc && b.y>=yc) || (b.y<=yc && a.y>=yc))
+                {
+                    const float x = (a.y==b.y) ? a.x
+                            : a.x + (yc-a.y)*(b.x-a.x)/(b.y-a.y);
+                    xl = std::min(xl, std::min(x, a.y==b.y ? b.x : x));
+                    xr = std::max(xr, std::max(x, a.y==b.y ? b.x : x));
+                }
+            }
+            const float cols = float(_foreground.cols);
+            const int x0 = int(std::min(cols, std::max(0.0f, std::ceil(xl-0.5f))));
+            const int x1 = int(std::max(-1.0f, std::min(cols-1.0f, std::floor(xr-0.5f))));
+            if (x0<=x1)
+            {
+                const int* sum = _rows_fg.ptr<int>(y);
+                hull_area += x1-x0+1;
+                occupied += sum[x1+1]-sum[x0];
+            }
+        }
+    }
+    if (hull_area==0)
+        //Smaller than a pixel: use the bbox.
+        return compute_occupied_area(bbox);
+    area = hull_area;
+    return occupied;
+}
+
 } // namespace fsiv
@@ -3,10 +3,25 @@
 #include <opencv2/core.hpp>
 
 #include "camera_parameters.hpp"
+#include "voxel.hpp"
+#include "projection.hpp"
 
 namespace fsiv
 {
 
+/** @brief Footprints of a projected voxel used to measure its occupied area. */
+typedef enum {
+    FOOTPRINT_BBOX=0, //the axis aligned bounding box of the projected vertices.
+    FOOTPRINT_HULL=1  //the convex hull of the projected vertices (exact).
+} FootprintMode;
+
+/** @brief Classes of a region of the image against the silhouette. */
+typedef enum {
+    REGION_MIXED=0,  //unknown: there may be foreground and background pixels.
+    REGION_INSIDE=1, //all the pixels are foreground.
+    REGION_OUTSIDE=2 //all the pixels are background.
+} RegionClass;
+
 /** @brief Model a 2D view of a 3D scene.
 
   A view is formed by a image from a camera, optionally the foreground
@@ -62,15 +77,125 @@ public:
    */
     cv::Rect compute_bounding_box(const cv::Mat& _3dPoints) const;
 
+    /**
+     * @brief Project a 3D point (WCS) onto the view.
+     * Closed-form equivalent to project_points() using the precomputed
+     * projection of the view (5 coeffs. radial/tangential distortion model).
+     */
+    cv::Point2f project_point(const float X, const float Y, const float Z) const;
+
+    /**
+     * @brief Project a batch of 3D points (WCS) onto the view.
+     * The points are given as a structure of arrays and they are projected
+     * with the fastest SIMD kernel of the cpu (see fsiv::project_points()).
+     * Same result as project_point() for each point.
+     * @param[in] X, Y, Z are the coordinates of the n points.
+     * @param[out] u, v are the 2d coordinates of the n points.
+     */
+    void project_points(const float* X, const float* Y, const float* Z,
+                        const size_t n, float* u, float* v) const;
+
+    /*!\brief Get the optical center of the camera (WCS).*/
+    cv::Point3f camera_center() const;
+
+    /*!\brief Get the precomputed projection of the view.*/
+    const ProjectionModel& projection_model() const;
+
+    /**
+     * @brief Project the eight vertices of a voxel onto the view.
+     * It is equivalent to project_points(voxel.vertices()) but it works with
+     * plain float arithmetic and no temporary matrices are allocated.
+     * @param[in] voxel is the voxel to be projected.
+     * @param[out] uv are the 2d coordinates in the order given by Voxel::vertices().
+     */
+    void project_voxel(const Voxel& voxel, cv::Point2f uv[8]) const;
+
+    /**
+     * @brief Project a plane of 3D points (WCS) onto the view.
+     * The points are (X[i], Y[j], Z) with i<nx, j<ny. Each point gives the
+     * same result as project_point(), but the products of the Y and Z
+     * coordinates are shared by the points of a row.
+     * @param[out] uv are the 2d coordinates stored as uv[j*nx+i].
+     */
+    void project_lattice_plane(const float* X, const size_t nx,
+                               const float* Y, const size_t ny, const float Z,
+                               cv::Point2f* uv) const;
+
+    /*!\brief Compute the bounding box of a sequence of 2d points.
+     * \warning the bbox is clipped to the image frame.
+     */
+    cv::Rect compute_bounding_box(const cv::Point2f* uv, const size_t n) const;
+
+    /*!\brief Compute the projected bounding box of a voxel.
+     * Same result as compute_bounding_box(voxel.vertices()) without heap allocations.
+     * \warning the bbox is clipped to the image frame.
+     */
+    cv::Rect compute_bounding_box(const Voxel& voxel) const;
+
+    /*!\brief Classify a bbox against the silhouette in O(1).
+     * The distance transforms of the foreground and the background are
+     * looked up at the center pixel of the bbox: if the nearest pixel of the
+     * other class is farther than the farthest pixel of the bbox, all the
+     * bbox is on the same side of the silhouette.
+     */
+    RegionClass classify(const cv::Rect& bbox) const;
+
+    /*!\brief Classify the footprints of all the voxels inside a 3D region.
+     * It is a conservative test for coarse to fine carving: the region is
+     * projected and the bbox of its projection, enlarged one pixel, bounds the
+     * bbox of any voxel of side vsize inside the region.
+     * \param[in] region is the 3D region (a block of voxels).
+     * \param[in] vsize is the side of the voxels.
+     * \param[out] out_of_frame is true if the bboxes of all the voxels are out
+     *  of the image frame (zero area).
+     * \return REGION_INSIDE if the bboxes of all the voxels are inside the image
+     *  and foreground, REGION_OUTSIDE if they are inside the image, background
+     *  and they are not empty (area>0), or REGION_MIXED otherwise. It is always
+     *  REGION_MIXED if the region is not in front of the camera. With distortion
+     *  the distorted coordinates are bounded over the region (interval arithmetic).
+     */
+    RegionClass classify_region(const Voxel& region, const float vsize,
+                                bool& out_of_frame) const;
+
     /*!\brief Compute the number of foreground active pixels inside of a bbox */
     int compute_occupied_area(const cv::Rect& bbox) const;
 
+    /*!\brief Compute the number of foreground active pixels inside the footprint of a set of 2d points.
+     * With FOOTPRINT_HULL the convex hull of the points is rasterised (pixel
+     * centers inside) using the per-row prefix sums of the foreground. If the
+     * hull does not cover any pixel center the bbox is used. A bbox fully
+     * inside or outside of the silhouette (see classify()) is not rasterised.
+     * \param[in] uv are the 2d points (at most 8, i.e. a projected voxel).
+     * \param[in] n is the number of points.
+     * \param[in] mode is the kind of footprint.
+     * \param[out] area is the footprint area in pixels (0 means out of the image frame).
+     * \return the number of foreground pixels inside the footprint.
+     */
+    int compute_occupied_area(const cv::Point2f* uv, const size_t n,
+                              const FootprintMode mode, int& area) const;
+
 private:
+    /*!\brief Precompute the projection parameters from the camera parameters.*/
+    void init_projection();
+
+    /*!\brief Compute the per-row prefix sums of the foreground.*/
+    void init_row_sums();
+
+    /*!\brief Compute the distance transforms of the foreground and the background.*/
+    void init_distances();
+
+    /*!\brief Project a point given in camera coordinates.*/
+    cv::Point2f project_camera_point(const float xc, const float yc, const float zc) const;
+
     std::string _id; /*!< the view identificator.*/
     cv::Mat _view; 	/*!< the view image.*/
     cv::Mat _foreground; 	/*!< the foreground image.*/
     cv::Mat _iimg_fg; /*!< the foreground integral image.*/
+    cv::Mat _rows_fg; /*!< the foreground per-row prefix sums (rows x cols+1).*/
+    cv::Mat _dist_fg; /*!< distance from a foreground pixel to the background.*/
+    cv::Mat _dist_bg; /*!< distance from a background pixel to the foreground.*/
     CameraParameters _cparams; /*!< the camera parameters. */
+    ProjectionModel _proj; /*!< the precomputed projection.*/
 };
 
 } //namespacde fsiv
@@ -0,0 +1,178 @@
+#include <cmath>
+#include <algorithm>
+#include "voxel_coloring.hpp"
+
+namespace fsiv {
+
+void
+VoxelColors::reset(const size_t n)
+{
+    rgb.assign(n, cv::Vec3b(0, 0, 0));
+    has_color.assign(n, 0);
+}
+
+/** @brief A surface voxel of a plane and the result of its photo consistency test.*/
+struct VoxelSample
+{
+    size_t pos[3];
+    bool consistent;
+    bool seen;
+    cv::Vec3b rgb;
+};
+
+/**
+ * @brief Test the photo consistency of a voxel against the active views.
+ * The unoccluded foreground pixels of the projected bbox are used.
+ */
+static void
+test_voxel(std::vector<View> const& views, const std::vector<size_t>& active,
+           const std::vector<cv::Mat>& occlusion, const VoxelSet& vs,
+           const float max_stddev, VoxelSample& sample)
+{
+    const Voxel voxel = vs.voxel(sample.pos[0], sample.pos[1], sample.pos[2]);
+    double sum[3] = {0.0, 0.0, 0.0};
+    double sum2[3] = {0.0, 0.0, 0.0};
+    size_t n = 0;
+    for (size_t a = 0; a < active.size(); ++a)
+    {
+        const View& view = views[active[a]];
+        const cv::Rect bbox = view.compute_bounding_box(voxel);
+        const cv::Mat& img = view.colored_view();
+        const int channels = img.channels();
+        for (int y = bbox.y; y < bbox.y + bbox.height; ++y)
+        {
+            const uchar* fg = view.foreground().ptr<uchar>(y);
+            const uchar* occ = occlusion[active[a]].ptr<uchar>(y);
+            const uchar* pixel = img.ptr<uchar>(y);
+            for (int x = bbox.x; x < bbox.x + bbox.width; ++x)
+            {
+                if (!fg[x] || occ[x])
+                    continue;
+                //BGR or gray.
+                for (int c = 0; c < 3; ++c)
+                {
+                    const double value = pixel[x * channels + (channels == 3 ? c : 0)];
+                    sum[c] += value;
+                    sum2[c] += value * value;
+                }
+                ++n;
+            }
+        }
+    }
+    sample.seen = n > 0;
+    sample.consistent = true;
+    if (!sample.seen)
+        return;
+    double variance = 0.0;
+    for (int c = 0; c < 3; ++c)
+    {
+        const double mean = sum[c] / n;
+        variance += std::max(0.0, sum2[c] / n - mean * mean);
+        sample.rgb[2 - c] = cv::saturate_cast<uchar>(mean);
+    }
+    sample.consistent = std::sqrt(variance / 3.0) <= max_stddev;
+}
+
+size_t
+compute_voxel_coloring(std::vector<View> const& views, VoxelSet& vs,
+                       VoxelColors& colors, const float max_stddev,
+                       const size_t max_iterations)
+{
+    std::vector<cv::Point3f> centers(views.size());
+    std::vector<cv::Mat> occlusion(views.size());
+    for (size_t v = 0; v < views.size(); ++v)
+    {
+        const cv::Mat& img = views[v].colored_view();
+        CV_Assert(img.depth() == CV_8U && (img.channels() == 3 || img.channels() == 1));
+        CV_Assert(img.size() == views[v].foreground().size());
+        centers[v] = views[v].camera_center();
+    }
+    colors.reset(vs.size());
+    const size_t n[3] = {vs.x_size(), vs.y_size(), vs.z_size()};
+    const float origin[3] = {vs.bounding_cuve().x(), vs.bounding_cuve().y(),
+                             vs.bounding_cuve().z()};
+    std::vector<size_t> active;
+    std::vector<VoxelSample> samples;
+    size_t carved = 0;
+    for (size_t it = 0; it < max_iterations; ++it)
+    {
+        size_t carved_it = 0;
+        for (int axis = 0; axis < 3; ++axis)
+            for (int dir = 0; dir < 2; ++dir)
+            {
+                for (size_t v = 0; v < views.size(); ++v)
+                    occlusion[v] = cv::Mat::zeros(views[v].foreground().size(), CV_8UC1);
+                const int u = (axis + 1) % 3, w = (axis + 2) % 3;
+                for (size_t k = 0; k < n[axis]; ++k)
+                {
+                    const size_t p = (dir == 0) ? k : n[axis] - 1 - k;
+                    //The views in front of the face of the plane seen in this sweep.
+                    const float face = origin[axis] + vs.vsize() * ((dir == 0) ? p : p + 1);
+                    active.clear();
+                    for (size_t v = 0; v < views.size(); ++v)
+                    {
+                        const float c = (axis == 0) ? centers[v].x :
+                                        (axis == 1) ? centers[v].y : centers[v].z;
+                        if ((dir == 0) ? (c < face) : (c > face))
+                            active.push_back(v);
+                    }
+                    if (active.empty())
+                        continue;
+
+                    samples.clear();
+                    VoxelSample sample;
+                    sample.pos[axis] = p;
+                    for (size_t j = 0; j < n[w]; ++j)
+                        for (size_t i = 0; i < n[u]; ++i)
+                        {
+                            sample.pos[u] = i;
+                            sample.pos[w] = j;
+                            if (vs.occupancy(sample.pos[0], sample.pos[1], sample.pos[2]) &&
+                                vs.is_external(sample.pos[0], sample.pos[1], sample.pos[2]))
+                                samples.push_back(sample);
+                        }
+
+#pragma omp parallel for schedule(dynamic, 64)
+                    for (size_t s = 0; s < samples.size(); ++s)
+                        test_voxel(views, active, occlusion, vs, max_stddev, samples[s]);
+
+                    for (size_t s = 0; s < samples.size(); ++s)
+                    {
+                        const size_t idx = vs.xyz2index(samples[s].pos[0], samples[s].pos[1],
+                                                        samples[s].pos[2]);
+                        if (!samples[s].consistent)
+                        {
+                            vs.set_occupancy(idx, false);
+                            colors.has_color[idx] = 0;
+                            ++carved_it;
+                        }
+                        else if (samples[s].seen)
+                        {
+                            colors.rgb[idx] = samples[s].rgb;
+                            colors.has_color[idx] = 1;
+                        }
+                    }
+
+                    //The voxels kept occlude the next planes.
+#pragma omp parallel for
+                    for (size_t a = 0; a < active.size(); ++a)
+                        for (size_t s = 0; s < samples.size(); ++s)
+                        {
+                            if (!samples[s].consistent)
+                                continue;
+                            const cv::Rect bbox = views[active[a]].compute_bounding_box(
+                                        vs.voxel(samples[s].pos[0], samples[s].pos[1],
+                                                 samples[s].pos[2]));
+                            if (bbox.area() > 0)
+                                occlusion[active[a]](bbox).setTo(1);
+                        }
+                }
+            }
+        carved += carved_it;
+        if (carved_it == 0)
+            break;
+    }
+    return carved;
+}
+
+} //namespace fsiv
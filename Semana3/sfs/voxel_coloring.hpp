@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "voxelset.hpp"
+#include "view.hpp"
+
+namespace fsiv
+{
+
+/**
+ * @brief The VoxelColors struct.
+ * The colors of the voxels of a voxelset indexed as the voxelset.
+ * Only the occupied voxels seen by some view have a color.
+ */
+struct VoxelColors
+{
+    std::vector<cv::Vec3b> rgb;   //the colors (RGB order).
+    std::vector<uchar> has_color; //1 if the voxel has a color.
+
+    /** @brief Remove the colors and make room for n voxels.*/
+    void reset(const size_t n);
+};
+
+/**
+ * @brief Carve the photo inconsistent voxels of a visual hull and color the rest.
+ *
+ * It is the space carving algorithm with plane sweeps: the voxelset is swept
+ * along each axis in both directions and for a sweep only the views whose
+ * camera center is in front of the current plane are used, so the voxels of
+ * the previous planes are the only ones that can occlude it. For each view
+ * an occlusion buffer marks the pixels covered by the voxels already kept
+ * in the sweep.
+ *
+ * The surface voxels of a plane are tested in parallel: the unoccluded
+ * foreground pixels of the projected bbox of the voxel on each view are
+ * gathered from View::colored_view() and the voxel is carved if the
+ * standard deviation of their colors is greater than a threshold. Else
+ * its color is their mean. The sweeps are repeated until no voxel is carved.
+ *
+ * @param[in] views are the views with their colored images (BGR or gray).
+ * @param[in,out] vs is the visual hull.
+ * @param[out] colors are the colors of the surface voxels.
+ * @param[in] max_stddev is the max. standard deviation of a consistent voxel (0-255).
+ * @param[in] max_iterations is the max. number of times the six sweeps are done.
+ * @return the number of carved voxels.
+ */
+size_t compute_voxel_coloring(std::vector<View> const& views, VoxelSet& vs,
+                              VoxelColors& colors, const float max_stddev=20.0f,
+                              const size_t max_iterations=4);
+
+} //namespace fsiv
@@ -1,17 +1,33 @@
 #include <zlib.h>
 #include <valarray>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
 #include "voxelset.hpp"
+#include "morton.hpp"
 
 namespace fsiv {
 
 VoxelSet::VoxelSet ()
     : _bcuve(), _vsize(0.0),
-      _x_size(0), _y_size(0), _z_size(0), _xy_size(0)
+      _x_size(0), _y_size(0), _z_size(0), _xy_size(0),
+      _storage(BYTE_STORAGE), _layout(LINEAR_LAYOUT), _morton_bits(0),
+      _score_depth(NO_SCORES)
 {
     CV_Assert(empty());
 }
 
-VoxelSet::VoxelSet(const Voxel& bc, const float vsize, const bool init_occ_state)
+VoxelSet::VoxelSet (const VoxelStorage storage, const VoxelLayout layout)
+    : VoxelSet()
+{
+    _storage = storage;
+    _layout = layout;
+}
+
+VoxelSet::VoxelSet(const Voxel& bc, const float vsize, const bool init_occ_state,
+                   const VoxelStorage storage, const VoxelLayout layout)
+    : _storage(storage), _layout(layout), _morton_bits(0),
+      _score_depth(NO_SCORES)
 {
   reset(bc, vsize, init_occ_state);
 }
@@ -19,7 +35,7 @@ VoxelSet::VoxelSet(const Voxel& bc, const float vsize, const bool init_occ_state
 bool
 VoxelSet::empty()
 {
-    return _occupancy_map.empty();
+    return _occupancy_map.empty() && _occupancy_bits.empty();
 }
 
 Voxel
@@ -45,6 +61,8 @@ bool
 VoxelSet::occupancy(const size_t idx) const
 {
     CV_Assert(idx < size());
+    if (_storage == BIT_STORAGE)
+        return (_occupancy_bits[idx >> 6] >> (idx & 63)) & 1;
     return _occupancy_map.at<uchar>(idx);
 }
 
@@ -59,7 +77,17 @@ void
 VoxelSet::set_occupancy(const size_t idx, const bool new_v)
 {
     CV_Assert(idx < size());
-    _occupancy_map.at<cv::uint8_t>(idx)=new_v;
+    if (_storage == BIT_STORAGE)
+    {
+        //Atomic update because neighbour voxels share the word.
+        const std::uint64_t mask = std::uint64_t(1) << (idx & 63);
+        if (new_v)
+            __sync_fetch_and_or(&_occupancy_bits[idx >> 6], mask);
+        else
+            __sync_fetch_and_and(&_occupancy_bits[idx >> 6], ~mask);
+    }
+    else
+        _occupancy_map.at<cv::uint8_t>(idx)=new_v;
 }
 
 void
@@ -70,10 +98,238 @@ VoxelSet::set_occupancy(const size_t x, const size_t y, const size_t z,
   return set_occupancy(xyz2index(x, y, z), new_v);
 }
 
+void
+VoxelSet::fill_occupancy(const size_t begin, const size_t end, const bool new_v)
+{
+    CV_Assert(begin <= end && end <= size());
+    if (_storage == BYTE_STORAGE)
+    {
+        std::fill(_occupancy_map.data + begin, _occupancy_map.data + end,
+                  cv::uint8_t(new_v));
+        return;
+    }
+    size_t i = begin;
+    for (; i < end && (i & 63); ++i)
+        set_occupancy(i, new_v);
+    const std::uint64_t word = new_v ? ~std::uint64_t(0) : std::uint64_t(0);
+    for (; i + 64 <= end; i += 64)
+        _occupancy_bits[i >> 6] = word;
+    for (; i < end; ++i)
+        set_occupancy(i, new_v);
+}
+
+size_t
+VoxelSet::n_words() const
+{
+    return (size() + 63) / 64;
+}
+
+std::uint64_t
+VoxelSet::occupancy_word(const size_t w) const
+{
+    CV_Assert(w < n_words());
+    if (_storage == BIT_STORAGE)
+        return _occupancy_bits[w];
+    const size_t begin = w * 64;
+    const size_t end = std::min(size(), begin + 64);
+    std::uint64_t bits = 0;
+    for (size_t i = begin; i < end; ++i)
+        if (_occupancy_map.data[i])
+            bits |= std::uint64_t(1) << (i - begin);
+    return bits;
+}
+
+void
+VoxelSet::set_occupancy_word(const size_t w, const std::uint64_t bits)
+{
+    CV_Assert(w < n_words());
+    const size_t begin = w * 64;
+    const size_t end = std::min(size(), begin + 64);
+    if (_storage == BIT_STORAGE)
+    {
+        //Keep zero the bits beyond size().
+        const std::uint64_t valid = (end - begin == 64) ? ~std::uint64_t(0)
+                                    : (std::uint64_t(1) << (end - begin)) - 1;
+        _occupancy_bits[w] = bits & valid;
+    }
+    else
+        for (size_t i = begin; i < end; ++i)
+            _occupancy_map.data[i] = (bits >> (i - begin)) & 1;
+}
+
+size_t
+VoxelSet::count_occupied() const
+{
+    size_t count = 0;
+    if (_storage == BIT_STORAGE)
+    {
+        for (size_t w = 0; w < _occupancy_bits.size(); ++w)
+            count += __builtin_popcountll(_occupancy_bits[w]);
+    }
+    else if (!_occupancy_map.empty())
+        count = cv::countNonZero(_occupancy_map);
+    return count;
+}
+
+/** @brief Max quantized score of a score depth.*/
+static unsigned
+score_max(const ScoreDepth depth)
+{
+    return depth == SCORES_16U ? 65535u : 255u;
+}
+
+void
+VoxelSet::set_score_depth(const ScoreDepth depth)
+{
+    _score_depth = depth;
+    if (depth == NO_SCORES || size() == 0)
+    {
+        _scores.release();
+        return;
+    }
+    _scores = cv::Mat(1, size(), depth == SCORES_16U ? CV_16UC1 : CV_8UC1,
+                      cv::Scalar(score_max(depth)));
+    //The padding of the morton layout is never occupied.
+    if (_layout == MORTON_LAYOUT)
+        for (size_t idx = 0; idx < size(); ++idx)
+            if (!valid_index(idx))
+                set_score(idx, 0.0f);
+}
+
+ScoreDepth
+VoxelSet::score_depth() const
+{
+    return _score_depth;
+}
+
+bool
+VoxelSet::has_scores() const
+{
+    return !_scores.empty();
+}
+
+float
+VoxelSet::score(const size_t idx) const
+{
+    CV_Assert(has_scores() && idx < size());
+    if (_score_depth == SCORES_16U)
+        return _scores.ptr<std::uint16_t>()[idx] / float(score_max(SCORES_16U));
+    return _scores.ptr<std::uint8_t>()[idx] / float(score_max(SCORES_8U));
+}
+
+void
+VoxelSet::set_score(const size_t idx, const float oar)
+{
+    CV_Assert(has_scores() && idx < size());
+    const long q = std::lround(std::min(1.0f, std::max(0.0f, oar)) *
+                               score_max(_score_depth));
+    if (_score_depth == SCORES_16U)
+        _scores.ptr<std::uint16_t>()[idx] = std::uint16_t(q);
+    else
+        _scores.ptr<std::uint8_t>()[idx] = std::uint8_t(q);
+}
+
+/**
+ * @brief Set the occupancy of the voxels [0, size) as scores >= q_th.
+ * @param bytes is the occupancy map with BYTE_STORAGE (null otherwise).
+ * @param words are the occupancy bits with BIT_STORAGE (null otherwise).
+ */
+template <class T>
+static void
+threshold_scores(const T* scores, const size_t size, const T q_th,
+                 cv::uint8_t* bytes, std::uint64_t* words)
+{
+    if (bytes)
+    {
+#pragma omp parallel for
+        for (size_t i = 0; i < size; ++i)
+            bytes[i] = scores[i] >= q_th;
+        return;
+    }
+    const size_t n_words = (size + 63) / 64;
+#pragma omp parallel for
+    for (size_t w = 0; w < n_words; ++w)
+    {
+        const size_t begin = 64 * w;
+        const size_t n = std::min(size - begin, size_t(64));
+        std::uint64_t bits = 0;
+        for (size_t i = 0; i < n; ++i)
+            bits |= std::uint64_t(scores[begin + i] >= q_th) << i;
+        words[w] = bits;
+    }
+}
+
+size_t
+VoxelSet::apply_threshold(const float OAR_th)
+{
+    CV_Assert(has_scores());
+    if (OAR_th > 1.0f)
+    {
+        fill_occupancy(0, size(), false);
+        return 0;
+    }
+    const long q_th = std::lround(std::max(0.0f, OAR_th) * score_max(_score_depth));
+    cv::uint8_t* bytes = _storage == BYTE_STORAGE ? _occupancy_map.data : nullptr;
+    std::uint64_t* words = _storage == BIT_STORAGE ? &_occupancy_bits[0] : nullptr;
+    if (_score_depth == SCORES_16U)
+        threshold_scores(_scores.ptr<std::uint16_t>(), size(), std::uint16_t(q_th),
+                         bytes, words);
+    else
+        threshold_scores(_scores.ptr<std::uint8_t>(), size(), std::uint8_t(q_th),
+                         bytes, words);
+    //A zero threshold also passes the padding scores.
+    if (q_th == 0 && _layout == MORTON_LAYOUT)
+        for (size_t idx = 0; idx < size(); ++idx)
+            if (!valid_index(idx))
+                set_occupancy(idx, false);
+    return count_occupied();
+}
+
+size_t
+VoxelSet::next_occupied(const size_t idx) const
+{
+    if (idx >= size())
+        return size();
+    if (_storage == BIT_STORAGE)
+    {
+        size_t w = idx >> 6;
+        std::uint64_t bits = _occupancy_bits[w] & (~std::uint64_t(0) << (idx & 63));
+        while (bits == 0)
+        {
+            if (++w >= _occupancy_bits.size())
+                return size();
+            bits = _occupancy_bits[w];
+        }
+        return (w << 6) + __builtin_ctzll(bits);
+    }
+    const cv::uint8_t* begin = _occupancy_map.data;
+    return std::find_if(begin + idx, begin + size(),
+                        [](cv::uint8_t v) { return v != 0; }) - begin;
+}
+
 size_t
 VoxelSet::size () const
 {
-  return _occupancy_map.cols;
+  if (_layout == MORTON_LAYOUT)
+    return (_x_size * _y_size * _z_size != 0) ? (size_t(1) << _morton_bits) : 0;
+  return _x_size * _y_size * _z_size;
+}
+
+bool
+VoxelSet::valid_index(const size_t idx) const
+{
+    if (_layout == MORTON_LAYOUT)
+        return idx < size() &&
+               extract_bits(idx, _morton_mask[0]) < _x_size &&
+               extract_bits(idx, _morton_mask[1]) < _y_size &&
+               extract_bits(idx, _morton_mask[2]) < _z_size;
+    return idx < size();
+}
+
+VoxelLayout
+VoxelSet::layout() const
+{
+    return _layout;
 }
 
 size_t
@@ -105,20 +361,126 @@ const Voxel& VoxelSet::bounding_cuve() const
   return _bcuve;
 }
 
+VoxelStorage
+VoxelSet::storage() const
+{
+    return _storage;
+}
+
 cv::uint8_t*
 VoxelSet::data()
 {
+    if (_storage == BIT_STORAGE)
+        return _occupancy_bits.empty() ? nullptr :
+               reinterpret_cast<cv::uint8_t*>(&_occupancy_bits[0]);
     return _occupancy_map.data;
 }
 
 const cv::uint8_t*
 VoxelSet::data() const
 {
+    if (_storage == BIT_STORAGE)
+        return _occupancy_bits.empty() ? nullptr :
+               reinterpret_cast<const cv::uint8_t*>(&_occupancy_bits[0]);
     return _occupancy_map.data;
 }
 
 static std::string voxelset_signature = "voxelset";
 
+/** @brief Number of voxels (de)compressed at once. It must be a multiple of 64. */
+static const size_t zlib_chunk = 1 << 16;
+
+/** @brief Get the number of voxels saved in the file (linear order without padding). */
+static size_t
+linear_size(const VoxelSet& vs)
+{
+    return vs.x_size() * vs.y_size() * vs.z_size();
+}
+
+/** @brief Get the occupancy of voxels [begin, end) as one byte per voxel.
+ * The range is given in linear order whatever the layout of the voxelset is.
+ */
+static void
+get_occupancy_bytes(const VoxelSet& vs, const size_t begin, const size_t end,
+                    Bytef* bytes)
+{
+    if (vs.layout() == MORTON_LAYOUT)
+    {
+        size_t x = begin % vs.x_size();
+        size_t y = (begin / vs.x_size()) % vs.y_size();
+        size_t z = begin / (vs.x_size() * vs.y_size());
+        for (size_t i = begin; i < end; ++i)
+        {
+            bytes[i - begin] = vs.occupancy(x, y, z);
+            if (++x == vs.x_size())
+            {
+                x = 0;
+                if (++y == vs.y_size())
+                {
+                    y = 0;
+                    ++z;
+                }
+            }
+        }
+        return;
+    }
+    if (vs.storage() == BYTE_STORAGE)
+    {
+        std::memcpy(bytes, vs.data() + begin, end - begin);
+        return;
+    }
+    for (size_t w = begin / 64; w * 64 < end; ++w)
+    {
+        const std::uint64_t bits = vs.occupancy_word(w);
+        const size_t w_end = std::min(end, w * 64 + 64);
+        for (size_t i = w * 64; i < w_end; ++i)
+            bytes[i - begin] = (bits >> (i & 63)) & 1;
+    }
+}
+
+/** @brief Set the occupancy of voxels [begin, end) from one byte per voxel.
+ * The range is given in linear order whatever the layout of the voxelset is.
+ */
+static void
+set_occupancy_bytes(VoxelSet& vs, const size_t begin, const size_t end,
+                    const Bytef* bytes)
+{
+    if (vs.layout() == MORTON_LAYOUT)
+    {
+        size_t x = begin % vs.x_size();
+        size_t y = (begin / vs.x_size()) % vs.y_size();
+        size_t z = begin / (vs.x_size() * vs.y_size());
+        for (size_t i = begin; i < end; ++i)
+        {
+            vs.set_occupancy(x, y, z, bytes[i - begin] != 0);
+            if (++x == vs.x_size())
+            {
+                x = 0;
+                if (++y == vs.y_size())
+                {
+                    y = 0;
+                    ++z;
+                }
+            }
+        }
+        return;
+    }
+    if (vs.storage() == BYTE_STORAGE)
+    {
+        std::memcpy(vs.data() + begin, bytes, end - begin);
+        return;
+    }
+    for (size_t w = begin / 64; w * 64 < end; ++w)
+    {
+        std::uint64_t bits = 0;
+        const size_t w_end = std::min(end, w * 64 + 64);
+        for (size_t i = w * 64; i < w_end; ++i)
+            if (bytes[i - begin])
+                bits |= std::uint64_t(1) << (i & 63);
+        vs.set_occupancy_word(w, bits);
+    }
+}
+
 std::ostream&
 operator<<(std::ostream& out, const VoxelSet& vs)
 {
@@ -130,16 +492,40 @@ operator<<(std::ostream& out, const VoxelSet& vs)
   out << "ysize = " << vs.y_size()<< std::endl;
   out << "zsize = " << vs.z_size()<< std::endl;
   out.unsetf(std::ios::scientific);
-  uLong sourceLen = vs.size();
-  uLongf destLen = compressBound(sourceLen);
-  std::valarray<Bytef> dest (destLen+1);
-  dest[0]='#';
-  int error;
-  if ((error=compress(reinterpret_cast<Bytef*>(&(dest[1])), &destLen,
-                      reinterpret_cast<const Bytef *>(vs.data()), sourceLen))!=Z_OK)
+
+  //The format is always one byte per voxel, but it is compressed by chunks
+  //so a bit packed occupancy map is never fully unpacked.
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  if (deflateInit(&strm, Z_DEFAULT_COMPRESSION)!=Z_OK)
     throw std::runtime_error("ZLIB error");
-  out << "BinarySize = " << destLen << std::endl;
-  out.write(reinterpret_cast<const char *>(&dest[0]), destLen+1);
+  std::vector<Bytef> chunk(zlib_chunk);
+  std::vector<Bytef> zbuf(zlib_chunk);
+  std::vector<Bytef> dest(1, '#');
+  for (size_t begin = 0; ; begin += zlib_chunk)
+  {
+    const size_t end = std::min(linear_size(vs), begin + zlib_chunk);
+    get_occupancy_bytes(vs, begin, end, &chunk[0]);
+    strm.next_in = &chunk[0];
+    strm.avail_in = end - begin;
+    const int flush = (end == linear_size(vs)) ? Z_FINISH : Z_NO_FLUSH;
+    do
+    {
+      strm.next_out = &zbuf[0];
+      strm.avail_out = zbuf.size();
+      if (deflate(&strm, flush) == Z_STREAM_ERROR)
+      {
+        deflateEnd(&strm);
+        throw std::runtime_error("ZLIB error");
+      }
+      dest.insert(dest.end(), zbuf.begin(), zbuf.end() - strm.avail_out);
+    } while (strm.avail_out == 0);
+    if (end == linear_size(vs))
+      break;
+  }
+  deflateEnd(&strm);
+  out << "BinarySize = " << dest.size()-1 << std::endl;
+  out.write(reinterpret_cast<const char *>(&dest[0]), dest.size());
   return out;
 }
 
@@ -149,7 +535,9 @@ operator>>(std::istream& in, VoxelSet& vs)
     std::string signature;
     in >> signature;
     std::string key, sep;
-    if (!in && signature!=voxelset_signature)
+    if (in && signature=="voxelbricks")
+        throw std::runtime_error("Wrong Input Format: bricked voxelset (see load_voxelset()).");
+    if (!in || signature!=voxelset_signature)
         throw std::runtime_error("Wrong Input Format: signature.");
     float vsize;
     in >> key >> sep >> vsize;
@@ -187,17 +575,38 @@ operator>>(std::istream& in, VoxelSet& vs)
     if (!in)
         throw std::runtime_error("Wrong Input Format: raw data");
 
-    vs.reset(bcuve, vsize);
+    vs.reset(bcuve, vsize, false);
     if (vs.x_size()!=xsize ||
             vs.y_size()!=ysize ||
             vs.z_size()!=zsize)
         throw std::runtime_error("Wrong Input Format: wrong dimensions.");
-    uLongf destLen = sizeof(float)*xsize*ysize*zsize;
 
-    int error;
-    if ((error=uncompress(reinterpret_cast<Bytef*>(vs.data()), &destLen,
-                          reinterpret_cast<const Bytef*>(&source[0]),
-                          sourceLen))!=Z_OK)
+    //Uncompress by chunks of one byte per voxel.
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm)!=Z_OK)
+        throw std::runtime_error("Wrong Input Format: ZLIB uncompress error.");
+    strm.next_in = &source[0];
+    strm.avail_in = sourceLen;
+    std::vector<Bytef> chunk(zlib_chunk);
+    int error = Z_OK;
+    for (size_t begin = 0; begin < linear_size(vs) && error == Z_OK; begin += zlib_chunk)
+    {
+        const size_t end = std::min(linear_size(vs), begin + zlib_chunk);
+        strm.next_out = &chunk[0];
+        strm.avail_out = end - begin;
+        while (strm.avail_out > 0 && error == Z_OK)
+            error = inflate(&strm, Z_NO_FLUSH);
+        if (strm.avail_out > 0)
+            break;
+        set_occupancy_bytes(vs, begin, end, &chunk[0]);
+        if (error == Z_STREAM_END && end < linear_size(vs))
+            error = Z_DATA_ERROR;
+        else if (error == Z_STREAM_END)
+            error = Z_OK;
+    }
+    inflateEnd(&strm);
+    if (error != Z_OK || strm.avail_out > 0)
         throw std::runtime_error("Wrong Input Format: ZLIB uncompress error.");
     return in;
 }
@@ -225,13 +634,10 @@ save_as_pointcloud_WRML (std::ostream& out, const VoxelSet& vs,
   out << "      {\n";
   out << "        point\n";
   out << "          [\n";
-  for (size_t v=0; v<vs.size() ;++v)
+  for (size_t v=vs.next_occupied(0); v<vs.size(); v=vs.next_occupied(v+1))
   {
-    if ( vs.occupancy(v) )
-    {
-      cv::Mat pos3d=vs.voxel(v).center();
-      out << pos3d.at<float>(0) << ' ' << pos3d.at<float>(1) << ' ' << pos3d.at<float>(2) << std::endl;
-    }
+    cv::Mat pos3d=vs.voxel(v).center();
+    out << pos3d.at<float>(0) << ' ' << pos3d.at<float>(1) << ' ' << pos3d.at<float>(2) << std::endl;
   }
   out << "         ]\n";
   out << "      }\n";
@@ -241,24 +647,154 @@ save_as_pointcloud_WRML (std::ostream& out, const VoxelSet& vs,
 }
 
 bool
-VoxelSet::is_external(const size_t idx) const
+VoxelSet::is_external(const size_t idx, const int connectivity) const
 {
     CV_Assert (idx<size());
     size_t x,y,z;
     index2xyz(idx, x, y, z);
-    return is_external(x, y, z);
+    return is_external(x, y, z, connectivity);
+}
+
+/** @brief Number of 64 bits words of a row of voxels. */
+static size_t
+row_words(const VoxelSet& vs)
+{
+    return (vs.x_size() + 63) / 64;
+}
+
+/** @brief Get the occupancy of the row (y, z) as a bit mask (bit x is voxel x). */
+static void
+get_row_bits(const VoxelSet& vs, const size_t y, const size_t z,
+             std::uint64_t* row)
+{
+    const size_t n_w = row_words(vs);
+    std::fill(row, row + n_w, std::uint64_t(0));
+    if (vs.layout() == MORTON_LAYOUT)
+    {
+        for (size_t x = 0; x < vs.x_size(); ++x)
+            if (vs.occupancy(x, y, z))
+                row[x >> 6] |= std::uint64_t(1) << (x & 63);
+        return;
+    }
+    //The row is a run of x_size bits from idx0 not aligned to words.
+    const size_t idx0 = vs.xyz2index(0, y, z);
+    const size_t off = idx0 & 63;
+    for (size_t k = 0; k < n_w; ++k)
+    {
+        const size_t w = (idx0 >> 6) + k;
+        std::uint64_t bits = vs.occupancy_word(w) >> off;
+        if (off && w + 1 < vs.n_words())
+            bits |= vs.occupancy_word(w + 1) << (64 - off);
+        row[k] = bits;
+    }
+    const size_t tail = vs.x_size() & 63;
+    if (tail)
+        row[n_w - 1] &= (std::uint64_t(1) << tail) - 1;
 }
 
+/** @brief AND a row with its x-1 and x+1 shifted copies (out of the row is empty). */
+static void
+and_x_neighbours(const std::uint64_t* row, const size_t n_w, std::uint64_t* dst)
+{
+    for (size_t k = 0; k < n_w; ++k)
+    {
+        const std::uint64_t prev = (row[k] << 1) | (k > 0 ? row[k - 1] >> 63 : 0);
+        const std::uint64_t next = (row[k] >> 1) | (k + 1 < n_w ? row[k + 1] << 63 : 0);
+        dst[k] &= row[k] & prev & next;
+    }
+}
+
+void
+compute_external_voxels(const VoxelSet& vs, VoxelSet& external,
+                        const int connectivity)
+{
+    CV_Assert(connectivity == 6 || connectivity == 26);
+    external = VoxelSet(vs.bounding_cuve(), vs.vsize(), false, BIT_STORAGE,
+                        vs.layout());
+    CV_Assert(external.x_size() == vs.x_size() &&
+              external.y_size() == vs.y_size() &&
+              external.z_size() == vs.z_size());
+    const size_t n_w = row_words(vs);
+    const size_t ny = vs.y_size();
+    if (n_w == 0 || ny == 0 || vs.z_size() == 0)
+        return;
+    //Planes z-1, z, z+1 with an empty row before and after each one, so
+    //the rows out of the voxelset are empty.
+    const size_t plane_words = (ny + 2) * n_w;
+    std::vector<std::uint64_t> planes(3 * plane_words, 0);
+    std::uint64_t* prev = &planes[0];
+    std::uint64_t* curr = prev + plane_words;
+    std::uint64_t* next = curr + plane_words;
+    for (size_t y = 0; y < ny; ++y)
+        get_row_bits(vs, y, 0, curr + (y + 1) * n_w);
+
+    for (size_t z = 0; z < vs.z_size(); ++z)
+    {
+        if (z + 1 < vs.z_size())
+        {
+#pragma omp parallel for
+            for (size_t y = 0; y < ny; ++y)
+                get_row_bits(vs, y, z + 1, next + (y + 1) * n_w);
+        }
+        else
+            std::fill(next, next + plane_words, std::uint64_t(0));
+
+        //One row mask per thread, reused for all its rows.
+#pragma omp parallel
+        {
+            std::vector<std::uint64_t> inner(n_w);
+#pragma omp for
+            for (size_t y = 0; y < ny; ++y)
+            {
+                std::fill(inner.begin(), inner.end(), ~std::uint64_t(0));
+                const std::uint64_t* occ = curr + (y + 1) * n_w;
+                if (connectivity == 6)
+                {
+                    and_x_neighbours(occ, n_w, &inner[0]);
+                    const std::uint64_t* rows[4] = {occ - n_w, occ + n_w,
+                                                    prev + (y + 1) * n_w,
+                                                    next + (y + 1) * n_w};
+                    for (int r = 0; r < 4; ++r)
+                        for (size_t k = 0; k < n_w; ++k)
+                            inner[k] &= rows[r][k];
+                }
+                else
+                {
+                    const std::uint64_t* planes_zyx[3] = {prev, curr, next};
+                    for (int dz = 0; dz < 3; ++dz)
+                        for (int dy = 0; dy < 3; ++dy)
+                            and_x_neighbours(planes_zyx[dz] + (y + dy) * n_w, n_w,
+                                             &inner[0]);
+                }
+                for (size_t k = 0; k < n_w; ++k)
+                {
+                    std::uint64_t ext = occ[k] & ~inner[k];
+                    while (ext)
+                    {
+                        const size_t x = k * 64 + __builtin_ctzll(ext);
+                        external.set_occupancy(x, y, z, true);
+                        ext &= ext - 1;
+                    }
+                }
+            }
+        }
+        std::uint64_t* tmp = prev;
+        prev = curr;
+        curr = next;
+        next = tmp;
+    }
+}
 
 void save_as_cubes_WRML (std::ostream& out, const VoxelSet& vs,
-            const cv::Scalar & color)
+            const cv::Scalar & color, const int connectivity)
 {
+    VoxelSet external;
+    compute_external_voxels(vs, external, connectivity);
     out << "#VRML V2.0 utf8\n";
-    for (size_t v=0; v<vs.size() ;++v)
+    for (size_t v=external.next_occupied(0); v<external.size();
+         v=external.next_occupied(v+1))
     {
-      if ( vs.occupancy(v) && vs.is_external(v))
-      {
-        cv::Mat pos3d=vs.voxel(v).center();
+        cv::Mat pos3d=external.voxel(v).center();
         out << "Transform {\n";
         out << "  translation " <<  pos3d.at<float>(0) << ' ' << pos3d.at<float>(1) << ' ' << pos3d.at<float>(2) << std::endl;
         out << "  children Shape {\n";
@@ -266,7 +802,6 @@ void save_as_cubes_WRML (std::ostream& out, const VoxelSet& vs,
         out << "     geometry Box { size " << vs.vsize() << ' ' << vs.vsize() << ' ' << vs.vsize() << " }\n";
         out << "  }\n";
         out << "}\n";
-      }
     }
 }
 
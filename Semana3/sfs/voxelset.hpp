@@ -1,5 +1,7 @@
 #pragma once
 #include <iostream>
+#include <vector>
+#include <cstdint>
 #include <opencv2/core.hpp>
 
 #include "voxel.hpp"
@@ -7,23 +9,55 @@
 namespace fsiv
 {
 
+/** @brief Storage backends for the occupancy map of a voxelset. */
+typedef enum {
+    BYTE_STORAGE=0, //one byte per voxel.
+    BIT_STORAGE=1   //one bit per voxel packed in 64 bits words.
+} VoxelStorage;
+
+/** @brief Orders of the voxels in the 1D index. */
+typedef enum {
+    LINEAR_LAYOUT=0, //idx = z*xsize*ysize + y*xsize + x.
+    MORTON_LAYOUT=1  //Z-order: the bits of x,y,z are interleaved.
+} VoxelLayout;
+
+/** @brief Precision of the OAR scores channel of a voxelset. */
+typedef enum {
+    NO_SCORES=0,  //the voxelset has not scores.
+    SCORES_8U=1,  //8 bits per voxel (steps of 1/255).
+    SCORES_16U=2  //16 bits per voxel (steps of 1/65535).
+} ScoreDepth;
 
 /**
  * @brief The Voxelset class.
  *
  * Models a discretized volumen of 3D space where each piece is a voxel.
+ *
+ * With MORTON_LAYOUT the spatial neighbours of a voxel are near in memory
+ * and a 2x2x2 block of voxels is a run of 8 indices, as the octants of an
+ * octree. The index space is padded to a power of two on each axis, so
+ * size() may be greater than x_size()*y_size()*z_size(): the padding
+ * indices are not valid_index() and they are never occupied.
  */
 class VoxelSet
 {
 public:
 
     VoxelSet ();
-    VoxelSet(const Voxel& bc, const float vsize, const bool init_occ_state=true);
+
+    /** @brief Create an empty voxelset using a given storage backend and layout. */
+    explicit VoxelSet (const VoxelStorage storage,
+                       const VoxelLayout layout=LINEAR_LAYOUT);
+
+    VoxelSet(const Voxel& bc, const float vsize, const bool init_occ_state=true,
+             const VoxelStorage storage=BYTE_STORAGE,
+             const VoxelLayout layout=LINEAR_LAYOUT);
 
     bool empty();
 
     /**
      * @brief set voxel set attributes.
+     * The storage backend and the layout are kept.
      * @arg[in] bc define the 3D volumen represented.
      * @arg[in] vsize define the size of the voxel in wcs units.
      * @arg[in] init_occ_state is the initial state of occupancy for the voxels.
@@ -36,6 +70,11 @@ public:
     /** @brief convert from 1D index to x,y,z indexes. **/
     void index2xyz (const size_t index, size_t& x, size_t& y, size_t& z) const;
 
+    /** @brief test if a 1D index corresponds to a voxel of the set.
+     * It is false for the padding indices of the Morton layout.
+     **/
+    bool valid_index (const size_t idx) const;
+
     /** @brief Get a voxel.*/
     Voxel voxel(const size_t idx) const;
 
@@ -48,25 +87,86 @@ public:
     /** @brief get the occupancy value. **/
     bool occupancy(const size_t x, const size_t y, const size_t z) const;
 
-    /** @brief set the occupancy value. **/
+    /** @brief set the occupancy value.
+     * It is safe to call it concurrently for different voxels.
+     **/
     void set_occupancy(const size_t idx, const bool new_v);
 
     /** @brief set the occupancy value. **/
     void set_occupancy(const size_t x, const size_t y, const size_t z, const bool new_v);
 
+    /** @brief set the occupancy value of the voxels in the range [begin, end). **/
+    void fill_occupancy(const size_t begin, const size_t end, const bool new_v);
+
+    /** @brief get the occupancy of the voxels [64*w, 64*w+64) as a bit mask.
+     * Bit i is the occupancy of voxel 64*w+i (zero beyond size()).
+     **/
+    std::uint64_t occupancy_word(const size_t w) const;
+
+    /** @brief set the occupancy of the voxels [64*w, 64*w+64) from a bit mask. **/
+    void set_occupancy_word(const size_t w, const std::uint64_t bits);
+
+    /** @brief get the number of 64 voxels words. **/
+    size_t n_words() const;
+
+    /** @brief get the number of occupied voxels. **/
+    size_t count_occupied() const;
+
+    /** @brief get the index of the first occupied voxel with index >= idx.
+     * @return the index or size() if there is not any one.
+     **/
+    size_t next_occupied(const size_t idx) const;
+
     /**
      * @brief test if a voxel is external.
      * A voxel is considered external if it is in the limits of the voxelset or
      * any of its neighbors voxels is not occupied.
+     * @param connectivity is 6 (face neighbours) or 26.
+     * \see compute_external_voxels() to test all the voxels at once.
      */
-    bool is_external(size_t idx) const;
+    bool is_external(size_t idx, const int connectivity=26) const;
 
     /**
      * @brief test if a voxel is external.
      * A voxel is considered external if it is in the limits of the voxelset or
      * any of its neighbors voxels is not occupied.
+     * @param connectivity is 6 (face neighbours) or 26.
+     * \see compute_external_voxels() to test all the voxels at once.
      */
-    bool is_external(const size_t x, const size_t y, const size_t z) const;
+    bool is_external(const size_t x, const size_t y, const size_t z,
+                     const int connectivity=26) const;
+
+    /** @brief set the precision of the scores channel.
+     * The scores keep the minimum OAR of each voxel over the views, quantized
+     * in [0, 1], so the occupancy can be recomputed for other thresholds
+     * (see apply_threshold()). The scores are set to 1 (0 for the padding).
+     * NO_SCORES releases the channel.
+     **/
+    void set_score_depth(const ScoreDepth depth);
+
+    /** @brief get the precision of the scores channel. **/
+    ScoreDepth score_depth() const;
+
+    /** @brief test if the voxelset has a scores channel. **/
+    bool has_scores() const;
+
+    /** @brief get the score of a voxel in [0, 1]. **/
+    float score(const size_t idx) const;
+
+    /** @brief set the score of a voxel (clamped to [0, 1] and quantized).
+     * It is safe to call it concurrently for different voxels.
+     **/
+    void set_score(const size_t idx, const float oar);
+
+    /**
+     * @brief set the occupancy of all the voxels from their scores.
+     * A voxel is occupied if its quantized score is not less than the
+     * quantized threshold, so a voxel whose exact OAR passes the threshold is
+     * never carved. The scores are compared in one pass, 64 voxels per word
+     * with BIT_STORAGE.
+     * @return the number of occupied voxels.
+     **/
+    size_t apply_threshold(const float OAR_th);
 
     /** @brief get the discritized size on X axis. **/
     size_t x_size () const;
@@ -77,7 +177,7 @@ public:
     /** @brief get the discritized size on Z axis. **/
     size_t z_size () const;
 
-    /** @brief get the discritized size as 1D array. **/
+    /** @brief get the discritized size as 1D array (including the padding). **/
     size_t size () const;
 
     /** @brief get the side voxel size in WCS units. **/
@@ -86,10 +186,20 @@ public:
     /** @brief get the 3D space volumen represented by the voxel set. **/
     const Voxel& bounding_cuve() const;
 
-    /** @brief get raw data of occupancy **/
+    /** @brief get the storage backend. **/
+    VoxelStorage storage() const;
+
+    /** @brief get the layout of the 1D index. **/
+    VoxelLayout layout() const;
+
+    /** @brief get raw data of occupancy
+     * \warning the layout depends on the storage backend.
+     **/
     const cv::uint8_t* data() const;
 
-    /** @brief get raw data of occupancy **/
+    /** @brief get raw data of occupancy
+     * \warning the layout depends on the storage backend.
+     **/
     cv::uint8_t* data();
 
 private:
@@ -100,7 +210,15 @@ private:
     size_t _y_size;
     size_t _z_size;
     size_t _xy_size;
+    VoxelStorage _storage;
+    VoxelLayout _layout;
+    size_t _morton_bits; //total bits of the morton index.
+    std::uint64_t _morton_mask[3]; //bits of x, y, z in the morton index.
+    std::vector<std::uint64_t> _morton_x, _morton_y, _morton_z; //encoding LUTs.
     cv::Mat _occupancy_map; //Array de 3 dimensiones
+    std::vector<std::uint64_t> _occupancy_bits; //used with BIT_STORAGE.
+    ScoreDepth _score_depth;
+    cv::Mat _scores; //CV_8UC1 or CV_16UC1, 1 x size().
 };
 
 /** @brief Save a voxelset from a file. **/
@@ -115,10 +233,25 @@ std::istream& operator>>(std::istream& in, VoxelSet& vs);
 void save_as_pointcloud_WRML (std::ostream& out, const VoxelSet& vs,
             const cv::Scalar & color=cv::Scalar(255, 255, 255));
 
+/**
+ * @brief Compute the external voxels of a voxelset in one sweep.
+ * An occupied voxel is external if it is in the limits of the voxelset or
+ * any of its neighbours is not occupied. The voxelset is processed by rows
+ * of 64 voxels per word, testing a row against its shifted neighbour rows
+ * of the adjacent rows and planes (only three planes are unpacked at once).
+ * @param[in] vs is the voxelset.
+ * @param[out] external is a voxelset (bit storage) with the same geometry and
+ *  layout as vs whose occupied voxels are the external ones.
+ * @param[in] connectivity is 6 (face neighbours) or 26 (face, edge and corner ones).
+ */
+void compute_external_voxels(const VoxelSet& vs, VoxelSet& external,
+                             const int connectivity=26);
+
 /** @brief Save a voxelset as set of 3d cubes in vrml 2.0 format
  * \warning only external cubes are saved. **/
 void save_as_cubes_WRML (std::ostream& out, const VoxelSet& vs,
-            const cv::Scalar & color=cv::Scalar(255, 255, 255));
+            const cv::Scalar & color=cv::Scalar(255, 255, 255),
+            const int connectivity=26);
 
 
 } //namespacde fsiv
@@ -0,0 +1,121 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<cstdlib>
+#include<stdexcept>
+#include<algorithm>
+#include <opencv2/core.hpp>
+#include "sfs.hpp"
+
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{stl            |      | save in binary stl format instead of binary ply.}"
+    "{buffer         |4     | size in MB of the write buffer.}"
+    "{bits           |      | Use a bit packed occupancy map.}"
+    "{morton         |      | Use a Z-order layout for the voxels.}"
+    "{mc             |      | save a marching cubes surface (binary ply with triangles).}"
+    "{iso            |0.5   | iso level of the marching cubes surface.}"
+    "{@input         |<none>| input voxel set data.}"
+    "{@output        |<none>| output .ply/.stl file.}"
+    ;
+
+int
+main (int argc, char* const* argv)
+{
+  int retCode=EXIT_SUCCESS;
+
+  try
+  {
+      cv::CommandLineParser parser(argc, argv, keys);
+      parser.about("Save the surface of a visual hull as a binary mesh.");
+      if (parser.has("help"))
+      {
+          parser.printMessage();
+          return 0;
+      }
+
+      fsiv::VoxelSet vs(parser.has("bits") ? fsiv::BIT_STORAGE : fsiv::BYTE_STORAGE,
+                        parser.has("morton") ? fsiv::MORTON_LAYOUT : fsiv::LINEAR_LAYOUT);
+      std::ifstream input (parser.get<std::string>("@input"));
+      if (!input)
+      {
+          std::cerr << "Error: could not open the file ["
+                    <<parser.get<std::string>("@input")
+                   << "] to read." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::ofstream output(parser.get<std::string>("@output"), std::ios::binary);
+      if (!output)
+      {
+          std::cerr << "Error: could not open the file ["
+                    <<parser.get<std::string>("@output")
+                   << "] to write." << std::endl;
+          return EXIT_FAILURE;
+      }
+      if (parser.has("mc"))
+      {
+          int64_t t0 = cv::getTickCount();
+          bool ok = false;
+          //A bricked voxelset is streamed, so it is never fully inflated.
+          if (fsiv::is_bricked_file(parser.get<std::string>("@input")))
+          {
+              fsiv::BrickedVoxelSet bvs;
+              if (!bvs.open(parser.get<std::string>("@input")))
+              {
+                  std::cerr << "Error: could not open the file ["
+                            << parser.get<std::string>("@input") << "] to read." << std::endl;
+                  return EXIT_FAILURE;
+              }
+              ok = fsiv::save_marching_cubes(output, bvs, parser.get<float>("iso"));
+          }
+          else
+          {
+              input >> vs;
+              ok = fsiv::save_marching_cubes(output, vs, parser.get<float>("iso"));
+          }
+          if (!ok)
+          {
+              std::cerr << "Error: could not write the mesh." << std::endl;
+              return EXIT_FAILURE;
+          }
+          std::cout << "Marching cubes: " << (cv::getTickCount()-t0)/cv::getTickFrequency()
+                    << " s" << std::endl;
+          return EXIT_SUCCESS;
+      }
+      input.close();
+      if (!fsiv::load_voxelset(parser.get<std::string>("@input"), vs))
+      {
+          std::cerr << "Error: could not open the file ["
+                    << parser.get<std::string>("@input") << "] to read." << std::endl;
+          return EXIT_FAILURE;
+      }
+      std::vector<char> buffer(size_t(std::max(1, parser.get<int>("buffer"))) << 20);
+      int64_t t0 = cv::getTickCount();
+      fsiv::QuadMesh mesh;
+      fsiv::compute_mesh(vs, mesh);
+      const double t_mesh = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      t0 = cv::getTickCount();
+      if (!fsiv::save_mesh(output, mesh,
+                           parser.has("stl") ? fsiv::STL_FORMAT : fsiv::PLY_FORMAT,
+                           &buffer[0], buffer.size()))
+      {
+          std::cerr << "Error: could not write the mesh." << std::endl;
+          return EXIT_FAILURE;
+      }
+      const double t_write = (cv::getTickCount()-t0)/cv::getTickFrequency();
+      std::cout << "Quads: " << mesh.quads.size() << " meshing: " << t_mesh
+                << " s writing: " << t_write << " s" << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Capturada excepcion: " << e.what() << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cerr << "Capturada excepcion desconocida!" << std::endl;
+    retCode = EXIT_FAILURE;
+  }
+  return retCode;
+}
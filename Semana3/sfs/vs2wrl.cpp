@@ -12,7 +12,9 @@
 const cv::String keys =
     "{help h usage ? |      | print this message.}"
     "{cubes          |      | save only externals voxels.}"
-    "{@input         |<none>| input voxel set data.}"
+    "{bits           |      | Use a bit packed occupancy map.}"
+    "{morton         |      | Use a Z-order layout for the voxels.}"
+    "{@input         |<none>| input voxel set data (plain or bricked format).}"
     "{@output        |<none>| output .wrl file.}"
     ;
 
@@ -31,7 +33,8 @@ main (int argc, char* const* argv)
           return 0;
       }
 
-      fsiv::VoxelSet vs;
+      fsiv::VoxelSet vs(parser.has("bits") ? fsiv::BIT_STORAGE : fsiv::BYTE_STORAGE,
+                        parser.has("morton") ? fsiv::MORTON_LAYOUT : fsiv::LINEAR_LAYOUT);
       std::ifstream input (parser.get<std::string>("@input"));
       if (!input)
       {
@@ -48,7 +51,25 @@ main (int argc, char* const* argv)
                    << "] to write." << std::endl;
           return EXIT_FAILURE;
       }
-      input >> vs;
+      if (fsiv::is_bricked_file(parser.get<std::string>("@input")))
+      {
+        //Bricked format: the point cloud is streamed brick by brick.
+        fsiv::BrickedVoxelSet bvs;
+        if (!bvs.open(parser.get<std::string>("@input")))
+        {
+          std::cerr << "Error: could not map the file ["
+                    << parser.get<std::string>("@input") << "]." << std::endl;
+          return EXIT_FAILURE;
+        }
+        if (!parser.has("cubes"))
+        {
+          fsiv::save_as_pointcloud_WRML(output, bvs);
+          return EXIT_SUCCESS;
+        }
+        bvs.to_voxelset(vs);
+      }
+      else
+        input >> vs;
       if (parser.has("cubes"))
         fsiv::save_as_cubes_WRML(output, vs);
       else
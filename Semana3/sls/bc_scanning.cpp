@@ -1,9 +1,15 @@
 #include "bc_scanning.hpp"
 #include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include "sls.hpp"
 #include <iostream>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace fsiv
 {
@@ -119,36 +125,213 @@ namespace fsiv
         return decoding;
     }
 
-    /** @brief Convierte de código gray a binario.
-    @warning Ojo sólo para enteros de 32bits.
- */
+    /**
+     * @brief Calcula la tabla de conversión de código Gray a binario.
+     * @param n_bits es el número de bits de los códigos (la tabla tiene 2^n_bits entradas).
+     * @param remove_lsb es el número de bits menos significativos no codificados:
+     *  sólo se capturan los bits Gray altos y cada bit binario es el XOR de
+     *  los bits Gray desde el más significativo hasta él, así los bits bajos
+     *  se dejan a 0.
+     */
+    static std::vector<cv::int16_t>
+    compute_gray_to_binary_table(const int n_bits, const int remove_lsb)
+    {
+        CV_Assert(n_bits >= 0 && n_bits <= 15);
+        std::vector<cv::int16_t> table(size_t(1) << n_bits);
+        const int low_bits = (1 << std::max(0, remove_lsb)) - 1;
+        //binary(g) = g ^ binary(g >> 1), y g >> 1 < g.
+        table[0] = 0;
+        for (size_t g = 1; g < table.size(); ++g)
+            table[g] = cv::int16_t(g ^ table[g >> 1]);
+        for (size_t g = 0; g < table.size(); ++g)
+            table[g] = cv::int16_t(table[g] & ~low_bits);
+        return table;
+    }
+
+    /** @brief Convierte de código Gray a binario.
+     * @param n_bits es el número de bits de los códigos.
+     * @param remove_lsb es el número de bits menos significativos no codificados.
+     */
     static cv::Mat
-    convert_gray_to_binary_code(const cv::Mat &img)
+    convert_gray_to_binary_code(const cv::Mat &img, const int n_bits, const int remove_lsb)
     {
         CV_Assert(img.type() == CV_16SC1);
-        cv::Mat ret = img.clone();
-        for (auto v = ret.begin<cv::int16_t>(); v != ret.begin<cv::int16_t>(); ++v)
+        const std::vector<cv::int16_t> table = compute_gray_to_binary_table(n_bits, remove_lsb);
+        cv::Mat ret(img.rows, img.cols, CV_16SC1);
+        cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range &rows)
         {
-            auto num = *v;
-            num ^= num >> 16;
-            num ^= num >> 8;
-            num ^= num >> 4;
-            num ^= num >> 2;
-            num ^= num >> 1;
-            *v = num;
-        }
+            for (int y = rows.start; y < rows.end; ++y)
+            {
+                const cv::int16_t *src = img.ptr<cv::int16_t>(y);
+                cv::int16_t *dst = ret.ptr<cv::int16_t>(y);
+                for (int x = 0; x < img.cols; ++x)
+                {
+                    CV_Assert(src[x] >= 0 && size_t(src[x]) < table.size());
+                    dst[x] = table[src[x]];
+                }
+            }
+        });
         return ret;
     }
 
+    /** @brief Obtiene una imagen en niveles de gris (las capturas blanca y
+     * negra se guardan en color). */
+    static cv::Mat
+    to_grey(const cv::Mat &img)
+    {
+        if (img.channels() == 1)
+            return img;
+        cv::Mat grey;
+        cv::cvtColor(img, grey, cv::COLOR_BGR2GRAY);
+        return grey;
+    }
+
+    /** @brief Calcula la imagen media de las capturas blanca y negra.
+     * La suma no se satura antes de dividir. */
+    static cv::Mat
+    compute_mean_image(const cv::Mat &pos_img, const cv::Mat &neg_img)
+    {
+        cv::Mat mean_img;
+        cv::addWeighted(to_grey(pos_img), 0.5, to_grey(neg_img), 0.5, 0.0, mean_img);
+        return mean_img;
+    }
+
+    /**
+     * @brief Decodifica una fila de los planos de bit de un eje.
+     * El código de cada pixel se acumula en registros (8 pixeles de 16 bits
+     * por registro SSE2) comparando los planos desde el bit más significativo,
+     * sin imágenes intermedias. El código Gray se pasa a binario a la vez:
+     * cada bit binario es el anterior XOR el bit Gray.
+     * @param pos, neg son las filas de los planos positivo y negativo (o media).
+     * @param n_bits es el número de planos.
+     * @param shift es la posición del bit menos significativo codificado.
+     * @param valid se pone a 0 en los pixeles con |pos-neg| < min_contrast en
+     *  algún plano.
+     */
+    static void
+    decode_code_row(const uchar *const *pos, const uchar *const *neg, const int n_bits,
+                    const int shift, const bool gray, const uchar min_contrast,
+                    const int cols, cv::int16_t *codes, uchar *valid)
+    {
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i th = _mm_set1_epi8(char(min_contrast));
+        const __m128i lsb = _mm_cvtsi32_si128(shift);
+        for (; x + 16 <= cols; x += 16)
+        {
+            __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+            __m128i bit = _mm_setzero_si128();
+            __m128i ok = _mm_loadu_si128(reinterpret_cast<const __m128i *>(valid + x));
+            for (int b = 0; b < n_bits; ++b)
+            {
+                const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos[b] + x));
+                const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i *>(neg[b] + x));
+                //0xFF si p >= n (sin signo).
+                const __m128i g = _mm_cmpeq_epi8(_mm_max_epu8(p, n), p);
+                bit = gray ? _mm_xor_si128(bit, g) : g;
+                lo = _mm_or_si128(_mm_slli_epi16(lo, 1),
+                                  _mm_and_si128(_mm_unpacklo_epi8(bit, bit), one));
+                hi = _mm_or_si128(_mm_slli_epi16(hi, 1),
+                                  _mm_and_si128(_mm_unpackhi_epi8(bit, bit), one));
+                const __m128i diff = _mm_or_si128(_mm_subs_epu8(p, n), _mm_subs_epu8(n, p));
+                ok = _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_max_epu8(diff, th), diff));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + x), _mm_sll_epi16(lo, lsb));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + x + 8), _mm_sll_epi16(hi, lsb));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(valid + x), ok);
+        }
+#endif
+        for (; x < cols; ++x)
+        {
+            int code = 0, bit = 0;
+            bool ok = valid[x] != 0;
+            for (int b = 0; b < n_bits; ++b)
+            {
+                const int g = pos[b][x] >= neg[b][x];
+                bit = gray ? (bit ^ g) : g;
+                code = (code << 1) | bit;
+                ok = ok && std::abs(int(pos[b][x]) - int(neg[b][x])) >= min_contrast;
+            }
+            codes[x] = cv::int16_t(code << shift);
+            valid[x] = ok ? 255 : 0;
+        }
+    }
+
     void
     BinaryCodeScanning::decode_scanning(cv::Mat &x_codes, cv::Mat &y_codes) const
     {
-        cv::Mat mean_img, pos_img, neg_img;
+        cv::Mat valid;
+        decode_scanning(x_codes, y_codes, valid, 0);
+    }
+
+    void
+    BinaryCodeScanning::decode_scanning(cv::Mat &x_codes, cv::Mat &y_codes,
+                                        cv::Mat &valid, int min_contrast) const
+    {
+        CV_Assert(min_contrast >= 0 && min_contrast <= 255);
+        cv::Mat mean_img;
+        if (!use_inverse)
+            mean_img = compute_mean_image(seq[0], seq[1]);
+
+        //Planos positivo y negativo de cada bit, desde el más significativo,
+        //de cada eje: 0 la coordenada y, 1 la coordenada x. Los patrones
+        //empiezan en el índice 2 y el eje y va primero.
+        std::vector<const cv::Mat *> pos[2], neg[2];
+        cv::Mat *codes[2] = {&y_codes, &x_codes};
+        const int msb[2] = {int(std::floor(std::log2(prj_size.height))),
+                            int(std::floor(std::log2(prj_size.width)))};
+        size_t seq_idx = 2;
+        for (int a = 0; a < 2; ++a)
+        {
+            if (axis != a && axis != 2)
+                continue;
+            for (int i = msb[a]; i >= remove_lsb; --i)
+            {
+                CV_Assert(seq_idx + (use_inverse ? 1 : 0) < seq.size());
+                pos[a].push_back(&seq[seq_idx]);
+                neg[a].push_back(use_inverse ? &seq[seq_idx + 1] : &mean_img);
+                seq_idx += use_inverse ? 2 : 1;
+                CV_Assert(pos[a].back()->type() == CV_8UC1 && neg[a].back()->type() == CV_8UC1);
+                CV_Assert(pos[a].back()->size() == seq[0].size() &&
+                          neg[a].back()->size() == seq[0].size());
+            }
+            codes[a]->create(seq[0].rows, seq[0].cols, CV_16SC1);
+        }
+
+        //Cada bloque de filas se decodifica leyendo todos sus planos una vez.
+        valid = cv::Mat(seq[0].rows, seq[0].cols, CV_8UC1, cv::Scalar(255));
+        const int cols = seq[0].cols;
+        cv::parallel_for_(cv::Range(0, seq[0].rows), [&](const cv::Range &rows)
+        {
+            std::vector<const uchar *> pos_rows, neg_rows;
+            for (int y = rows.start; y < rows.end; ++y)
+                for (int a = 0; a < 2; ++a)
+                {
+                    if (axis != a && axis != 2)
+                        continue;
+                    pos_rows.resize(pos[a].size());
+                    neg_rows.resize(neg[a].size());
+                    for (size_t b = 0; b < pos[a].size(); ++b)
+                    {
+                        pos_rows[b] = pos[a][b]->ptr<uchar>(y);
+                        neg_rows[b] = neg[a][b]->ptr<uchar>(y);
+                    }
+                    decode_code_row(pos_rows.data(), neg_rows.data(), int(pos[a].size()),
+                                    remove_lsb, use_gray_code, uchar(min_contrast), cols,
+                                    codes[a]->ptr<cv::int16_t>(y), valid.ptr<uchar>(y));
+                }
+        });
+        CV_Assert(axis == 1 || (x_codes.type() == CV_16SC1 && x_codes.size() == seq[0].size()));
+        CV_Assert(axis == 0 || (y_codes.type() == CV_16SC1 && y_codes.size() == seq[0].size()));
+    }
+
+    void
+    BinaryCodeScanning::decode_scanning_per_plane(cv::Mat &x_codes, cv::Mat &y_codes) const
+    {
+        cv::Mat mean_img;
         //TODO
         //Revisa los atributos de la clase que son necesarios para decodificar.
-        pos_img = seq[0].clone();
-        neg_img = seq[1].clone();
-
 
         //TODO
         //Primero, si la propiedad use_inverse no es cierta, calcula la imagen
@@ -157,7 +340,7 @@ namespace fsiv
         if (!use_inverse)
         {
             //Calculo de la imagen media mediante operaciones vectoriales
-            mean_img = (pos_img + neg_img) / 2;
+            mean_img = compute_mean_image(seq[0], seq[1]);
         }
         //
         CV_Assert(use_inverse || (mean_img.size() == seq[0].size() && mean_img.type() == CV_8UC1));
@@ -210,7 +393,8 @@ namespace fsiv
 
             //
             if (use_gray_code)
-                y_codes = convert_gray_to_binary_code(y_codes);
+                y_codes = convert_gray_to_binary_code(
+                            y_codes, int(std::floor(std::log2(prj_size.height))) + 1, remove_lsb);
         }
 
         if (axis == 1 || axis == 2)
@@ -255,7 +439,8 @@ namespace fsiv
 
             //
             if (use_gray_code)
-                x_codes = convert_gray_to_binary_code(x_codes);
+                x_codes = convert_gray_to_binary_code(
+                            x_codes, int(std::floor(std::log2(prj_size.width))) + 1, remove_lsb);
         }
         //
         CV_Assert(axis == 1 || (x_codes.type() == CV_16SC1 && x_codes.size() == seq[0].size()));
@@ -342,9 +527,12 @@ Returns:
         use_inverse = use_inverse_;
         seq.push_back(cv::Mat(prj_size, CV_8UC1, white_v));
         seq.push_back(cv::Mat(prj_size, CV_8UC1, black_v));
+        //Los planos horizontales (axis 0) codifican la fila y del proyector y
+        //los verticales (axis 1) la columna x, con los bits que decodifica
+        //decode_scanning().
         if (axis == 0 || axis == 2)
         {
-            int plane_bit = int(std::floor(std::log2(prj_size.width)));
+            int plane_bit = int(std::floor(std::log2(prj_size.height)));
             while (plane_bit >= remove_lsb)
             {
                 seq.push_back(create_binary_code_pattern(prj_size, plane_bit, 0,
@@ -359,7 +547,7 @@ Returns:
         }
         if (axis == 1 || axis == 2)
         {
-            int plane_bit = int(std::floor(std::log2(prj_size.height)));
+            int plane_bit = int(std::floor(std::log2(prj_size.width)));
             while (plane_bit >= remove_lsb)
             {
                 seq.push_back(create_binary_code_pattern(prj_size, plane_bit, 1,
@@ -23,6 +23,8 @@ struct BinaryCodeScanning: public ScanningPatternSequence
     bits más significativos.
     Además si use_inverse=True, por cada patrón se genera el inverso.
     Si use_gray_code=true se codifica el código gray en vez del binario puro.
+    Con código Gray dos franjas vecinas sólo difieren en un bit, así un
+    error en el borde de una franja sólo desplaza el código en una unidad.
     */
     BinaryCodeScanning(const cv::Size& prj_size,
                        int axis=0,
@@ -45,6 +47,8 @@ struct BinaryCodeScanning: public ScanningPatternSequence
     bits más significativos.
     Además si use_inverse=True, por cada patrón se genera el inverso.
     Si use_gray_code=True se codifica el código gray en vez del binario puro.
+    Con código Gray dos franjas vecinas sólo difieren en un bit, así un
+    error en el borde de una franja sólo desplaza el código en una unidad.
     */
     static std::shared_ptr<BinaryCodeScanning> create(const cv::Size& prj_size,
                                                       int axis=0,
@@ -59,13 +63,36 @@ struct BinaryCodeScanning: public ScanningPatternSequence
     /** @brief Guarda la secuencia en un fichero **/
     virtual bool save(const std::string& fname) const;
 
+    /** @brief Descodifica el escaneo.
+     * @see decode_scanning(cv::Mat&, cv::Mat&, cv::Mat&, int) const
+     */
     virtual void decode_scanning(cv::Mat & x_codes, cv::Mat& y_codes) const;
 
+    /**
+     * @brief Descodifica el escaneo leyendo todos los planos capturados en una
+     * sola pasada por bloque de filas.
+     *
+     * El código de cada pixel se acumula en registros (SSE2) comparando el
+     * patrón positivo con el negativo (o la imagen media) de cada bit, y el
+     * código Gray se pasa a binario a la vez, así sólo se escriben una vez
+     * los códigos y la máscara de validez.
+     * @param valid es una máscara 0|255, 0 si en algún plano |pos - neg| < min_contrast.
+     * @param min_contrast es la diferencia mínima entre el patrón positivo y el
+     *  negativo de cada bit para considerar válido un pixel.
+     */
+    void decode_scanning(cv::Mat & x_codes, cv::Mat& y_codes, cv::Mat& valid,
+                         int min_contrast=0) const;
+
+    /** @brief Descodifica el escaneo plano a plano (una imagen por bit).
+     * Da el mismo resultado que decode_scanning(), sirve como referencia.
+     */
+    void decode_scanning_per_plane(cv::Mat & x_codes, cv::Mat& y_codes) const;
+
     int axis; /*!< which axis: 0:vertical, 1:horizontal, 2->both. */
     cv::Size prj_size; /*!< projector image size WxH.*/
     int remove_lsb; /*!< number of lsb bits which are not codified.*/
     bool use_inverse; /*!< Is there a inverse image for each pattern?.*/
-    bool use_gray_code; /*!< the patterns codify binary gray code. NI CASO*/
+    bool use_gray_code; /*!< the patterns codify binary gray code.*/
 };
 
 /** @brief Carga un escaneo desde fichero. **/
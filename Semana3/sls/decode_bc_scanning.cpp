@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <exception>
+#include <limits>
 
 //Includes para OpenCV, Descomentar según los módulo utilizados.
 #include <opencv2/core/core.hpp>
@@ -15,6 +16,9 @@ const cv::String keys =
     "{help h usage ? |      | print this message   }"
     "{v verbose      |0     | Verbose level. Value 0 means not log.}"
     "{a axis         |0     | Axis to decode 0:Y, 1:X, 2:both.}"
+    "{cache          |      | Triangulation tables cache file (rebuilt if the calibration changes).}"
+    "{min_contrast   |0     | Minimum difference between the positive and negative image of every bit.}"
+    "{max_ray_dist   |0     | Axis 2: discard the points whose camera and projector rays are farther (0 no limit).}"
     "{@cparams       |<none>| Calibration parameters.}"
     "{@scanning      |<none>| Scanning.}"
     "{@output        |<none>| output wrl file.}"
@@ -46,9 +50,22 @@ main (int argc, char* const* argv)
             return EXIT_FAILURE;
         }
 
-        fsiv::CParams cparams;
-        if (!fsiv::load_calibration_parameters_from_file(
-                    parser.get<std::string>("@cparams"), cparams))
+        //The triangulation tables only depend on the calibration.
+        fsiv::TriangulationTables tables;
+        bool was_ok;
+        if (parser.has("cache"))
+            was_ok = fsiv::load_triangulation_tables_cached(
+                        parser.get<std::string>("@cparams"),
+                        parser.get<std::string>("cache"), tables);
+        else
+        {
+            fsiv::CParams cparams;
+            was_ok = fsiv::load_calibration_parameters_from_file(
+                        parser.get<std::string>("@cparams"), cparams);
+            if (was_ok)
+                fsiv::compute_triangulation_tables(cparams, tables);
+        }
+        if (!was_ok)
         {
             std::cerr << "Error: could not read the calibrations parameters from file ["
                       << parser.get<std::string>("@cparams") << "]." << std::endl;
@@ -76,8 +93,11 @@ main (int argc, char* const* argv)
             cv::destroyWindow("MASK");
         }
 
-        cv::Mat x_codes_, y_codes_;
-        sc->decode_scanning(x_codes_, y_codes_);
+        cv::Mat x_codes_, y_codes_, valid;
+        auto bc_scan = std::dynamic_pointer_cast<fsiv::BinaryCodeScanning>(sc);
+        bc_scan->decode_scanning(x_codes_, y_codes_, valid,
+                                 parser.get<int>("min_contrast"));
+        cv::bitwise_and(mask, valid, mask);
 
         cv::Mat x_codes=cv::Mat::zeros(x_codes_.size(), x_codes_.type());
         cv::Mat y_codes=cv::Mat::zeros(y_codes_.size(), y_codes_.type());
@@ -99,14 +119,23 @@ main (int argc, char* const* argv)
         cv::Mat XYZ;        
         if (axis==0)
         {
-            XYZ = fsiv::compute_line_plane_triangulation(y_codes, axis, cparams, mask);
+            XYZ = fsiv::compute_line_plane_triangulation(y_codes, axis, tables, mask);
         }
         else if (axis==1)
         {
-            XYZ = fsiv::compute_line_plane_triangulation(x_codes, axis, cparams, mask);
+            XYZ = fsiv::compute_line_plane_triangulation(x_codes, axis, tables, mask);
         }
         else
-            XYZ = fsiv::compute_line_line_triangulation(x_codes, y_codes, cparams, mask);
+        {
+            cv::Mat ray_dist;
+            XYZ = fsiv::compute_line_line_triangulation(x_codes, y_codes, tables, mask,
+                                                        ray_dist);
+            //Los rayos paralelos tienen distancia infinita y se descartan
+            //siempre: no tienen triangulación (XYZ queda a 0).
+            const double max_ray_dist = parser.get<double>("max_ray_dist");
+            mask = fsiv::clip_ray_distance(ray_dist, max_ray_dist > 0.0 ? max_ray_dist :
+                                           std::numeric_limits<double>::max(), mask);
+        }
 
         mask = fsiv::clip_XYZ_data(XYZ, -0.5, 0.5, -0.5, 0.5, -0.25, 0.25, mask);
         fsiv::save_XYZ_to_vrml(output, XYZ, sc->seq[0], mask);
@@ -3,6 +3,7 @@
 #include "bc_scanning.hpp"
 #include "cparams.hpp"
 #include "triangulation.hpp"
+#include "triangulation_tables.hpp"
 #include "projector.hpp"
 #include "capturer.hpp"
 #include "calibration.hpp"
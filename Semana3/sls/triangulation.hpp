@@ -2,6 +2,7 @@
 
 #include <opencv2/core.hpp>
 #include "cparams.hpp"
+#include "triangulation_tables.hpp"
 
 namespace fsiv {
 
@@ -17,6 +18,16 @@ cv::Mat compute_line_plane_triangulation(cv::Mat const&p_codes, int  axis,
                                          CParams const& cparams,
                                          const cv::Mat & mask=cv::Mat());
 
+/**
+ * @brief Calcula la triangulación recta-plano con unas tablas precalculadas.
+ * Los rayos de la cámara corrigen la distorsión si las tablas tienen los
+ * rayos de cada pixel (ver compute_triangulation_tables()).
+ * @see compute_line_plane_triangulation(cv::Mat const&, int, CParams const&, const cv::Mat&)
+ */
+cv::Mat compute_line_plane_triangulation(cv::Mat const&p_codes, int  axis,
+                                         TriangulationTables const& tables,
+                                         const cv::Mat & mask=cv::Mat());
+
 /**
  * @brief Calcula la triangulación con el esquema intersección recta-recta.
  * @param x_codes son los códigos decodificados de la coordenada x del proyector
@@ -30,6 +41,40 @@ cv::Mat compute_line_line_triangulation(cv::Mat const&x_codes,
                                         CParams const& cparams,
                                         const cv::Mat &mask = cv::Mat());
 
+/**
+ * @brief Calcula la triangulación recta-recta con unas tablas precalculadas.
+ * @see compute_line_line_triangulation(cv::Mat const&, cv::Mat const&, CParams const&, const cv::Mat&)
+ */
+cv::Mat compute_line_line_triangulation(cv::Mat const&x_codes,
+                                        cv::Mat const&y_codes,
+                                        TriangulationTables const& tables,
+                                        const cv::Mat &mask = cv::Mat());
+
+/**
+ * @brief Calcula la triangulación recta-recta y la distancia entre los rayos.
+ * El punto calculado es el punto medio del segmento más corto entre el rayo
+ * de la cámara y el del proyector. La distancia entre los rayos (0 si se
+ * cortan) sirve como medida de calidad (ver clip_ray_distance()). Si los
+ * rayos son paralelos la distancia es infinita y el punto queda a 0, así
+ * que clip_ray_distance() lo descarta con cualquier max_dist finito.
+ * @param ray_dist es la distancia (CV_64FC1) entre los rayos de cada pixel.
+ */
+cv::Mat compute_line_line_triangulation(cv::Mat const&x_codes,
+                                        cv::Mat const&y_codes,
+                                        TriangulationTables const& tables,
+                                        const cv::Mat &mask,
+                                        cv::Mat &ray_dist);
+
+/** @brief Elimina de una máscara de validez los puntos cuyos rayos
+ * cámara-proyector distan más de max_dist.
+ * @param ray_dist es la distancia entre los rayos de cada pixel.
+ * @param max_dist es la distancia máxima admisible (unidades WCS).
+ * @param v_mask es la máscara de validez actual. Si no se da se consideran que todos son válidos.
+ * @return la máscara 0/255 actualizada.
+ */
+cv::Mat clip_ray_distance(cv::Mat const& ray_dist, double max_dist,
+                          cv::Mat const& v_mask=cv::Mat());
+
 /** @brief Calcula las coordenadas XYZ en WCS de los puntos proyectados en el
  *     plano imagen de la cámara conocidas sus profundidades medias en WCS.
  * @param depth_m es el mapa de profundidad.
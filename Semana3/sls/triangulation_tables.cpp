@@ -0,0 +1,315 @@
+#include <fstream>
+#include <cstring>
+#include <opencv2/calib3d.hpp>
+#include "triangulation_tables.hpp"
+
+namespace fsiv {
+
+static const char tables_signature[8] = {'s', 'l', 's', 't', 'a', 'b', 'l', 'e'};
+static const std::uint32_t tables_version = 2;
+
+/** @brief Copia una matriz 3x3 en un array (fila a fila) de doubles. */
+static void
+get_matrix33(const cv::Mat &M_, double M[9])
+{
+    cv::Mat M64;
+    M_.convertTo(M64, CV_64F);
+    CV_Assert(M64.rows == 3 && M64.cols == 3);
+    for (int i = 0; i < 9; ++i)
+        M[i] = M64.at<double>(i / 3, i % 3);
+}
+
+/**
+ * @brief Obtiene la rotación y el centro proyectivo de una cámara.
+ * @param R es la matriz de rotación WCS->cámara (fila a fila).
+ * @param center es el centro proyectivo en WCS (-R^t * tvec).
+ */
+static void
+get_pose(const cv::Mat &rvec, const cv::Mat &tvec, double R[9], cv::Vec3d &center)
+{
+    cv::Mat R_, t;
+    cv::Rodrigues(rvec, R_);
+    get_matrix33(R_, R);
+    tvec.convertTo(t, CV_64F);
+    CV_Assert(t.total() == 3);
+    const double *tv = t.ptr<double>();
+    for (int i = 0; i < 3; ++i)
+        center[i] = -(R[i] * tv[0] + R[3 + i] * tv[1] + R[6 + i] * tv[2]);
+}
+
+/** @brief Obtiene la inversa de una matriz K de intrínsecos. */
+static void
+get_inverse_K(const cv::Mat &K, double Kinv[9])
+{
+    cv::Mat K64;
+    K.convertTo(K64, CV_64F);
+    get_matrix33(K64.inv(), Kinv);
+}
+
+/** @brief Calcula R^t * v siendo R una matriz (fila a fila). */
+static void
+rotate_back(const double R[9], const double v[3], double out[3])
+{
+    for (int i = 0; i < 3; ++i)
+        out[i] = R[i] * v[0] + R[3 + i] * v[1] + R[6 + i] * v[2];
+}
+
+ProjectorPlane
+compute_projector_plane(TriangulationTables const &tables, int axis, double code)
+{
+    //Normal del plano en el sistema del proyector: el plano contiene el
+    //centro del proyector y la línea x=code (axis==1) o y=code (axis==0).
+    double n_p[3];
+    if (axis == 1)
+    {
+        n_p[0] = 1.0;
+        n_p[1] = 0.0;
+        n_p[2] = -(tables.prj_Kinv[0] * code + tables.prj_Kinv[2]);
+    }
+    else
+    {
+        n_p[0] = 0.0;
+        n_p[1] = 1.0;
+        n_p[2] = -(tables.prj_Kinv[4] * code + tables.prj_Kinv[5]);
+    }
+    ProjectorPlane plane;
+    rotate_back(tables.prj_R, n_p, plane.n);
+    plane.d = 0.0;
+    for (int i = 0; i < 3; ++i)
+        plane.d += plane.n[i] * (tables.prj_center[i] - tables.cam_center[i]);
+    return plane;
+}
+
+cv::Vec3d
+compute_projector_ray(TriangulationTables const &tables, double x_code, double y_code)
+{
+    const double *Kinv = tables.prj_Kinv;
+    const double v[3] = {Kinv[0] * x_code + Kinv[1] * y_code + Kinv[2],
+                         Kinv[3] * x_code + Kinv[4] * y_code + Kinv[5],
+                         Kinv[6] * x_code + Kinv[7] * y_code + Kinv[8]};
+    cv::Vec3d ray;
+    rotate_back(tables.prj_R, v, &ray[0]);
+    return ray;
+}
+
+void
+compute_triangulation_tables(CParams const &cparams, TriangulationTables &tables,
+                             bool pixel_rays)
+{
+    tables.cam_size = cparams.cam_size;
+    tables.prj_size = cparams.prj_size;
+    double R_cam[9], cam_Kinv[9];
+    get_pose(cparams.cam_rvec, cparams.cam_tvec, R_cam, tables.cam_center);
+    get_pose(cparams.prj_rvec, cparams.prj_tvec, tables.prj_R, tables.prj_center);
+    get_inverse_K(cparams.cam_K, cam_Kinv);
+    get_inverse_K(cparams.prj_K, tables.prj_Kinv);
+
+    //Rayo de un pixel: v = R_cam^t * K_cam^-1 * (x,y,1).
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            tables.cam_A[3 * i + j] = R_cam[i] * cam_Kinv[j] + R_cam[3 + i] * cam_Kinv[3 + j] +
+                                      R_cam[6 + i] * cam_Kinv[6 + j];
+
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        std::vector<ProjectorPlane> &planes = tables.planes[axis];
+        planes.resize(axis == 1 ? tables.prj_size.width : tables.prj_size.height);
+        for (size_t code = 0; code < planes.size(); ++code)
+            planes[code] = compute_projector_plane(tables, axis, double(code));
+    }
+
+    //El rayo es lineal en (x,y): R^t*K^-1*(x,0,0) + R^t*K^-1*(0,y,1).
+    tables.prj_rays[1].resize(tables.prj_size.width);
+    for (size_t x = 0; x < tables.prj_rays[1].size(); ++x)
+    {
+        const double v[3] = {tables.prj_Kinv[0] * x, tables.prj_Kinv[3] * x,
+                             tables.prj_Kinv[6] * x};
+        rotate_back(tables.prj_R, v, &tables.prj_rays[1][x][0]);
+    }
+    tables.prj_rays[0].resize(tables.prj_size.height);
+    for (size_t y = 0; y < tables.prj_rays[0].size(); ++y)
+    {
+        const double *Kinv = tables.prj_Kinv;
+        const double v[3] = {Kinv[1] * y + Kinv[2], Kinv[4] * y + Kinv[5],
+                             Kinv[7] * y + Kinv[8]};
+        rotate_back(tables.prj_R, v, &tables.prj_rays[0][y][0]);
+    }
+
+    tables.cam_rays.release();
+    if (!pixel_rays)
+        return;
+    //Las coordenadas normalizadas sin distorsión de cada pixel se pasan a WCS.
+    tables.cam_rays = cv::Mat(tables.cam_size, CV_64FC3);
+    const cv::Mat K = cparams.cam_K, D = cparams.cam_D;
+    cv::parallel_for_(cv::Range(0, tables.cam_size.height), [&](const cv::Range &rows)
+    {
+        std::vector<cv::Point2d> pixels(tables.cam_size.width);
+        cv::Mat normalized;
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            for (int x = 0; x < tables.cam_size.width; ++x)
+                pixels[x] = cv::Point2d(x, y);
+            cv::undistortPoints(cv::Mat(pixels), normalized, K, D);
+            const cv::Point2d *p = normalized.ptr<cv::Point2d>();
+            cv::Vec3d *ray = tables.cam_rays.ptr<cv::Vec3d>(y);
+            for (int x = 0; x < tables.cam_size.width; ++x)
+            {
+                const double v[3] = {p[x].x, p[x].y, 1.0};
+                rotate_back(R_cam, v, &ray[x][0]);
+            }
+        }
+    });
+}
+
+bool
+compute_file_hash(const std::string &fname, std::uint64_t &hash)
+{
+    std::ifstream in(fname, std::ios::binary);
+    if (!in)
+        return false;
+    hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+    {
+        for (std::streamsize i = 0; i < in.gcount(); ++i)
+        {
+            hash ^= std::uint8_t(buffer[i]);
+            hash *= 1099511628211ull;
+        }
+    }
+    return in.eof();
+}
+
+template <class T>
+static void
+write_raw(std::ostream &out, const T *data, const size_t n)
+{
+    out.write(reinterpret_cast<const char *>(data), n * sizeof(T));
+}
+
+template <class T>
+static bool
+read_raw(std::istream &in, T *data, const size_t n)
+{
+    return bool(in.read(reinterpret_cast<char *>(data), n * sizeof(T)));
+}
+
+bool
+save_triangulation_tables(const std::string &fname, TriangulationTables const &tables,
+                          std::uint64_t key)
+{
+    std::ofstream out(fname, std::ios::binary);
+    if (!out)
+        return false;
+    const std::int32_t sizes[4] = {tables.cam_size.width, tables.cam_size.height,
+                                   tables.prj_size.width, tables.prj_size.height};
+    const std::uint8_t has_rays = tables.cam_rays.empty() ? 0 : 1;
+    write_raw(out, tables_signature, 8);
+    write_raw(out, &tables_version, 1);
+    write_raw(out, &key, 1);
+    write_raw(out, sizes, 4);
+    write_raw(out, &tables.cam_center[0], 3);
+    write_raw(out, &tables.prj_center[0], 3);
+    write_raw(out, tables.cam_A, 9);
+    write_raw(out, tables.prj_R, 9);
+    write_raw(out, tables.prj_Kinv, 9);
+    write_raw(out, &has_rays, 1);
+    if (has_rays)
+    {
+        CV_Assert(tables.cam_rays.type() == CV_64FC3 &&
+                  tables.cam_rays.size() == tables.cam_size);
+        for (int y = 0; y < tables.cam_size.height; ++y)
+            write_raw(out, tables.cam_rays.ptr<double>(y), 3 * size_t(tables.cam_size.width));
+    }
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        const std::uint32_t n = tables.planes[axis].size();
+        write_raw(out, &n, 1);
+        if (n > 0)
+            write_raw(out, &tables.planes[axis][0], n);
+    }
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        const std::uint32_t n = tables.prj_rays[axis].size();
+        write_raw(out, &n, 1);
+        for (size_t i = 0; i < n; ++i)
+            write_raw(out, &tables.prj_rays[axis][i][0], 3);
+    }
+    return bool(out);
+}
+
+bool
+load_triangulation_tables(const std::string &fname, TriangulationTables &tables,
+                          std::uint64_t key)
+{
+    std::ifstream in(fname, std::ios::binary);
+    char signature[8];
+    std::uint32_t version = 0;
+    std::uint64_t file_key = 0;
+    std::int32_t sizes[4];
+    if (!in || !read_raw(in, signature, 8) || !read_raw(in, &version, 1) ||
+            !read_raw(in, &file_key, 1) || !read_raw(in, sizes, 4))
+        return false;
+    if (std::memcmp(signature, tables_signature, 8) != 0 ||
+            version != tables_version || file_key != key ||
+            sizes[0] < 0 || sizes[1] < 0 || sizes[2] < 0 || sizes[3] < 0)
+        return false;
+    TriangulationTables t;
+    t.cam_size = cv::Size(sizes[0], sizes[1]);
+    t.prj_size = cv::Size(sizes[2], sizes[3]);
+    std::uint8_t has_rays = 0;
+    if (!read_raw(in, &t.cam_center[0], 3) || !read_raw(in, &t.prj_center[0], 3) ||
+            !read_raw(in, t.cam_A, 9) || !read_raw(in, t.prj_R, 9) ||
+            !read_raw(in, t.prj_Kinv, 9) || !read_raw(in, &has_rays, 1))
+        return false;
+    if (has_rays)
+    {
+        t.cam_rays = cv::Mat(t.cam_size, CV_64FC3);
+        for (int y = 0; y < t.cam_size.height; ++y)
+            if (!read_raw(in, t.cam_rays.ptr<double>(y), 3 * size_t(t.cam_size.width)))
+                return false;
+    }
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        std::uint32_t n = 0;
+        if (!read_raw(in, &n, 1) ||
+                n != size_t(axis == 1 ? t.prj_size.width : t.prj_size.height))
+            return false;
+        t.planes[axis].resize(n);
+        if (n > 0 && !read_raw(in, &t.planes[axis][0], n))
+            return false;
+    }
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        std::uint32_t n = 0;
+        if (!read_raw(in, &n, 1) || n != t.planes[axis].size())
+            return false;
+        t.prj_rays[axis].resize(n);
+        for (size_t i = 0; i < n; ++i)
+            if (!read_raw(in, &t.prj_rays[axis][i][0], 3))
+                return false;
+    }
+    tables = t;
+    return true;
+}
+
+bool
+load_triangulation_tables_cached(const std::string &cparams_fname,
+                                 const std::string &cache_fname,
+                                 TriangulationTables &tables)
+{
+    std::uint64_t key = 0;
+    if (!compute_file_hash(cparams_fname, key))
+        return false;
+    if (load_triangulation_tables(cache_fname, tables, key))
+        return true;
+    CParams cparams;
+    if (!load_calibration_parameters_from_file(cparams_fname, cparams))
+        return false;
+    compute_triangulation_tables(cparams, tables);
+    //Si no se puede escribir la caché las tablas siguen siendo válidas.
+    save_triangulation_tables(cache_fname, tables, key);
+    return true;
+}
+
+} //namespace fsiv
@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include "cparams.hpp"
+
+namespace fsiv {
+
+/**
+ * @brief Plano de luz del proyector n·(X - q_l) = d en WCS.
+ * La distancia d está referida al centro de la cámara q_l, así la
+ * intersección con el rayo q_l + lambda*v es lambda = d / (n·v).
+ */
+struct ProjectorPlane
+{
+    double n[3];
+    double d;
+};
+
+/**
+ * @brief Geometría precalculada de un sistema cámara-proyector.
+ *
+ * Sólo depende de la calibración, así que se puede calcular una vez y usarla
+ * para todos los escaneos (ver load_triangulation_tables_cached()).
+ */
+struct TriangulationTables
+{
+    cv::Size cam_size;
+    cv::Size prj_size;
+    cv::Vec3d cam_center; /*!< centro proyectivo de la cámara (WCS).*/
+    cv::Vec3d prj_center; /*!< centro proyectivo del proyector (WCS).*/
+    double cam_A[9];      /*!< rayo de un pixel sin distorsión v = A*(x,y,1) (fila a fila).*/
+    double prj_R[9];      /*!< rotación WCS->proyector (fila a fila).*/
+    double prj_Kinv[9];   /*!< inversa de los intrínsecos del proyector (fila a fila).*/
+    /** @brief Rayos (WCS) de cada pixel de la cámara corrigiendo la distorsión
+     * de la lente (CV_64FC3 de tamaño cam_size). Si está vacía se usa cam_A. */
+    cv::Mat cam_rays;
+    /** @brief Planos de cada código del proyector: planes[0] los horizontales
+     * (código y, axis=0) y planes[1] los verticales (código x, axis=1). */
+    std::vector<ProjectorPlane> planes[2];
+    /** @brief Rayos (WCS) del proyector por componentes: el rayo del pixel
+     * (x,y) del proyector es prj_rays[1][x] + prj_rays[0][y]. */
+    std::vector<cv::Vec3d> prj_rays[2];
+};
+
+/**
+ * @brief Calcula las tablas de triangulación de una calibración.
+ * @param cparams son los parámetros de calibración.
+ * @param tables son las tablas calculadas.
+ * @param pixel_rays indica si calcular los rayos de cada pixel corrigiendo la
+ *  distorsión de la cámara. Si es false sólo se usa el modelo pinhole.
+ */
+void compute_triangulation_tables(CParams const& cparams, TriangulationTables& tables,
+                                  bool pixel_rays=true);
+
+/**
+ * @brief Calcula el plano del proyector de un código.
+ * Sirve para los códigos que no están en las tablas.
+ */
+ProjectorPlane compute_projector_plane(TriangulationTables const& tables, int axis,
+                                       double code);
+
+/**
+ * @brief Calcula el rayo (WCS) del proyector que pasa por un pixel suyo.
+ * Sirve para los códigos que no están en las tablas.
+ */
+cv::Vec3d compute_projector_ray(TriangulationTables const& tables, double x_code,
+                                double y_code);
+
+/**
+ * @brief Calcula un hash (FNV-1a de 64 bits) del contenido de un fichero.
+ * @return false si no se pudo leer el fichero.
+ */
+bool compute_file_hash(const std::string& fname, std::uint64_t& hash);
+
+/**
+ * @brief Guarda las tablas en un fichero binario de caché.
+ * @param key identifica la calibración (p.e. el hash de su fichero).
+ * @warning el formato usa el orden de bytes de la máquina.
+ */
+bool save_triangulation_tables(const std::string& fname,
+                               TriangulationTables const& tables,
+                               std::uint64_t key);
+
+/**
+ * @brief Carga las tablas de un fichero binario de caché.
+ * @return false si no existe, no es válido o su clave no es key.
+ */
+bool load_triangulation_tables(const std::string& fname,
+                               TriangulationTables& tables,
+                               std::uint64_t key);
+
+/**
+ * @brief Obtiene las tablas de una calibración usando un fichero de caché.
+ * Si la caché no existe o es de otra calibración (distinto hash del fichero
+ * de calibración), se calculan las tablas y se guardan en la caché.
+ * @return false si no se pudo leer la calibración.
+ */
+bool load_triangulation_tables_cached(const std::string& cparams_fname,
+                                      const std::string& cache_fname,
+                                      TriangulationTables& tables);
+
+} //namespace fsiv